@@ -6,9 +6,11 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
 	android/com_android_inputmethod_pinyin_PinyinDecoderService.cpp \
+	share/bigram.cpp \
 	share/dictbuilder.cpp \
 	share/dictlist.cpp \
 	share/dicttrie.cpp \
+	share/learnqueue.cpp \
 	share/lpicache.cpp \
 	share/matrixsearch.cpp \
 	share/mystdlib.cpp \
@@ -32,10 +32,12 @@ extern "C" {
 using namespace ime_pinyin;
 
 #define RET_BUF_LEN 256
+#define NBEST_BUF_LEN 32
 
 static char16 retbuf[RET_BUF_LEN];
 static char16 (*predict_buf)[kMaxPredictSize + 1] = NULL;
 static size_t predict_len;
+static NBestSentence nbest_buf[NBEST_BUF_LEN];
 
 static Sync sync_worker;
 
@@ -187,6 +189,103 @@ JNIEXPORT jstring JNICALL nativeImGetChoice(JNIEnv *env, jclass clazz,
   }
 }
 
+// Fill a direct buffer with a page of strings, so that a page can be got in
+// one JNI call. The buffer starts with num + 1 int offsets, counted in char16,
+// into the UTF-16 payload which follows them; the length of the i-th string is
+// offsets[i + 1] - offsets[i]. All values are in native byte order.
+// If candidates is true, the strings are the candidates from start; otherwise
+// they are the predicted items from start.
+// Return the number of strings filled, which is less than num when the
+// buffer is full.
+static jint fill_page_buffer(JNIEnv *env, jobject page_buf, jint start,
+                             jint num, bool candidates) {
+  char *buf = (char*)(*env).GetDirectBufferAddress(page_buf);
+  jlong capacity = (*env).GetDirectBufferCapacity(page_buf);
+  if (NULL == buf || start < 0 || num <= 0)
+    return 0;
+
+  size_t head_size = (size_t)(num + 1) * sizeof(jint);
+  if (capacity < 0 || (size_t)capacity < head_size)
+    return 0;
+
+  jint *offsets = (jint*)buf;
+  char16 *payload = (char16*)(buf + head_size);
+  size_t payload_len = ((size_t)capacity - head_size) / sizeof(char16);
+  size_t used = 0;
+
+  offsets[0] = 0;
+  jint filled = 0;
+  for (; filled < num; filled++) {
+    const char16 *str = retbuf;
+    size_t len = 0;
+    if (candidates) {
+      if (im_get_candidate(start + filled, retbuf, RET_BUF_LEN))
+        len = utf16_strlen(retbuf);
+    } else if ((size_t)(start + filled) < predict_len) {
+      str = predict_buf[start + filled];
+      len = utf16_strlen(str);
+    }
+
+    if (used + len > payload_len)
+      break;
+    memcpy(payload + used, str, len * sizeof(char16));
+    used += len;
+    offsets[filled + 1] = used;
+  }
+  return filled;
+}
+
+JNIEXPORT jint JNICALL nativeImGetChoicesToBuffer(JNIEnv *env, jclass clazz,
+                                                  jobject page_buf,
+                                                  jint choices_start,
+                                                  jint choices_num) {
+  return fill_page_buffer(env, page_buf, choices_start, choices_num, true);
+}
+
+// Fill the byte array with the num best sentences. Each sentence is a float
+// score, an int number of lemmas L, L + 1 int Pinyin starts, L + 1 int Hanzi
+// starts and the UTF-16 string, padded to a multiple of 4 bytes. All values
+// are in native byte order. Return the number of sentences filled, which is
+// less than num when there are fewer sentences or the array is full.
+JNIEXPORT jint JNICALL nativeImGetNBest(JNIEnv *env, jclass clazz, jint num,
+                                        jbyteArray nbest) {
+  if (num <= 0)
+    return 0;
+  if (num > NBEST_BUF_LEN)
+    num = NBEST_BUF_LEN;
+  size_t sent_num = im_get_nbest(nbest_buf, num);
+
+  jbyte *ptr = (*env).GetByteArrayElements(nbest, 0);
+  size_t size = (*env).GetArrayLength(nbest);
+  size_t used = 0;
+  jint filled = 0;
+  for (; (size_t)filled < sent_num; filled++) {
+    NBestSentence *sent = nbest_buf + filled;
+    size_t lma_num = sent->lma_num;
+    size_t str_len = sent->hz_start[lma_num];
+    size_t sent_size = (2 + 2 * (lma_num + 1)) * sizeof(jint) +
+                       ((str_len + 1) & ~1) * sizeof(char16);
+    if (size - used < sent_size)
+      break;
+
+    jint *head = (jint*)(ptr + used);
+    memcpy(head, &sent->score, sizeof(jint));
+    head[1] = lma_num;
+    for (size_t i = 0; i <= lma_num; i++) {
+      head[2 + i] = sent->py_start[i];
+      head[3 + lma_num + i] = sent->hz_start[i];
+    }
+    char16 *str = (char16*)(head + 2 * (lma_num + 2));
+    memcpy(str, sent->str, str_len * sizeof(char16));
+    if (str_len & 1)
+      str[str_len] = 0;
+    used += sent_size;
+  }
+
+  (*env).ReleaseByteArrayElements(nbest, ptr, 0);
+  return filled;
+}
+
 JNIEXPORT jint JNICALL nativeImChoose(JNIEnv *env, jclass clazz,
                                       jint choice_id) {
   return im_choose(choice_id);
@@ -212,6 +311,44 @@ JNIEXPORT jboolean JNICALL nativeImFlushCache(JNIEnv *env, jclass clazz) {
   return JNI_TRUE;
 }
 
+JNIEXPORT jboolean JNICALL nativeImDefragmentUserDict(JNIEnv *env,
+                                                      jclass clazz) {
+  if (im_defragment_user_dict())
+    return JNI_TRUE;
+
+  return JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL nativeImSetMemoryCap(JNIEnv *env, jclass clazz,
+                                                jint cap) {
+  if (im_set_memory_cap(cap > 0 ? static_cast<size_t>(cap) : 0))
+    return JNI_TRUE;
+
+  return JNI_FALSE;
+}
+
+// Return the fields of MemStats in order, with reduced as 0 or 1, or null
+// if the decoder is not open.
+JNIEXPORT jintArray JNICALL nativeImGetMemoryStats(JNIEnv *env,
+                                                   jclass clazz) {
+  MemStats stats;
+  if (!im_get_memory_stats(&stats))
+    return NULL;
+
+  jint values[] = {
+    (jint)stats.spl_trie, (jint)stats.sys_dict, (jint)stats.ngram,
+    (jint)stats.bigram, (jint)stats.user_dict, (jint)stats.lpi_cache,
+    (jint)stats.search, (jint)stats.total, (jint)stats.cap,
+    stats.reduced ? 1 : 0
+  };
+  size_t len = sizeof(values) / sizeof(values[0]);
+  jintArray arr = (*env).NewIntArray(len);
+  if (NULL != arr)
+    (*env).SetIntArrayRegion(arr, 0, len, values);
+
+  return arr;
+}
+
 JNIEXPORT jint JNICALL nativeImGetPredictsNum(JNIEnv *env, jclass clazz,
                                               jstring fixed_str) {
   char16 *fixed_ptr = (char16*)(*env).GetStringChars(fixed_str, false);
@@ -246,6 +383,13 @@ JNIEXPORT jstring JNICALL nativeImGetPredictItem(JNIEnv *env, jclass clazz,
   return retstr;
 }
 
+JNIEXPORT jint JNICALL nativeImGetPredictsToBuffer(JNIEnv *env, jclass clazz,
+                                                   jobject page_buf,
+                                                   jint predicts_start,
+                                                   jint predicts_num) {
+  return fill_page_buffer(env, page_buf, predicts_start, predicts_num, false);
+}
+
 JNIEXPORT jboolean JNICALL nativeSyncBegin(JNIEnv *env, jclass clazz,
                                            jbyteArray dict_file) {
   jbyte *file_name = (*env).GetByteArrayElements(dict_file, 0);
@@ -291,6 +435,32 @@ JNIEXPORT jstring JNICALL nativeSyncGetLemmas(JNIEnv *env, jclass clazz) {
   return retstr;
 }
 
+JNIEXPORT jint JNICALL nativeSyncPutLemmasChunk(JNIEnv *env, jclass clazz,
+                                                jbyteArray chunk, jint len) {
+  jbyte *ptr = (*env).GetByteArrayElements(chunk, 0);
+  if ((jint)(*env).GetArrayLength(chunk) < len)
+    len = (*env).GetArrayLength(chunk);
+
+  int used = sync_worker.put_lemmas_chunk((const uint8*)ptr, len);
+
+  (*env).ReleaseByteArrayElements(chunk, ptr, JNI_ABORT);
+
+  return used;
+}
+
+JNIEXPORT jint JNICALL nativeSyncGetLemmasChunk(JNIEnv *env, jclass clazz,
+                                                jint token, jbyteArray chunk) {
+  jbyte *ptr = (*env).GetByteArrayElements(chunk, 0);
+  int size = (*env).GetArrayLength(chunk);
+
+  uint32 next = sync_worker.get_lemmas_chunk(token, (uint8*)ptr, size);
+
+  (*env).ReleaseByteArrayElements(chunk, ptr, 0);
+
+  // UserDict::kUserDictSyncEnd, the end of a pull, is -1 in Java
+  return (jint)next;
+}
+
 JNIEXPORT jint JNICALL nativeSyncGetLastCount(JNIEnv *env, jclass clazz) {
   return sync_worker.get_last_got_count();
 }
@@ -334,6 +504,10 @@ static JNINativeMethod gMethods[] = {
             (void*) nativeImGetSplStart },
     { "nativeImGetChoice", "(I)Ljava/lang/String;",
             (void*) nativeImGetChoice },
+    { "nativeImGetChoicesToBuffer", "(Ljava/nio/ByteBuffer;II)I",
+            (void*) nativeImGetChoicesToBuffer },
+    { "nativeImGetNBest", "(I[B)I",
+            (void*) nativeImGetNBest },
     { "nativeImChoose", "(I)I",
             (void*) nativeImChoose },
     { "nativeImCancelLastChoice", "()I",
@@ -344,10 +518,18 @@ static JNINativeMethod gMethods[] = {
             (void*) nativeImGetPredictsNum },
     { "nativeImGetPredictItem", "(I)Ljava/lang/String;",
             (void*) nativeImGetPredictItem },
+    { "nativeImGetPredictsToBuffer", "(Ljava/nio/ByteBuffer;II)I",
+            (void*) nativeImGetPredictsToBuffer },
     { "nativeImCancelInput", "()Z",
             (void*) nativeImCancelInput },
     { "nativeImFlushCache", "()Z",
             (void*) nativeImFlushCache },
+    { "nativeImDefragmentUserDict", "()Z",
+            (void*) nativeImDefragmentUserDict },
+    { "nativeImSetMemoryCap", "(I)Z",
+            (void*) nativeImSetMemoryCap },
+    { "nativeImGetMemoryStats", "()[I",
+            (void*) nativeImGetMemoryStats },
     /* <<----Functions for Pinyin-to-hanzi decoding end------------- */
 
     /* ------Functions for sync begin----------------------------->> */
@@ -359,6 +541,10 @@ static JNINativeMethod gMethods[] = {
             (void*) nativeSyncPutLemmas },
     { "nativeSyncGetLemmas", "()Ljava/lang/String;",
             (void*) nativeSyncGetLemmas },
+    { "nativeSyncPutLemmasChunk", "([BI)I",
+            (void*) nativeSyncPutLemmasChunk },
+    { "nativeSyncGetLemmasChunk", "(I[B)I",
+            (void*) nativeSyncGetLemmasChunk },
     { "nativeSyncGetLastCount", "()I",
             (void*) nativeSyncGetLastCount },
     { "nativeSyncGetTotalCount", "()I",
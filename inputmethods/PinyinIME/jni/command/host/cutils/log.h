@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The Android log functions are not available on the host, so the tools in
+// this directory are built with this header, which drops the messages.
+
+#ifndef PINYINIME_COMMAND_HOST_CUTILS_LOG_H__
+#define PINYINIME_COMMAND_HOST_CUTILS_LOG_H__
+
+#define LOGD(...) ((void)0)
+#define LOGE(...) ((void)0)
+#define LOGI(...) ((void)0)
+#define LOGV(...) ((void)0)
+#define LOGW(...) ((void)0)
+#define LOG_FATAL_IF(cond, ...) ((void)0)
+
+#endif  // PINYINIME_COMMAND_HOST_CUTILS_LOG_H__
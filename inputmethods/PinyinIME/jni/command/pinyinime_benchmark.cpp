@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/matrixsearch.h"
+#include "../include/utf16char.h"
+
+using namespace ime_pinyin;
+
+/**
+ * Replay typing traces against the decoder and report the latency of each
+ * kind of operation, the high-water marks of the search pools, the matrix
+ * nodes expanded per step, and the memory footprint of the process.
+ *
+ * Usage:
+ *   pinyinime_benchmark <trace> [system dict] [user dict] [rounds]
+ *                       [beam width] [beam score gap]
+ *
+ * Each line of the trace is a typing session, and each character of it is a
+ * key:
+ *   a-z and '   Add a Pinyin character and search again.
+ *   <           Delete the last Pinyin character.
+ *   0-9         Choose the given candidate on the first page.
+ *   space       Choose the first candidate.
+ * When all Pinyin characters are converted, the result is committed: the
+ * predictions for it are fetched and the next key starts a new session. An
+ * uncommitted session is committed by choosing the first candidate at the
+ * end of the line. Empty lines and lines starting with '#' are skipped.
+ *
+ * The user dictionary learns from the choices, so several rounds show how
+ * the latency changes as it grows. The beam width and score gap of the
+ * sentence decoding default to those of MatrixSearch, see set_beam().
+ */
+
+namespace {
+
+enum OpType {
+  kOpSearch,
+  kOpDelete,
+  kOpChoose,
+  kOpCandidates,
+  kOpPredict,
+  kOpFlush,
+  kOpNum
+};
+
+const char *kOpNames[kOpNum] = {
+  "search", "delete", "choose", "candidates", "predict", "flush"
+};
+
+// Latencies are counted in buckets of powers of 2 in microseconds. Bucket i
+// holds latencies in [2^(i-1), 2^i), and bucket 0 those less than 1us.
+const size_t kBucketNum = 24;
+
+// How many candidates are fetched after each operation, as a candidate page.
+const size_t kCandPageSize = 10;
+
+const size_t kMaxLineLen = 1024;
+
+const size_t kMaxPredictNum = 500;
+
+struct OpStat {
+  size_t num;
+  double total_us;
+  double max_us;
+  size_t buckets[kBucketNum];
+};
+
+OpStat op_stats[kOpNum];
+
+size_t mtrx_nd_pool_max = 0;
+size_t dmi_pool_max = 0;
+
+// Matrix nodes expanded for the step added by each search key.
+size_t expanded_steps = 0;
+double expanded_total = 0;
+size_t expanded_max = 0;
+
+char16 predict_buf[kMaxPredictNum][kMaxPredictSize + 1];
+
+double now_us() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+void add_sample(OpType op, double us) {
+  OpStat &stat = op_stats[op];
+  stat.num++;
+  stat.total_us += us;
+  if (us > stat.max_us)
+    stat.max_us = us;
+
+  size_t bucket = 0;
+  while (bucket + 1 < kBucketNum && us >= static_cast<double>(1 << bucket))
+    bucket++;
+  stat.buckets[bucket]++;
+}
+
+// Return the upper bound of the bucket which holds the given percentile.
+double get_percentile(const OpStat &stat, double percent) {
+  size_t target = static_cast<size_t>(stat.num * percent / 100.0);
+  size_t num = 0;
+  for (size_t bucket = 0; bucket < kBucketNum; bucket++) {
+    num += stat.buckets[bucket];
+    if (num > target)
+      return static_cast<double>(1 << bucket);
+  }
+  return stat.max_us;
+}
+
+void update_pool_stats(MatrixSearch *ms) {
+  size_t used = ms->get_mtrx_nd_pool_used();
+  if (used > mtrx_nd_pool_max)
+    mtrx_nd_pool_max = used;
+  used = ms->get_dmi_pool_used();
+  if (used > dmi_pool_max)
+    dmi_pool_max = used;
+}
+
+// Count the nodes expanded for the last step, which the search has just
+// extended.
+void update_expanded_stats(MatrixSearch *ms) {
+  size_t decoded_len;
+  ms->get_pystr(&decoded_len);
+  if (0 == decoded_len)
+    return;
+  size_t expanded = ms->get_mtrx_nd_expanded(decoded_len);
+  expanded_steps++;
+  expanded_total += expanded;
+  if (expanded > expanded_max)
+    expanded_max = expanded;
+}
+
+// Fetch a page of candidates, as the candidate view does after each key.
+void fetch_candidates(MatrixSearch *ms, size_t cand_num) {
+  char16 cand_buf[kMaxLemmaSize * 4 + 1];
+  double start = now_us();
+  for (size_t pos = 0; pos < cand_num && pos < kCandPageSize; pos++)
+    ms->get_candidate(pos, cand_buf, kMaxLemmaSize * 4 + 1);
+  add_sample(kOpCandidates, now_us() - start);
+}
+
+// Return true if all Pinyin characters have been converted.
+bool is_committed(MatrixSearch *ms) {
+  const uint16 *spl_start;
+  size_t spl_num = ms->get_spl_start(spl_start);
+  size_t decoded_len;
+  ms->get_pystr(&decoded_len);
+  return decoded_len > 0 && ms->get_fixedlen() >= spl_num;
+}
+
+void commit(MatrixSearch *ms) {
+  char16 sent[kMaxSearchSteps + 1];
+  if (NULL != ms->get_candidate0(sent, kMaxSearchSteps + 1, NULL, false)) {
+    size_t len = utf16_strlen(sent);
+    const char16 *his = sent;
+    if (len > kMaxPredictSize)
+      his += len - kMaxPredictSize;
+
+    double start = now_us();
+    ms->get_predicts(his, predict_buf, kMaxPredictNum);
+    add_sample(kOpPredict, now_us() - start);
+  }
+  ms->reset_search();
+}
+
+size_t choose(MatrixSearch *ms, size_t cand_id, size_t cand_num) {
+  if (cand_id >= cand_num)
+    cand_id = 0;
+  double start = now_us();
+  cand_num = ms->choose(cand_id);
+  add_sample(kOpChoose, now_us() - start);
+  update_pool_stats(ms);
+  fetch_candidates(ms, cand_num);
+  return cand_num;
+}
+
+// Replay one line of the trace. Return the number of keys replayed.
+size_t replay_line(MatrixSearch *ms, const char *line) {
+  char py_buf[kMaxLineLen];
+  size_t py_len = 0;
+  size_t cand_num = 0;
+  size_t key_num = 0;
+
+  ms->reset_search();
+  for (const char *key = line; '\0' != *key; key++) {
+    char ch = *key;
+    bool searched = true;
+    if ((ch >= 'a' && ch <= 'z') || '\'' == ch) {
+      if (py_len + 1 >= kMaxLineLen)
+        continue;
+      py_buf[py_len++] = ch;
+      py_buf[py_len] = '\0';
+      double start = now_us();
+      ms->search(py_buf, py_len);
+      cand_num = ms->get_candidate_num();
+      add_sample(kOpSearch, now_us() - start);
+      update_expanded_stats(ms);
+    } else if ('<' == ch) {
+      if (0 == py_len)
+        continue;
+      double start = now_us();
+      cand_num = ms->delsearch(py_len - 1, false, false);
+      add_sample(kOpDelete, now_us() - start);
+      size_t decoded_len;
+      const char *py = ms->get_pystr(&decoded_len);
+      py_len = strlen(py);
+      memcpy(py_buf, py, py_len + 1);
+    } else if ((ch >= '0' && ch <= '9') || ' ' == ch) {
+      if (0 == py_len)
+        continue;
+      cand_num = choose(ms, ' ' == ch ? 0 : ch - '0', cand_num);
+      searched = false;
+    } else {
+      continue;
+    }
+    key_num++;
+
+    if (searched) {
+      update_pool_stats(ms);
+      fetch_candidates(ms, cand_num);
+    }
+
+    if (py_len > 0 && is_committed(ms)) {
+      commit(ms);
+      py_len = 0;
+      cand_num = 0;
+    }
+  }
+
+  // Commit the rest by choosing the first candidates.
+  for (size_t pos = 0; py_len > 0 && pos < kMaxSearchSteps; pos++) {
+    if (is_committed(ms)) {
+      commit(ms);
+      break;
+    }
+    cand_num = choose(ms, 0, cand_num);
+  }
+  return key_num;
+}
+
+// Print the VmRSS and VmHWM lines of /proc/self/status, if available.
+void print_memory(const char *when) {
+  printf("memory %s:", when);
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (NULL == fp) {
+    printf(" n/a\n");
+    return;
+  }
+  char line[256];
+  while (NULL != fgets(line, sizeof(line), fp)) {
+    if (0 == strncmp(line, "VmRSS:", 6) || 0 == strncmp(line, "VmHWM:", 6)) {
+      char *end = line + strlen(line);
+      while (end > line && ('\n' == end[-1] || ' ' == end[-1]))
+        *--end = '\0';
+      char *val = strchr(line, ':') + 1;
+      while (' ' == *val || '\t' == *val)
+        val++;
+      *strchr(line, ':') = '\0';
+      printf(" %s %s", line, val);
+    }
+  }
+  fclose(fp);
+  printf("\n");
+}
+
+void print_stats() {
+  printf("%-10s %8s %9s %8s %8s %8s %9s\n", "op", "count", "mean(us)",
+         "p50<", "p90<", "p99<", "max(us)");
+  for (size_t op = 0; op < kOpNum; op++) {
+    const OpStat &stat = op_stats[op];
+    if (0 == stat.num)
+      continue;
+    printf("%-10s %8zu %9.1f %8.0f %8.0f %8.0f %9.1f\n", kOpNames[op],
+           stat.num, stat.total_us / stat.num, get_percentile(stat, 50),
+           get_percentile(stat, 90), get_percentile(stat, 99), stat.max_us);
+  }
+
+  printf("\nhistograms, count of operations below each bound in us:\n");
+  for (size_t op = 0; op < kOpNum; op++) {
+    const OpStat &stat = op_stats[op];
+    if (0 == stat.num)
+      continue;
+    printf("%-10s", kOpNames[op]);
+    for (size_t bucket = 0; bucket < kBucketNum; bucket++) {
+      if (stat.buckets[bucket] > 0)
+        printf(" <%u:%zu", 1U << bucket, stat.buckets[bucket]);
+    }
+    printf("\n");
+  }
+
+  printf("\npool high-water marks: mtrx_nd %zu, dmi %zu\n", mtrx_nd_pool_max,
+         dmi_pool_max);
+  if (expanded_steps > 0) {
+    printf("matrix nodes expanded per step: mean %.1f, max %zu\n",
+           expanded_total / expanded_steps, expanded_max);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <trace> [system dict] [user dict] [rounds] "
+           "[beam width] [beam score gap]\n", argv[0]);
+    return -1;
+  }
+  const char *fn_trace = argv[1];
+  const char *fn_sys_dict = argc >= 3 ? argv[2] :
+                            "../../res/raw/dict_pinyin.dat";
+  const char *fn_usr_dict = argc >= 4 ? argv[3] : "benchmark_usr_dict.dat";
+  int rounds = argc >= 5 ? atoi(argv[4]) : 1;
+  size_t beam_width = argc >= 6 ? atoi(argv[5]) : 0;
+  float beam_score_gap = argc >= 7 ? atof(argv[6]) : 0;
+
+  memset(op_stats, 0, sizeof(op_stats));
+  print_memory("before loading");
+
+  MatrixSearch *ms = new MatrixSearch();
+  double start = now_us();
+  if (!ms->init(fn_sys_dict, fn_usr_dict)) {
+    printf("Failed to load %s and %s\n", fn_sys_dict, fn_usr_dict);
+    delete ms;
+    return -1;
+  }
+  printf("loading: %.1f ms\n", (now_us() - start) / 1000);
+  ms->set_beam(beam_width, beam_score_gap);
+  print_memory("after loading");
+
+  size_t key_num = 0;
+  size_t line_num = 0;
+  start = now_us();
+  for (int round = 0; round < rounds; round++) {
+    FILE *fp = fopen(fn_trace, "r");
+    if (NULL == fp) {
+      printf("Failed to open %s\n", fn_trace);
+      delete ms;
+      return -1;
+    }
+    char line[kMaxLineLen];
+    while (NULL != fgets(line, kMaxLineLen, fp)) {
+      if ('#' == line[0])
+        continue;
+      key_num += replay_line(ms, line);
+      line_num++;
+    }
+    fclose(fp);
+
+    double flush_start = now_us();
+    ms->flush_cache();
+    add_sample(kOpFlush, now_us() - flush_start);
+  }
+  double total_ms = (now_us() - start) / 1000;
+
+  printf("replayed %zu keys in %zu lines, %d round(s): %.1f ms\n\n", key_num,
+         line_num, rounds, total_ms);
+  print_stats();
+  print_memory("at the end");
+
+  ms->close();
+  delete ms;
+  return 0;
+}
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include "../include/bigram.h"
 #include "../include/dicttrie.h"
 
 using namespace ime_pinyin;
@@ -52,5 +53,21 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  // The bigram model is optional, built from a raw file of lemma pairs.
+  if (argc >= 4) {
+    Bigram *bigram = new Bigram();
+    size_t max_mb = argc >= 5 ? atoi(argv[4]) : Bigram::kDefaultBudgetMb;
+    success = bigram->build_bigram(argv[3], dict_trie, max_mb << 20) &&
+              bigram->save_bigram("../../res/raw/bigram_pinyin.dat");
+    delete bigram;
+
+    if (success) {
+      printf("Build bigram model successfully.\n");
+    } else {
+      printf("Build bigram model unsuccessfully.\n");
+      return -1;
+    }
+  }
+
   return 0;
 }
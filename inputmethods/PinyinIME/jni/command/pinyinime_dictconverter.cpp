@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include "../include/dicttrie.h"
+
+using namespace ime_pinyin;
+
+/**
+ * Convert a binary dictionary to the current layout. Old dictionaries are
+ * still loaded, but converted every time they are loaded. Make sure that
+ * ___BUILD_MODEL___ is defined in dictdef.h.
+ */
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    printf("Usage: %s <dictionary> <converted dictionary>\n", argv[0]);
+    return -1;
+  }
+
+  DictTrie* dict_trie = new DictTrie();
+  if (!dict_trie->load_dict(argv[1], 1, kSysDictIdEnd)) {
+    printf("Load dictionary unsuccessfully.\n");
+    return -1;
+  }
+
+  if (!dict_trie->save_dict(argv[2])) {
+    printf("Save dictionary unsuccessfully.\n");
+    return -1;
+  }
+
+  printf("Convert dictionary successfully.\n");
+  delete dict_trie;
+  return 0;
+}
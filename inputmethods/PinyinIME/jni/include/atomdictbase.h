@@ -263,6 +263,13 @@ class AtomDictBase {
    * if necessary.
    */
   virtual void flush_cache() = 0;
+
+  /**
+   * Get the memory used by this atom dictionary.
+   *
+   * @return The size in bytes of the buffers owned by this atom dictionary.
+   */
+  virtual size_t get_mem_size() = 0;
 };
 }
 
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PINYINIME_INCLUDE_BIGRAM_H__
+#define PINYINIME_INCLUDE_BIGRAM_H__
+
+#include <stdlib.h>
+#include "./dictdef.h"
+#include "./ngram.h"
+
+namespace ime_pinyin {
+
+#ifdef ___BUILD_MODEL___
+class DictTrie;
+#endif
+
+// Bigram model of the system lemmas. For a pair of lemmas (prev, cur), it
+// gives the difference between the bigram score of cur after prev and the
+// unigram score of cur, so that the decoder can add it to the unigram score
+// it already has. A cur not in the successor list of a known prev gets the
+// backoff penalty of prev, log(1 - lambda) of its Witten-Bell weight. Only a
+// prev not in the table falls back to the unigram score.
+//
+// The file has no pointers, so it is mapped into memory as it is:
+//   BigramHeader
+//   float codes[kCodeBookSize]        Quantized score differences.
+//   BigramSlot slots[slot_num]        Hash table keyed by prev, with the
+//                                     backoff penalty of each prev.
+//   uint32 items[item_num]            Successor lists, (cur << 8 | code),
+//                                     sorted by cur in each list.
+class Bigram {
+ public:
+  // The successor list of a lemma is limited to this length, so that a
+  // lookup takes a bounded number of steps.
+  static const size_t kMaxSuccessorNum = 255;
+
+  // The memory budget used if the caller does not give one, in MB.
+  static const size_t kDefaultBudgetMb = 2;
+
+ private:
+  static const uint32 kBigramMagic = 0x32474942;  // "BIG2"
+
+  struct BigramHeader {
+    uint32 magic;
+    // Number of slots in the hash table, a power of 2.
+    uint32 slot_num;
+    uint32 item_num;
+    // The smallest value in codes, never positive.
+    float min_delta;
+  };
+
+  struct BigramSlot {
+    // 0 means the slot is empty.
+    uint32 prev;
+    // (position in items << 8 | length of the list).
+    uint32 pos_num;
+    // The score difference of a cur not in the list, never negative.
+    float backoff;
+  };
+
+  void *buf_;
+  size_t buf_size_;
+  // Whether buf_ is mapped from a file or allocated.
+  bool mapped_;
+
+  const BigramHeader *header_;
+  const float *codes_;
+  const BigramSlot *slots_;
+  const uint32 *items_;
+
+  bool attach(size_t size);
+
+  static inline uint32 hash(LemmaIdType prev, uint32 slot_num) {
+    return (prev * 2654435761U) & (slot_num - 1);
+  }
+
+#ifdef ___BUILD_MODEL___
+  // Build the table from (prev, cur, count) triples. The pairs with the
+  // highest counts are kept until the table reaches max_bytes.
+  bool build(LemmaIdType *prevs, LemmaIdType *curs, double *counts,
+             size_t num, size_t max_bytes);
+#endif
+
+ public:
+  Bigram();
+  ~Bigram();
+
+  // Map the model file into memory. If the file is larger than max_mb MB,
+  // it is not loaded. If max_mb is 0, kDefaultBudgetMb is used.
+  bool load_bigram(const char *fn_bigram, size_t max_mb);
+
+  void free_resource();
+
+  bool is_loaded() const {
+    return NULL != header_;
+  }
+
+  // Return the memory used by the model, in bytes.
+  size_t get_size() const {
+    return buf_size_;
+  }
+
+  // The smallest score difference in the table. A lemma can never get a
+  // better score after prev than its unigram score plus this value. The
+  // backoff penalties are not negative, so they do not lower it.
+  float get_min_delta() const {
+    return NULL == header_ ? 0 : header_->min_delta;
+  }
+
+  // Get the successor list of the given lemma, and the backoff penalty of
+  // the lemmas not in it. Return NULL and set *num and *backoff to 0 if it
+  // has no successor in the table.
+  const uint32* get_successors(LemmaIdType prev, size_t *num,
+                               float *backoff) const;
+
+  // Get the score difference of cur in the successor list given by
+  // get_successors(). Return backoff if cur is not in the list.
+  float get_delta(const uint32 *succ, size_t succ_num, float backoff,
+                  LemmaIdType cur) const;
+
+  // Get the score difference of cur after prev. Return 0 if prev is not in
+  // the table.
+  float get_delta(LemmaIdType prev, LemmaIdType cur) const;
+
+#ifdef ___BUILD_MODEL___
+  // Build the model from a raw UTF-16 file, each line of which is
+  // "<lemma string> <lemma string> <count>". The lemma strings are mapped to
+  // ids with dict_trie, which should have been built or loaded, so that the
+  // unigram model is available too.
+  bool build_bigram(const char *fn_raw, DictTrie *dict_trie,
+                    size_t max_bytes);
+
+  bool save_bigram(const char *fn_bigram);
+#endif
+};
+}
+
+#endif  // PINYINIME_INCLUDE_BIGRAM_H__
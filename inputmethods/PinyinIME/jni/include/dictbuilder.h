@@ -101,10 +101,6 @@ class DictBuilder {
                   DictTrie *dict_trie);
 
  private:
-  // Fill in the buffer with id. The caller guarantees that the paramters are
-  // vaild.
-  void id_to_charbuf(unsigned char *buf, LemmaIdType id);
-
   // Update the offset of sons for a node.
   void set_son_offset(LmaNodeGE1 *node, size_t offset);
 
@@ -63,7 +63,7 @@ const size_t kMaxPredictSize = (kMaxLemmaSize - 1);
 
 // LemmaIdType must always be size_t.
 typedef size_t LemmaIdType;
-const size_t kLemmaIdSize = 3;  // Actually, a Id occupies 3 bytes in storage.
+const size_t kLemmaIdSize = 3;  // Actually, a Id has only 3 bytes of data.
 const size_t kLemmaIdComposing = 0xffffff;
 
 typedef uint16 LmaScoreType;
@@ -76,6 +76,9 @@ const size_t kMaxPredictNumByGt3 = 1;
 const size_t kMaxPredictNumBy3 = 2;
 const size_t kMaxPredictNumBy2 = 2;
 
+// The maximum number of the prediction items.
+const size_t kMaxPredictNum = 500;
+
 // The last lemma id (included) for the system dictionary. The system
 // dictionary's ids always start from 1.
 const LemmaIdType kSysDictIdEnd = 500000;
@@ -91,6 +94,12 @@ typedef struct {
   uint16 full_splid:11;
 } SpellingId, *PSpellingId;
 
+// A range of full spelling ids, [start, start + num).
+typedef struct {
+  uint16 start;
+  uint16 num;
+} SplIdRange;
+
 
 /**
  * We use different node types for different layers
@@ -107,10 +116,13 @@ typedef struct {
  *
  * LE = less and equal,
  * A node occupies 16 bytes. so, totallly less than 16 * 500 = 8K
+ *
+ * Offsets are 32-bit, so that the layout is the same on all hosts and can be
+ * read into memory as it is.
  */
 struct LmaNodeLE0 {
-  size_t son_1st_off;
-  size_t homo_idx_buf_off;
+  uint32 son_1st_off;
+  uint32 homo_idx_buf_off;
   uint16 spl_idx;
   uint16 num_of_son;
   uint16 num_of_homo;
@@ -118,9 +130,31 @@ struct LmaNodeLE0 {
 
 /**
  * GE = great and equal
- * A node occupies 8 bytes.
+ * A node occupies 12 bytes.
  */
 struct LmaNodeGE1 {
+  uint32 son_1st_off;
+  uint32 homo_idx_buf_off;
+  uint16 spl_idx;
+  unsigned char num_of_son;            // number of son nodes
+  unsigned char num_of_homo;           // number of homo words
+};
+
+/**
+ * The node layouts of the version 1 dictionary file, in which the offsets of
+ * a LmaNodeGE1 node are split into low and high bits. They are only used to
+ * load old dictionary files. The offsets of LmaNodeLE0V1 were size_t; the
+ * files were built for 32-bit devices, so they are read as uint32.
+ */
+struct LmaNodeLE0V1 {
+  uint32 son_1st_off;
+  uint32 homo_idx_buf_off;
+  uint16 spl_idx;
+  uint16 num_of_son;
+  uint16 num_of_homo;
+};
+
+struct LmaNodeGE1V1 {
   uint16 son_1st_off_l;        // Low bits of the son_1st_off
   uint16 homo_idx_buf_off_l;   // Low bits of the homo_idx_buf_off_1
   uint16 spl_idx;
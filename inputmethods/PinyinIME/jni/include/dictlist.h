@@ -37,7 +37,25 @@ class DictList {
   char16 *scis_hz_;
   SpellingId *scis_splid_;
 
-  // The large memory block to store the word list.
+  // Index from a hanzi to its items in scis_hz_ and scis_splid_, built when
+  // the list is loaded. The hanzis are split into pages of 256 by their high
+  // bytes. The page of hanzis whose high byte is hi is hz_page_[hi], or
+  // kNoHzPage if there is no such hanzi. The items of hanzi (hi << 8 | lo)
+  // are those in [starts[lo], starts[lo + 1]), where starts is
+  // hz_start_ + hz_page_[hi] * kHzPageItems.
+  static const uint16 kNoHzPage = 0xffff;
+  static const size_t kHzPageItems = 257;
+  uint16 hz_page_[256];
+  uint16 *hz_start_;
+
+  // Bit h of full_half_mask_[full_splid] is set if half id h is compatible
+  // with the full id.
+  uint32 full_half_mask_[kFullSplIdStart + kMaxSpellingNum];
+
+  // The large memory block to store the word list. It is not compressed:
+  // front coding it in sorted blocks saved about 15% of it, but every word
+  // had to be decoded from its block head, which made get_lemma_str(),
+  // get_lemma_id() and prediction slower.
   char16 *buf_;
 
   // Starting position of those words whose lengths are i+1, counted in
@@ -46,12 +64,67 @@ class DictList {
 
   size_t start_id_[kMaxLemmaSize + 1];
 
-  int (*cmp_func_[kMaxLemmaSize])(const void *, const void *);
-
-  bool alloc_resource(size_t buf_size, size_t scim_num);
+  // Number of the uint32 sizes stored before the lists in the file:
+  // scis_num_, start_pos_ and start_id_.
+  static const size_t kListSizesNum = 2 * (kMaxLemmaSize + 1) + 1;
+
+  // Prediction index for the histories of one or two hanzis which start
+  // many words. A key of one hanzi is the hanzi itself, a key of two is
+  // (hz1 << 16 | hz2), and pre_keys_ is sorted. The items of the i-th key are
+  // in pre_items_, from pre_pos_[i] to pre_pos_[i + 1]. Each item is a word
+  // started by the key: the top 3 bits are the length of the word minus 1,
+  // and the others are its position among the words of that length, counted
+  // from pre_bases_[i * kMaxLemmaSize + length - 1]. Items of a key are
+  // sorted as the prediction results are: by score, and then by the string.
+  // A string is only kept for its best word, and only the first
+  // kMaxPredictIndexItems strings are kept: at most kMaxPredictNum
+  // predictions are returned, after at most kTopScoreLemmaNum strings are
+  // removed as predicted before.
+  static const uint32 kPredictIndexMagic = 0x33584950;  // "PIX3"
+  static const uint16 kMaxPredictKeyLen = 2;
+  static const size_t kMinPredictIndexItems = 32;
+  static const size_t kMaxPredictIndexItems =
+      kMaxPredictNum + kTopScoreLemmaNum;
+  static const uint16 kPredictItemPosBits = 13;
+  size_t pre_key_num_;
+  uint32 *pre_keys_;
+  uint32 *pre_pos_;
+  uint32 *pre_bases_;
+  size_t pre_items_len_;
+  uint16 *pre_items_;
+
+  bool alloc_resource(size_t buf_size, size_t scis_num);
 
   void free_resource();
 
+  // Build hz_page_, hz_start_ and full_half_mask_ from the SingleCharItems.
+  bool build_hz_index();
+
+  inline size_t get_word_num(size_t word_len) const {
+    return (start_pos_[word_len] - start_pos_[word_len - 1]) / word_len;
+  }
+
+  inline const char16* get_word(size_t word_len, size_t index) const {
+    return buf_ + start_pos_[word_len - 1] + index * word_len;
+  }
+
+  // Find the first word of length word_len whose first kCmpLen characters
+  // are not less than the key. Return the number of those words if there is
+  // no such word.
+  template <size_t kCmpLen>
+  size_t find_first(const char16 *key, size_t word_len) const;
+
+  // Call find_first() with cmp_len as the template argument, so that the
+  // comparisons are inlined and specialized by length.
+  size_t find_first(const char16 *key, size_t cmp_len,
+                    size_t word_len) const;
+
+  // Fill the prediction items from the prediction index. Return false if
+  // the index can not be used for the history.
+  bool predict_by_index(const char16 last_hzs[], uint16 hzs_len,
+                        NPredictItem *npre_items, size_t npre_max,
+                        size_t *item_num);
+
 #ifdef ___BUILD_MODEL___
   // Calculate the requsted memory, including the start_pos[] buffer.
   size_t calculate_size(const LemmaEntry *lemma_arr, size_t lemma_num);
@@ -61,19 +134,8 @@ class DictList {
   // Copy the related content to the inner buffer
   // It should be called after calculate_size()
   void fill_list(const LemmaEntry *lemma_arr, size_t lemma_num);
-
-  // Find the starting position for the buffer of those 2-character Chinese word
-  // whose first character is the given Chinese character.
-  char16* find_pos2_startedbyhz(char16 hz_char);
 #endif
 
-  // Find the starting position for the buffer of those words whose lengths are
-  // word_len. The given parameter cmp_func decides how many characters from
-  // beginning will be used to compare.
-  char16* find_pos_startedbyhzs(const char16 last_hzs[],
-                                size_t word_Len,
-                                int (*cmp_func)(const void *, const void *));
-
  public:
 
   DictList();
@@ -82,17 +144,40 @@ class DictList {
   bool save_list(FILE *fp);
   bool load_list(FILE *fp);
 
+  // The prediction index is optional in the dictionary file. Without it,
+  // the words are searched for each prediction. If there is no index, an
+  // empty one is saved.
+  bool save_predict_index(FILE *fp);
+  bool load_predict_index(FILE *fp);
+  void free_predict_index();
+
 #ifdef ___BUILD_MODEL___
   // Init the list from the LemmaEntry array.
   // lemma_arr should have been sorted by the hanzi_str, and have been given
   // ids from 1
   bool init_list(const SingleCharItem *scis, size_t scis_num,
                  const LemmaEntry *lemma_arr, size_t lemma_num);
+
+  // Build the prediction index from the list. The unigram model must have
+  // been built.
+  bool build_predict_index();
 #endif
 
   // Get the hanzi string for the given id
   uint16 get_lemma_str(LemmaIdType id_hz, char16 *str_buf, uint16 str_max);
 
+  // Get the position of the given lemma's string in the word list, counted in
+  // char16. The length of the lemma is returned, 0 if the id is invalid.
+  uint16 get_lemma_pos(LemmaIdType id_lemma, size_t *pos);
+
+  // Get the memory used by the list and its indexes, in bytes.
+  size_t get_mem_size();
+
+  // Get the total length of the word list, counted in char16.
+  size_t get_list_len() {
+    return initialized_ ? start_pos_[kMaxLemmaSize] : 0;
+  }
+
   void convert_to_hanzis(char16 *str, uint16 str_len);
 
   void convert_to_scis_ids(char16 *str, uint16 str_len);
@@ -78,11 +78,28 @@ class DictTrie : AtomDictBase {
 
   // The first part is for homophnies, and the last  top_lma_num_ items are
   // lemmas with highest scores.
-  unsigned char *lma_idx_buf_;
-  size_t lma_idx_buf_len_;  // The total size of lma_idx_buf_ in byte.
+  uint32 *lma_idx_buf_;
+  size_t lma_idx_buf_len_;  // The number of ids in lma_idx_buf_.
   size_t total_lma_num_;    // Total number of lemmas in this dictionary.
   size_t top_lmas_num_;     // Number of lemma with highest scores.
 
+  // Spelling ids of the lemmas, in the same order as the lemma strings in the
+  // word list, so that get_lemma_splids() can get them directly instead of
+  // searching the trie. It is built from the trie when the dictionary is
+  // loaded. 0 means the spelling ids of that lemma are not available.
+  uint16 *lma_splids_;
+  size_t lma_splids_len_;
+
+  // The lemmas with highest scores and their strings, looked up once when
+  // the dictionary is loaded. They are sorted as the prediction results are:
+  // by score, and then by the string.
+  struct TopLemma {
+    LemmaIdType id;
+    char16 str[kMaxPredictSize];
+  };
+  TopLemma *top_lmas_;
+  size_t top_lmas_valid_num_;
+
   // Parsing mark list used to mark the detailed extended statuses.
   ParsingMark *parsing_marks_;
   // The position for next available mark.
@@ -107,6 +124,36 @@ class DictTrie : AtomDictBase {
 
   bool load_dict(FILE *fp);
 
+  // Load the trie in the version 1 layout, and convert it to the current one.
+  bool load_dict_v1(FILE *fp);
+
+  // Load the prediction index of the word list, if the dictionary data,
+  // which ends at data_end, has not ended yet.
+  bool load_predict_index(FILE *fp, long data_end);
+
+  // Allocate the buffers of the trie and the parsing space.
+  bool alloc_resource();
+
+  // Reorder the LmaNodeGE1 nodes level by level, so that the son lists of
+  // sibling nodes are next to each other, and the homophony ids in the same
+  // order as the nodes. Extending a range of sibling nodes then reads a
+  // contiguous range of memory.
+  bool sort_nodes_bfs();
+
+  // Build lma_splids_ by walking through the trie.
+  void build_lma_splids();
+
+  // Build top_lmas_ from the word list and the unigram model.
+  void build_top_lmas();
+
+  static int cmp_top_lemma(const void *p1, const void *p2);
+
+  void fill_lma_splids(const LmaNodeGE1 *node, uint16 splids[], uint16 level);
+
+  // Record splids as the spelling ids of the lemmas in the homo buffer.
+  void set_lma_splids(size_t homo_buf_off, size_t homo_num,
+                      const uint16 splids[], uint16 splid_num);
+
   // Given a LmaNodeLE0 node, extract the lemmas specified by it, and fill
   // them into the lpi_items buffer.
   // This function is called by the search engine.
@@ -145,6 +192,10 @@ class DictTrie : AtomDictBase {
   bool save_dict(FILE *fp);
 #endif  // ___BUILD_MODEL___
 
+  // Written before the trie in the dictionary file to tell the current
+  // layout from version 1, which starts with the number of LmaNodeLE0 nodes.
+  static const uint32 kDictTrieMagic = 0x32545944;  // "DYT2"
+
   static const int kMaxMileStone = 100;
   static const int kMaxParsingMark = 600;
   static const MileStoneHandle kFirstValidMileStoneHandle = 1;
@@ -221,6 +272,13 @@ class DictTrie : AtomDictBase {
 
   void flush_cache() {}
 
+  size_t get_mem_size();
+
+  // Free the indexes which only make lookups faster, the spelling ids of the
+  // lemmas and the prediction index, to save memory. The results do not
+  // change.
+  void free_extra_index();
+
   LemmaIdType get_lemma_id(const char16 lemma_str[], uint16 lemma_len);
 
   // Fill the lemmas with highest scores to the prediction buffer.
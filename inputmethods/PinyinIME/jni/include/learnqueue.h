@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PINYINIME_INCLUDE_LEARNQUEUE_H__
+#define PINYINIME_INCLUDE_LEARNQUEUE_H__
+
+#include <stdlib.h>
+#include "./dictdef.h"
+
+namespace ime_pinyin {
+
+// Something the user dictionary should learn from a choice of the user. The
+// lemma is given by its string and spelling ids rather than its id, so that
+// it can be found in any copy of the user dictionary.
+typedef struct {
+  // One of LearnQueue::kLearnXxx.
+  uint16 type;
+  // Length of lma_str and spl_ids.
+  uint16 lma_len;
+  // The user lemmas which the new lemma of kLearnAdd is made of. They are
+  // hit too. Each of them is given by its start and length in lma_str.
+  uint16 hit_num;
+  uint16 hit_starts[kMaxLemmaSize];
+  uint16 hit_lens[kMaxLemmaSize];
+  // The full spelling ids and the string of the lemma.
+  uint16 spl_ids[kMaxLemmaSize];
+  char16 lma_str[kMaxLemmaSize + 1];
+} LearnEvent;
+
+// A bounded queue of LearnEvent items from the decoding thread to the thread
+// which updates the user dictionary. It needs no lock: only one thread pushes
+// and only one thread pops at a time, and each index is written by one side
+// only.
+class LearnQueue {
+ public:
+  // The user lemma in the event is hit.
+  static const uint16 kLearnHit = 0;
+  // The lemma in the event is added to the user dictionary.
+  static const uint16 kLearnAdd = 1;
+
+  // Capacity of the queue, must be a power of 2.
+  static const uint32 kQueueSize = 32;
+
+ private:
+  LearnEvent events_[kQueueSize];
+
+  // Number of items ever popped, written by the consumer only.
+  volatile uint32 head_;
+  // Number of items ever pushed, written by the producer only.
+  volatile uint32 tail_;
+
+ public:
+  LearnQueue();
+
+  // Drop all items. Neither side may use the queue at the same time.
+  void clear();
+
+  // Append an item. Return false if the queue is full.
+  bool push(const LearnEvent *event);
+
+  // Take the oldest item. Return false if the queue is empty.
+  bool pop(LearnEvent *event);
+
+  bool empty() const {
+    return head_ == tail_;
+  }
+};
+}
+
+#endif  // PINYINIME_INCLUDE_LEARNQUEUE_H__
@@ -23,14 +23,68 @@
 
 namespace ime_pinyin {
 
-// Used to cache LmaPsbItem list for half spelling ids.
+// Used to cache LmaPsbItem lists of the first extending step (for both half
+// and full spelling ids) and of the second step (for two-syllable prefixes).
+// Lists for half ids are truncated to a fixed depth; lists for full ids and
+// prefixes are cached completely or not at all, so that the search result
+// is the same as without cache.
+// All lists share one buffer whose size is limited by a memory budget. When
+// the budget is used up, all lists are dropped and the cache is refilled.
 class LpiCache {
  private:
   static LpiCache *instance_;
   static const int kMaxLpiCachePerId = 15;
+  static const int kMaxLpiCacheFullLen = 512;
+  static const size_t kDefaultBudget = 256 * 1024;
+  // Number of slots for two-syllable prefixes, must be a power of 2.
+  static const uint16 kPairSlotNum = 1024;
 
-  LmaPsbItem *lpi_cache_;
-  uint16 *lpi_cache_len_;
+  struct LpiCacheEntry {
+    // Position in lpi_buf_.
+    uint32 pos;
+    // Length of the cached list, 0 means nothing is cached.
+    uint16 len;
+    // Number of items reserved in lpi_buf_ for this entry.
+    uint16 capacity;
+    // The value of user_version_ when the list was put, if the list contains
+    // lemmas from the user dictionary. Otherwise it is 0.
+    uint32 user_version;
+  };
+
+  LmaPsbItem *lpi_buf_;
+  size_t lpi_buf_size_;
+  size_t lpi_buf_used_;
+
+  // Entries for single spelling ids, indexed by the id.
+  LpiCacheEntry *entries_;
+
+  // Open addressing table for two-syllable prefixes. The key is
+  // (splid0 << 16 | splid1), 0 means the slot is empty.
+  uint32 *pair_keys_;
+  LpiCacheEntry *pair_entries_;
+
+  uint16 half_depth_;
+  uint16 full_depth_;
+
+  // Bumped whenever the user dictionary changes, so that all lists which
+  // contain user lemmas become stale at once.
+  uint32 user_version_;
+
+  void clear();
+
+  bool is_valid(const LpiCacheEntry *entry) const;
+
+  LpiCacheEntry* find_pair(uint16 splid0, uint16 splid1, bool add);
+
+  // Store the list into the entry. Return false if the budget is used up.
+  bool store(LpiCacheEntry *entry, LmaPsbItem lpi_items[], size_t lpi_num);
+
+  size_t load(const LpiCacheEntry *entry, LmaPsbItem lpi_items[],
+              size_t lpi_max);
+
+  // Test if the list for the given (half or full) key can contain a lemma
+  // whose spelling id is full_id.
+  static bool key_covers(uint16 key, uint16 full_id);
 
  public:
   LpiCache();
@@ -38,23 +92,61 @@ class LpiCache {
 
   static LpiCache& get_instance();
 
-  // Test if the LPI list of the given splid  has been cached.
-  // If splid is a full spelling id, it returns false, because we only cache
-  // list for half ids.
+  // Set the number of items kept for a half id, the maximum length of a list
+  // cached for a full id or a two-syllable prefix, and the memory budget in
+  // bytes. All cached lists are dropped.
+  bool configure(uint16 half_depth, uint16 full_depth, size_t budget);
+
+  // Change the memory budget only, 0 means the default one. If it changes,
+  // all cached lists are dropped.
+  bool set_budget(size_t budget);
+
+  // Get the memory used by the cache, in bytes.
+  size_t get_mem_size() const;
+
+  // Test if the LPI list of the given splid has been cached.
   bool is_cached(uint16 splid);
 
-  // Put LPI list to cahce. If the length of the list, lpi_num, is longer than
-  // the cache buffer. the list will be truncated, and function returns the
-  // maximum length of the cache buffer.
-  // Note: splid must be a half id, and lpi_items must be not NULL. The
-  // caller of this function should guarantee this.
+  // Test if the LPI list of the two-syllable prefix has been cached.
+  bool is_cached(uint16 splid0, uint16 splid1);
+
+  // Put LPI list to cache. If splid is a half id and the length of the list,
+  // lpi_num, is longer than the depth for half ids, the list will be
+  // truncated, and function returns the depth. Otherwise lpi_num is
+  // returned, no matter the list is cached or not.
+  // Note: lpi_items must be not NULL. The caller of this function should
+  // guarantee this.
   size_t put_cache(uint16 splid, LmaPsbItem lpi_items[], size_t lpi_num);
 
-  // Get the cached list for the given half id.
+  // Put LPI list of a two-syllable prefix to cache. The list is never
+  // truncated, and lpi_num is returned.
+  size_t put_cache(uint16 splid0, uint16 splid1, LmaPsbItem lpi_items[],
+                   size_t lpi_num);
+
+  // Get the cached list for the given id.
   // Return the length of the cached buffer.
-  // Note: splid must be a half id, and lpi_items must be not NULL. The
-  // caller of this function should guarantee this.
+  // Note: lpi_items must be not NULL. The caller of this function should
+  // guarantee this.
   size_t get_cache(uint16 splid, LmaPsbItem lpi_items[], size_t lpi_max);
+
+  // Get the cached list for the given two-syllable prefix.
+  size_t get_cache(uint16 splid0, uint16 splid1, LmaPsbItem lpi_items[],
+                   size_t lpi_max);
+
+  // Called by the user dictionary when the score of any lemma changes. The
+  // scores of all user lemmas depend on the total frequency of the
+  // dictionary, so all lists containing user lemmas become stale.
+  static void invalidate_user();
+
+  // Called by the user dictionary when a lemma is added, removed or updated.
+  // Besides invalidate_user(), the lists for the lemma's own spellings are
+  // dropped, because a new lemma may belong to them.
+  static void invalidate_lemma(const uint16 *splids, uint16 lemma_len);
+
+  // Drop all cached lists, e.g. when the lemma ids in the user dictionary
+  // change, or the total frequency of the other dictionaries changes the
+  // scores of all system lemmas.
+  static void invalidate_all();
 };
 
 }  // namespace
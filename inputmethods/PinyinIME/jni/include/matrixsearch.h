@@ -17,15 +17,22 @@
 #ifndef PINYINIME_ANDPY_INCLUDE_MATRIXSEARCH_H__
 #define PINYINIME_ANDPY_INCLUDE_MATRIXSEARCH_H__
 
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdlib.h>
 #include "./atomdictbase.h"
+#include "./bigram.h"
 #include "./dicttrie.h"
+#include "./learnqueue.h"
+#include "./memstats.h"
 #include "./searchutility.h"
 #include "./spellingtrie.h"
 #include "./splparser.h"
 
 namespace ime_pinyin {
 
+class UserDict;
+
 static const size_t kMaxRowNum = kMaxSearchSteps;
 
 typedef struct {
@@ -63,6 +70,15 @@ typedef struct MatrixNode {
   uint16 step;
 } MatrixNode, *PMatrixNode;
 
+// One of the k best paths which end at a MatrixNode. The path is this node
+// appended to the rank-th best path of the node at pred.
+typedef struct {
+  float score;
+  // Position of the previous node in the matrix node pool, -1 for the root.
+  PoolPosType pred;
+  uint16 rank;
+} NBestEntry;
+
 typedef struct {
   // The MatrixNode position in the matrix pool
   PoolPosType mtrx_nd_pos;
@@ -140,7 +156,19 @@ class MatrixSearch {
   // The maximum buffer to store LmaPsbItems.
   static const size_t kMaxLmaPsbItems = 1450;
 
-  // How many rows for each step.
+  // Lemma buffer bytes walked through in one idle defragment step of the
+  // user dictionary, about 25 microseconds of work on a desktop CPU.
+  static const size_t kUserDictDefragStepBytes = 16384;
+
+  // Candidates are sorted lazily, at least this many items a time.
+  static const size_t kCandidatePageSize = 16;
+
+  // Number of slots of the hash set used to remove repeated items in
+  // get_lpis(). It must be a power of 2 and larger than 2 * kMaxLmaPsbItems.
+  static const size_t kLpiHashSlots = 4096;
+
+  // How many rows for each step. This is the space reserved for each step in
+  // the matrix node pool, and the upper bound of the beam width.
   static const size_t kMaxNodeARow = 5;
 
   // The maximum length of the sentence candidates counted in chinese
@@ -153,6 +181,21 @@ class MatrixSearch {
   // The size of the DMI node pool.
   static const size_t kDmiPoolSize = 800;
 
+  // The maximum number of sentences get_nbest() gives.
+  static const size_t kMaxNBest = 32;
+
+  // The memory budget of the lemma list cache when the decoder is over its
+  // memory cap.
+  static const size_t kLowMemLpiCacheBudget = 32 * 1024;
+
+  // How many new lemmas the user dictionary keeps room for when the decoder
+  // is over its memory cap.
+  static const uint32 kLowMemUserDictPreAlloc = 4;
+
+  // Nice value of the thread which updates the user dictionary, the same as
+  // a background thread of Android.
+  static const int kLearnThreadNice = 10;
+
   // Used to indicate whether this object has been initialized.
   bool inited_;
 
@@ -167,21 +210,67 @@ class MatrixSearch {
   // split into "d a", because "d" is not a full spelling id.
   bool xi_an_enabled_;
 
+  // Beam width of the sentence decoding, the number of matrix nodes kept for
+  // each step. It is in [1, kMaxNodeARow], and kMaxNodeARow by default.
+  size_t beam_width_;
+
+  // A new matrix node whose score is worse than the best node of the same
+  // step by more than this gap is pruned.
+  float beam_score_gap_;
+
   // System dictionary.
   DictTrie* dict_trie_;
 
-  // User dictionary.
+  // User dictionary. While learn_thread_ runs, it is a copy of learn_dict_
+  // which is only read, and it is replaced by a newer copy when a new search
+  // starts.
   AtomDictBase* user_dict_;
 
+  // The user dictionary which learns from the choices. Without
+  // learn_thread_, it is user_dict_ itself.
+  UserDict* learn_dict_;
+
+  // A newer copy of learn_dict_ made by learn_thread_, not taken by the
+  // decoder yet. It is passed between the threads by atomic exchanges.
+  UserDict* volatile ready_dict_;
+
+  // Bigram model of the system lemmas, NULL if it is not loaded.
+  Bigram* bigram_;
+
   // Spelling parser.
   SpellingParser* spl_parser_;
 
+  // What the user dictionary should learn from the choices is queued here,
+  // and applied to learn_dict_ by learn_thread_, so that choose() does not
+  // wait for it.
+  LearnQueue learn_queue_;
+  pthread_t learn_thread_;
+  bool learn_thread_started_;
+  // Posted once for each queued event or request, and once to stop
+  // learn_thread_.
+  sem_t learn_sem_;
+  volatile bool learn_stop_;
+  // Requests to learn_thread_ to flush, reload or defragment learn_dict_.
+  volatile bool learn_flush_;
+  volatile bool learn_reload_;
+  volatile bool learn_defrag_;
+  // Memory used by learn_dict_, updated by learn_thread_.
+  volatile size_t learn_dict_size_;
+
   // The maximum allowed length of spelling string (such as a Pinyin string).
   size_t max_sps_len_;
 
   // The maximum allowed length of a result Chinese string.
   size_t max_hzs_len_;
 
+  // The memory cap in bytes, 0 means there is none. See set_mem_cap().
+  size_t mem_cap_;
+  // Whether something has been freed to keep under mem_cap_.
+  bool mem_reduced_;
+  // Whether the user dictionary has been reloaded with less room for new
+  // lemmas to keep under mem_cap_.
+  bool mem_reduced_usr_;
+
   // Pinyin string. Max length: kMaxRowNum - 1
   char pys_[kMaxRowNum];
 
@@ -190,6 +279,7 @@ class MatrixSearch {
 
   // Shared buffer for multiple purposes.
   size_t *share_buf_;
+  size_t share_buf_len_;
 
   MatrixNode *mtrx_nd_pool_;
   PoolPosType mtrx_nd_pool_used_;    // How many nodes used in the pool
@@ -198,6 +288,11 @@ class MatrixSearch {
 
   MatrixRow *matrix_;                // The first row is for starting
 
+  // How many (matrix node, lemma) pairs were evaluated to extend each step.
+  // Used to measure the effect of the beam. They are cleared by
+  // reset_search0(), and a step is cleared again when it is re-extended.
+  uint32 mtrx_nd_expanded_[kMaxRowNum];
+
   DictExtPara *dep_;                 // Parameter used to extend DMI nodes.
 
   NPredictItem *npre_items_;         // Used to do prediction
@@ -241,6 +336,12 @@ class MatrixSearch {
   LmaPsbItem lpi_items_[kMaxLmaPsbItems];
   size_t lpi_total_;
 
+  // When lpi_items_ contains candidates, the first lpi_num_full_match_ items
+  // are the fully-matched ones, and only the first lpi_sorted_ items are in
+  // their final order. See sort_candidates().
+  size_t lpi_num_full_match_;
+  size_t lpi_sorted_;
+
   // Assign the pointers with NULL. The caller makes sure that all pointers are
   // not valid before calling it. This function only will be called in the
   // construction function and free_resource().
@@ -281,11 +382,18 @@ class MatrixSearch {
   // fixed_hzs_ will be also assigned.
   void get_spl_start_id();
 
+  // Get the number of spellings get_spl_start_id() would give if the search
+  // ended at ch_pos, without changing the search space. ch_pos should be after
+  // the fixed part and not after pys_decoded_len_.
+  size_t get_spl_num(size_t ch_pos);
+
   // Get all lemma ids with match the given spelling id stream(shorter than the
   // maximum length of a word).
   // If pfullsent is not NULL, means the full sentence candidate may be the
   // same with the coming lemma string, if so, remove that lemma.
-  // The result is sorted in descendant order by the frequency score.
+  // If sort_by_psb is true, the result is sorted in descendant order by the
+  // frequency score; otherwise the items keep the order in which the
+  // dictionaries return them.
   size_t get_lpis(const uint16* splid_str, size_t splid_str_len,
                   LmaPsbItem* lma_buf, size_t max_lma_buf,
                   const char16 *pfullsent, bool sort_by_psb);
@@ -322,6 +430,8 @@ class MatrixSearch {
 
   // Extend a MatrixNode with the give LmaPsbItem list.
   // res_row is the destination row number.
+  // lpi_items should be sorted by psb, so that the extension can stop once an
+  // item cannot get into the beam of res_row.
   // This function does not change mtrx_nd_pool_used_. Please change it after
   // calling this function if necessary.
   // return 0 always.
@@ -339,9 +449,16 @@ class MatrixSearch {
   // Called after prepare_add_char, so the input char has been saved.
   bool add_char_qwerty();
 
-  // Prepare candidates from the last fixed hanzi position.
+  // Prepare candidates from the last fixed hanzi position. Only the first
+  // page of candidates is sorted, see sort_candidates().
   void prepare_candidates();
 
+  // Make sure that the first num candidates in lpi_items_ are in their final
+  // order. Fully-matched items are sorted by their scores, and the others by
+  // their unified scores. Items are sorted page by page, so that the work
+  // depends on how many candidates are shown instead of the total number.
+  void sort_candidates(size_t num);
+
   // Is the character in step pos a splitter character?
   // The caller guarantees that the position is valid.
   bool is_split_at(uint16 pos);
@@ -363,12 +480,63 @@ class MatrixSearch {
   // candidate 0. lma_from is from which lemma in lma_ids_, lma_num is the
   // number of lemmas to be combined together as a new lemma. The caller
   // gurantees that the combined new lemma's length is less or equal to
-  // kMaxLemmaSize.
+  // kMaxLemmaSize. The lemma is queued, and added by apply_learning().
   bool add_lma_to_userdict(uint16 lma_from, uint16 lma_num, float score);
 
+  // Queue the given event, or apply it at once if there is no learning
+  // thread.
+  void queue_learning(LearnEvent *event);
+
+  // Queue a hit of the given user lemma.
+  void queue_lemma_hit(LemmaIdType lma_id);
+
+  // Apply an event to learn_dict_.
+  bool apply_learning(LearnEvent *event);
+
+  // Apply all queued events in the calling thread, when learn_thread_ is not
+  // running.
+  void apply_pending_learning();
+
+  void start_learning();
+  void stop_learning();
+
+  // Do the work given to learn_thread_, and publish a new copy of
+  // learn_dict_ if it changes.
+  void run_learning();
+
+  // Put a new copy of learn_dict_ into ready_dict_.
+  void publish_user_dict();
+
+  // Replace user_dict_ with ready_dict_, if there is one. Called when a new
+  // search starts, so that no lemma id of the old copy is still in use.
+  void adopt_user_dict();
+
+  static void* learn_thread_proc(void *arg);
+
   // Update dictionary frequencies.
   void update_dict_freq();
 
+  // Get the nodes which can precede a node extended from row fr_row, at most
+  // one for each lemma and start step. Return the number of them.
+  size_t get_nbest_preds(size_t fr_row, PoolPosType *preds);
+
+  // Fill in the k best paths which end at the node at nd_pos, and those of
+  // the nodes they come from, unless nums[nd_pos] says they are known.
+  void fill_nbest(PoolPosType nd_pos, size_t k, NBestEntry *entries,
+                  uint16 *nums);
+
+  // Merge the best paths of the given nodes, each moved by its shift, into
+  // the k best ones. Return the number of them.
+  size_t merge_nbest(const PoolPosType *preds, const float *shifts,
+                     size_t pred_num, size_t k, const NBestEntry *entries,
+                     const uint16 *nums, NBestEntry *res);
+
+  void fill_mem_stats(MemStats *stats);
+
+  // Free the optional parts until the decoder is under mem_cap_. Return false
+  // if it is still over the cap.
+  bool apply_mem_cap();
+
   void debug_print_dmi(PoolPosType dmi_pos, uint16 nest_level);
 
  public:
@@ -380,17 +548,69 @@ class MatrixSearch {
   bool init_fd(int sys_fd, long start_offset, long length,
                const char *fn_usr_dict);
 
+  // Load the bigram model used to decode sentences, after the decoder is
+  // initialized. The model is not loaded if it is larger than max_mb MB; if
+  // max_mb is 0, Bigram::kDefaultBudgetMb is used.
+  // If it fails, the decoder goes on with the unigram model only.
+  bool load_bigram(const char *fn_bigram, size_t max_mb);
+
   void set_max_lens(size_t max_sps_len, size_t max_hzs_len);
 
+  // Set the fuzzy Pinyin options, a combination of SpellingTrie::kFuzzyXxx.
+  // The current search is reset. 0 turns fuzzy Pinyin off.
+  bool set_fuzzy(uint32 fuzzy_flags);
+
+  // Set a cap on the memory used by the decoder, in bytes, 0 means there is
+  // none. Over the cap, the decoder runs in a reduced mode: the lemma list
+  // cache is shrunk, the indexes which only make lookups faster are freed,
+  // the learning thread is stopped so that the user dictionary is not
+  // copied, and the user dictionary keeps less room for new lemmas. At last
+  // the bigram model is unloaded. What is freed is not loaded again before
+  // the decoder is initialized again. The search space is not shrunk, it is
+  // what the longest input needs.
+  // The cap is checked when it is set, when the decoder is initialized, when
+  // the bigram model is loaded, and by reset_search(), which sees the user
+  // dictionary grow. The current search is reset if the user dictionary is
+  // reloaded or the bigram model is unloaded. Return false if the decoder is
+  // still over the cap.
+  bool set_mem_cap(size_t mem_cap);
+
+  // Get the memory used by the decoder.
+  void get_mem_stats(MemStats *stats);
+
   void close();
 
   void flush_cache();
 
+  // Do a bounded part of the user dictionary defragment, it should be called
+  // in idle time until it returns true. A defragment only starts when enough
+  // user lemmas are removed. When it finishes, user lemma ids change, so the
+  // current search is reset. If the learning thread runs, it does the whole
+  // defragment, and this returns true at once.
+  bool defragment_user_dict();
+
   void set_xi_an_switch(bool xi_an_enabled);
 
   bool get_xi_an_switch();
 
+  // Set the beam used by the sentence decoding. beam_width is clamped to
+  // [1, kMaxNodeARow]. If beam_width is 0 or score_gap is not positive, the
+  // corresponding value is not changed.
+  void set_beam(size_t beam_width, float score_gap);
+
+  // Return how many (matrix node, lemma) pairs were evaluated to extend the
+  // given step in the last search.
+  size_t get_mtrx_nd_expanded(size_t step);
+
+  // Return how many matrix nodes and dict match items are used by the
+  // current search, out of kMtrxNdPoolSize and kDmiPoolSize.
+  size_t get_mtrx_nd_pool_used();
+  size_t get_dmi_pool_used();
+
   // Reset the search space. Equivalent to reset_search(0).
+  // The new search takes the newest copy of the user dictionary which the
+  // learning thread has published, if there is one. It never waits for the
+  // thread.
   // If inited, always return true;
   bool reset_search();
 
@@ -438,7 +658,15 @@ class MatrixSearch {
   char16* get_candidate0(char16* cand_str, size_t max_len,
                          uint16 *retstr_len, bool only_unfixed);
 
+  // Get the max_num best full sentences of the current search, at most
+  // kMaxNBest, best first. The first one is the sentence get_candidate0()
+  // gives. They are read from the lattice of the last search, so no new
+  // search is done. Return the number of sentences filled in.
+  size_t get_nbest(NBestSentence *sents, size_t max_num);
+
   // Choose a candidate. The decoder will do a search after the fixed position.
+  // What the user dictionary learns from the choice is queued, and applied by
+  // another thread. The searches see it after the next reset_search().
   size_t choose(size_t cand_id);
 
   // Cancel the last choosing operation, and return the new number of choices.
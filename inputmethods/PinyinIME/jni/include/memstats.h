@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PINYINIME_INCLUDE_MEMSTATS_H__
+#define PINYINIME_INCLUDE_MEMSTATS_H__
+
+#include <stdlib.h>
+
+namespace ime_pinyin {
+
+// Memory used by the decoder, in bytes, by subsystem.
+typedef struct {
+  // The spelling trie and the tables compiled from it.
+  size_t spl_trie;
+  // The system dictionary: the trie, the word list and their indexes.
+  size_t sys_dict;
+  // The unigram model of the system dictionary.
+  size_t ngram;
+  // The bigram model, 0 if it is not loaded.
+  size_t bigram;
+  // The user dictionary, including the room kept for new lemmas.
+  size_t user_dict;
+  // The cache of the lemma lists of the first steps.
+  size_t lpi_cache;
+  // The search space of the decoder.
+  size_t search;
+  // The sum of the above.
+  size_t total;
+  // The memory cap, 0 if there is none.
+  size_t cap;
+  // Whether something has been freed to keep the decoder under the cap.
+  bool reduced;
+} MemStats;
+}
+
+#endif  // PINYINIME_INCLUDE_MEMSTATS_H__
@@ -76,8 +76,15 @@ class NGram {
   // Set the total frequency of all none system dictionaries.
   void set_total_freq_none_sys(size_t freq_none_sys);
 
+  size_t get_total_freq_none_sys() const {
+    return total_freq_none_sys_;
+  }
+
   float get_uni_psb(LemmaIdType lma_id);
 
+  // Get the memory used by the model, in bytes.
+  size_t get_mem_size();
+
   // Convert a probability to score. Actually, the score will be limited to
   // kMaxScore, but at runtime, we also need float expression to get accurate
   // value of the score.
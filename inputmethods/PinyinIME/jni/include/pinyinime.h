@@ -19,6 +19,8 @@
 
 #include <stdlib.h>
 #include "./dictdef.h"
+#include "./memstats.h"
+#include "./searchutility.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +57,19 @@ extern "C" {
    */
   void im_close_decoder();
 
+  /**
+   * Load the bigram model used to decode sentences. The decoder should have
+   * been opened, and it works without the model if this function fails.
+   * The application does not ship a model or call this function yet, so it
+   * is only used by host tools for now.
+   *
+   * @param fn_bigram The file name of the bigram model.
+   * @param max_mb The model is not loaded if it is larger than max_mb MB. If
+   * it is 0, a default limitation is used.
+   * @return true if succeed.
+   */
+  bool im_load_bigram(const char *fn_bigram, size_t max_mb);
+
   /**
    * Set maximum limitations for decoding. If this function is not called,
    * default values will be used. For example, due to screen size limitation,
@@ -74,6 +89,16 @@ extern "C" {
    */
   void im_flush_cache();
 
+  /**
+   * Do a small part of the user dictionary defragment. It should be called in
+   * idle time, e.g. when no input view is shown, until it returns true, so
+   * that removed user lemmas are not compacted all at once when the decoder
+   * is closed. The current search is reset when the defragment finishes.
+   *
+   * @return true if there is no more defragment work to do.
+   */
+  bool im_defragment_user_dict();
+
   /**
    * Use a spelling string(Pinyin string) to search. The engine will try to do
    * an incremental search based on its previous search result, so if the new
@@ -149,6 +174,17 @@ extern "C" {
    */
   size_t im_get_spl_start_pos(const uint16 *&spl_start);
 
+  /**
+   * Get the best full sentences of the current search, with the Pinyin and
+   * Hanzi boundaries of their lemmas. The first one is the same as candidate
+   * 0. No new search is done.
+   *
+   * @param sents Used to return the sentences, best first.
+   * @param max_num The size of sents.
+   * @return The number of sentences filled in.
+   */
+  size_t im_get_nbest(NBestSentence *sents, size_t max_num);
+
   /**
    * Choose a candidate and make it fixed. If the candidate does not match
    * the end of all spelling ids, new candidates will be provided from the
@@ -202,6 +238,35 @@ extern "C" {
    * Enable Yunmus in ShouZiMu mode.
    */
   void im_enable_ym_as_szm(bool enable);
+
+  /**
+   * Set the fuzzy Pinyin options, with which the two spellings of each pair
+   * are matched as the same one. The current search is reset.
+   *
+   * @param fuzzy_flags A combination of SpellingTrie::kFuzzyXxx: z/zh, c/ch,
+   * s/sh, n/l, an/ang, en/eng and in/ing. 0 turns fuzzy Pinyin off.
+   * @return true if succeed.
+   */
+  bool im_set_fuzzy(unsigned int fuzzy_flags);
+
+  /**
+   * Set a cap on the memory used by the decoder engine. Over the cap, the
+   * engine runs in a reduced mode: caches and indexes which only make it
+   * faster are freed, and then the bigram model. It can be called before the
+   * engine is opened, and the cap is kept for the engines opened later.
+   *
+   * @param cap The cap in bytes, 0 means there is no cap.
+   * @return false if the engine is still over the cap.
+   */
+  bool im_set_memory_cap(size_t cap);
+
+  /**
+   * Get the memory used by the decoder engine, by subsystem.
+   *
+   * @param stats Used to return the numbers of bytes.
+   * @return true if succeed.
+   */
+  bool im_get_memory_stats(MemStats *stats);
 }
 
 #ifdef __cplusplus
@@ -51,6 +51,17 @@ typedef struct {
   uint16 his_len;  // The length of the history used to do the prediction.
 } NPredictItem, *PNPredictItem;
 
+// A full sentence of the current search, made of lma_num lemmas. Lemma i
+// covers the Pinyin string [py_start[i], py_start[i + 1]) and the Hanzi
+// string [hz_start[i], hz_start[i + 1]) of str.
+typedef struct {
+  float score;  // The lower score, the higher possibility.
+  uint16 lma_num;
+  uint16 py_start[kMaxSearchSteps + 1];
+  uint16 hz_start[kMaxSearchSteps + 1];
+  char16 str[kMaxSearchSteps + 1];
+} NBestSentence, *PNBestSentence;
+
 // Parameter structure used to extend in a dictionary. All dictionaries
 // receives the same DictExtPara and a dictionary specific MileStoneHandle for
 // extending.
@@ -61,15 +72,14 @@ typedef struct {
 // For example, when the user inputs "wm", extend_dict() will be called twice,
 // and the DictExtPara parameter are as follows respectively:
 // 1. splids = {w, m}; splids_extended = 1; ext_len = 1; step_no = 1;
-// splid_end_split = false; id_start = wa(the first id start with 'w');
-// id_num = number of ids starting with 'w'.
+// splid_end_split = false; id_ranges = {[wa, the last id starting with 'w']}.
 // 2. splids = {m}; splids_extended = 0; ext_len = 1; step_no = 1;
-// splid_end_split = false; id_start = wa; id_num = number of ids starting with
-// 'w'.
+// splid_end_split = false; id_ranges = {[wa, the last id starting with 'w']}.
 //
 // For string "women", one of the cases of the DictExtPara parameter is:
 // splids = {wo, men}, splids_extended = 1, ext_len = 3 (length of "men"),
-// step_no = 4; splid_end_split = false; id_start = men, id_num = 1.
+// step_no = 4; splid_end_split = false; id_ranges = {[men, men]}.
+// If fuzzy Pinyin makes en = eng, id_ranges = {[men, men], [meng, meng]}.
 //
 typedef struct {
   // Spelling ids for extending, there are splids_extended + 1 ids in the
@@ -98,14 +108,11 @@ typedef struct {
   // Indicate whether the newly added spelling ends with a splitting character
   bool splid_end_split;
 
-  // If the newly added id is a half id, id_start is the first id of the
-  // corresponding full ids; if the newly added id is a full id, id_start is
-  // that id.
-  uint16 id_start;
-
-  // If the newly added id is a half id, id_num is the number of corresponding
-  // ids; if it is a full id, id_num == 1.
-  uint16 id_num;
+  // The full ids the newly added id stands for, sorted by id, as given by
+  // SpellingTrie::get_id_ranges(). Without fuzzy Pinyin, a half id stands for
+  // one range of full ids, and a full id only for itself.
+  const SplIdRange *id_ranges;
+  uint16 id_range_num;
 }DictExtPara, *PDictExtPara;
 
 bool is_system_lemma(LemmaIdType lma_id);
@@ -135,6 +142,32 @@ int cmp_npre_by_hanzi_score(const void *p1, const void *p2);
 
 size_t remove_duplicate_npre(NPredictItem *npre_items, size_t npre_num);
 
+// Move the sel_num smallest items (compared by cmp_func) of
+// lpi_items[0, lpi_num) to the front in sorted order, while the other items
+// keep their relative order. Items which are equal keep their original
+// order, so that sorting a list page by page gives the same result as a
+// stable sort of the whole list.
+// Return the number of items at the front which are in their final order. It
+// may be more than sel_num when it is cheaper to sort the whole list.
+size_t partial_sort_lpi(LmaPsbItem *lpi_items, size_t lpi_num, size_t sel_num,
+                        int (*cmp_func)(const void *, const void *));
+
+// Remove the items in npre_items[0, npre_num) whose Hanzi strings have
+// appeared in the b4_used items before npre_items. Return the number of
+// remaining items, which are moved to the front of npre_items.
+size_t remove_b4_used_npre(NPredictItem *npre_items, size_t npre_num,
+                           size_t b4_used);
+
+// Remove duplicated items, keep the best top_k ones and sort them. For
+// duplicated Hanzi strings, the item with the smallest psb is kept. The items
+// are sorted by cmp_npre_by_hislen_score() if by_hislen is true, otherwise by
+// cmp_npre_by_score(); the ties are sorted by Hanzi strings.
+// The result is the same as calling remove_duplicate_npre(), sorting the
+// items and truncating the list to top_k items, but it is done in one pass
+// over a hash set and a bounded heap.
+size_t select_top_npre(NPredictItem *npre_items, size_t npre_num,
+                       size_t top_k, bool by_hislen);
+
 size_t align_to_size_t(size_t size);
 
 }  // namespace
@@ -114,6 +114,23 @@ class SpellingTrie {
   // Map from full id to half id.
   uint16 *f2h_;
 
+  // The trie compiled into a flat transition table, used by SpellingParser.
+  // Each node is a state, and state 0 is the root. The next state of state s
+  // for a spelling char ch is dfa_next_[s * kValidSplCharNum + ch - 'A'] (ch
+  // in upper case). 0 means ch can not follow.
+  uint16 *dfa_next_;
+  // The spelling id of each state, the same as SpellingNode::spelling_idx.
+  uint16 *dfa_splid_;
+  size_t dfa_state_num_;
+
+  // The fuzzy Pinyin options in use, a combination of kFuzzyXxx.
+  uint32 fuzzy_flags_;
+
+  // The full id ranges each spelling id stands for. Those of splid are
+  // id_ranges_[splid * kMaxIdRangeNum + i], 0 <= i < id_range_num_[splid].
+  SplIdRange *id_ranges_;
+  uint16 *id_range_num_;
+
 #ifdef ___BUILD_MODEL___
   // How many node used to build the trie.
   size_t node_num_;
@@ -131,6 +148,26 @@ class SpellingTrie {
                                            size_t level, SpellingNode *parent);
   bool build_f2h();
 
+  // Build dfa_next_ and dfa_splid_ from the trie.
+  bool build_dfa();
+
+  static size_t count_nodes(const SpellingNode *node);
+
+  // Build id_ranges_ and id_range_num_ for the current fuzzy options.
+  bool build_id_ranges();
+
+  // Get the full id of the given spelling string, 0 if it is not a full
+  // spelling.
+  uint16 get_full_id(const char *spl_str) const;
+
+  // Mark the full ids which the fuzzy options make equal to full_id, full_id
+  // included, in the bit set.
+  void mark_fuzzy_ids(uint16 full_id, uint32 *id_bits);
+
+  // Give the node and its sons states from next_state on. Return the state of
+  // the node.
+  uint16 fill_dfa(const SpellingNode *node, uint16 &next_state);
+
   // The caller should guarantee ch >= 'A' && ch <= 'Z'
   bool is_shengmu_char(char ch) const;
 
@@ -152,6 +189,21 @@ class SpellingTrie {
   friend class SmartSplParser2;
 
  public:
+  // Fuzzy Pinyin options. With an option, the two spellings are matched as
+  // the same one. The final options also apply to the finals ending with
+  // them, so kFuzzyAnAng makes "uan" = "uang" and "ian" = "iang" too.
+  static const uint32 kFuzzyZZh = 0x01;
+  static const uint32 kFuzzyCCh = 0x02;
+  static const uint32 kFuzzySSh = 0x04;
+  static const uint32 kFuzzyNL = 0x08;
+  static const uint32 kFuzzyAnAng = 0x10;
+  static const uint32 kFuzzyEnEng = 0x20;
+  static const uint32 kFuzzyInIng = 0x40;
+
+  // The most ranges an id can stand for. A full id has at most one fuzzy
+  // initial and one fuzzy final, so it stands for at most 4 spellings.
+  static const uint16 kMaxIdRangeNum = 4;
+
   ~SpellingTrie();
 
   inline static bool is_valid_spl_char(char ch) {
@@ -163,6 +215,18 @@ class SpellingTrie {
     return ch1 == ch2 || ch1 - ch2 == 'a' - 'A' || ch2 - ch1 == 'a' - 'A';
   }
 
+  // Get the next state of the compiled trie. The caller guarantees that ch is
+  // a valid spelling char.
+  inline uint16 dfa_next(uint16 state, char ch) const {
+    return dfa_next_[state * kValidSplCharNum + ((ch & ~0x20) - 'A')];
+  }
+
+  // Get the spelling id of the given state, 0 if it is not the end of a
+  // spelling.
+  inline uint16 dfa_splid(uint16 state) const {
+    return dfa_splid_[state];
+  }
+
   // Construct the tree from the input pinyin array
   // The given string list should have been sorted.
   // score_amplifier is used to convert a possibility value into score.
@@ -225,6 +289,42 @@ class SpellingTrie {
   // with a full id like "Zhe". (Fussy mode is not ready).
   bool half_full_compatible(uint16 half_id, uint16 full_id) const;
 
+  // Set the fuzzy Pinyin options, a combination of kFuzzyXxx. The spelling
+  // trie should have been built. The caller should reset its searches and
+  // the caches of lemmas found by spelling ids.
+  bool set_fuzzy(uint32 fuzzy_flags);
+
+  uint32 get_fuzzy() const {
+    return fuzzy_flags_;
+  }
+
+  // Get the ranges of full ids the given id stands for, sorted by id. A half
+  // id stands for its full ids, and a full id for itself, together with
+  // those which the fuzzy options make equal to them. Return the number of
+  // ranges.
+  inline uint16 get_id_ranges(uint16 splid, const SplIdRange **ranges) const {
+    *ranges = id_ranges_ + splid * kMaxIdRangeNum;
+    return id_range_num_[splid];
+  }
+
+  // Test if full_id is in the ranges.
+  inline static bool in_id_ranges(uint16 full_id, const SplIdRange *ranges,
+                                  uint16 range_num) {
+    for (uint16 pos = 0; pos < range_num; pos++) {
+      if (full_id < ranges[pos].start)
+        return false;
+      if (full_id < ranges[pos].start + ranges[pos].num)
+        return true;
+    }
+    return false;
+  }
+
+  // Test if full_id is one of the full ids the given id stands for.
+  bool id_covers(uint16 splid, uint16 full_id) const;
+
+  // Test if the given full id stands for other full ids than itself.
+  bool is_fuzzy_id(uint16 splid) const;
+
   static const SpellingTrie* get_cpinstance();
 
   static SpellingTrie& get_instance();
@@ -238,6 +338,9 @@ class SpellingTrie {
   // Get the number of spellings
   size_t get_spelling_num();
 
+  // Get the memory used by the trie and its tables, in bytes.
+  size_t get_mem_size();
+
   // Return the Yunmu id for the given Yunmu string.
   // If the string is not valid, return 0;
   uint8 get_ym_id(const char* ym_str);
@@ -245,6 +348,16 @@ class SpellingTrie {
   // Get the readonly Pinyin string for a given spelling id
   const char* get_spelling_str(uint16 splid);
 
+  // Get the first char of get_spelling_str(splid) without building the
+  // string. splid must not be 0.
+  inline char get_spelling_initial(uint16 splid) const {
+    if (splid >= kFullSplIdStart)
+      return spelling_buf_[(splid - kFullSplIdStart) * spelling_size_];
+    char ch = kHalfId2Sc_[splid];
+    // Zh/Ch/Sh are in low case in the table.
+    return ch > 'Z' ? ch - 'a' + 'A' : ch;
+  }
+
   // Get the readonly Pinyin string for a given spelling id
   const char16* get_spelling_str16(uint16 splid);
 
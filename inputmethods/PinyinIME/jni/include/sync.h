@@ -59,13 +59,35 @@ class Sync {
   // Return length of returned buffer in measure of UTF16LE
   int get_lemmas(char16 * str, int size);
 
-  // Return lemmas count in last get_lemmas()
+  // Merge lemmas in binary chunk format into local dictionary
+  // chunk, lemma records, see UserDict::get_sync_lemmas_in_chunk()
+  // size, size of chunk in bytes
+  // Return how many bytes are consumed. A partial record at the end is not
+  // consumed, and it should be put again at the beginning of next chunk.
+  int put_lemmas_chunk(const uint8 * chunk, int size);
+
+  // Get local new user lemmas into binary chunk
+  // token, continuation token, 0 to start a pull and the returned value of
+  // previous call for the following chunks
+  // chunk, buffer to store lemma records
+  // size, size of buffer in bytes
+  // Return the token to get next chunk, or UserDict::kUserDictSyncEnd after
+  // the last lemma is got. If the buffer is too small for the next lemma,
+  // nothing is got and the given token is returned. If the token is not of
+  // the current pull, e.g. clear_last_got() or get_lemmas() was called
+  // since, 0 is returned and the pull should be started again.
+  // Lemmas added or removed between two chunks do not disturb the pull.
+  uint32 get_lemmas_chunk(uint32 token, uint8 * chunk, int size);
+
+  // Return lemmas count got by the last get_lemmas() or the current pull of
+  // get_lemmas_chunk(), which are still in the sync list
   int get_last_got_count();
 
   // Return total lemmas count need get_lemmas()
   int get_total_count();
 
-  // Clear lemmas got by recent get_lemmas()
+  // Clear lemmas got by recent get_lemmas() or get_lemmas_chunk() pull,
+  // lemmas added to the sync list after that are kept
   void clear_last_got();
 
   void finish();
@@ -75,7 +97,6 @@ class Sync {
  private:
   UserDict * userdict_;
   char * dictfile_;
-  int last_count_;
 };
 
 }
@@ -82,18 +82,60 @@ class UserDict : public AtomDictBase {
 
   void flush_cache();
 
+  size_t get_mem_size();
+
   void set_limit(uint32 max_lemma_count, uint32 max_lemma_size,
                  uint32 reclaim_ratio);
 
+  // Set for how many new lemmas room is kept when the dictionary is loaded,
+  // at least 1. A smaller room saves memory, but the dictionary is flushed
+  // more often when lemmas are added. It takes effect from the next load.
+  void set_prealloc(uint32 count);
+
   void reclaim();
 
   void defragment();
 
+  // Do part of defragment work, at most max_bytes of lemma buffer are walked
+  // through. The dictionary can be used normally between two steps, so this
+  // function can be called in idle time to avoid a long pause. The first and
+  // the last step also walk through the lemma lists once.
+  // Return true if defragment is finished.
+  bool defragment_step(size_t max_bytes);
+
+  // Return true if a defragment is running, or if enough lemmas are removed
+  // to start one.
+  bool need_defragment();
+
+  // Make this dictionary a copy of dict, to be read by one thread while
+  // another thread changes dict. The copy never writes or reloads the file,
+  // and it keeps no room for new lemmas.
+  bool copy_dict(UserDict *dict);
+
+  // Return true if the file has been written by another dictionary since
+  // this one was loaded.
+  bool is_outdated();
+
+  // Reload the file if it is outdated. Return true if it is reloaded.
+  bool reload_if_outdated();
+
+  // Whether the changes of this dictionary drop the lists in LpiCache. It
+  // should be turned off if LpiCache is used by another thread.
+  void set_lpi_cache_notify(bool notify);
+
 #ifdef ___SYNC_ENABLED___
   void clear_sync_lemmas(unsigned int start, unsigned int end);
 
   int get_sync_count();
 
+  // Return how many lemmas at the head of the sync list have been got by
+  // the current pull and are still in the list.
+  int get_sync_got_count();
+
+  // Clear the lemmas got by the current pull, lemmas added to the sync list
+  // after they were got are kept.
+  void clear_sync_got_lemmas();
+
   LemmaIdType put_lemma_no_sync(char16 lemma_str[], uint16 splids[],
                         uint16 lemma_len, uint16 count, uint64 lmt);
    /**
@@ -118,8 +160,62 @@ class UserDict : public AtomDictBase {
   int get_sync_lemmas_in_utf16le_string_from_beginning(
       char16 * str, int size, int * count);
 
+  /**
+   * Add lemmas in binary chunk format into dictionary without adding sync
+   * flag. Room for all complete records in the chunk is reserved before
+   * adding, so that the dictionary is not flushed for every few lemmas.
+   *
+   * @param chunk lemma records, see the format below
+   * @param size chunk size in bytes
+   * @param count output value of lemma added
+   * @return bytes consumed, a partial record at the end of the chunk is not
+   *         consumed and should be passed again with the following data
+   */
+  int put_lemmas_no_sync_from_chunk(const uint8 * chunk, int size,
+                                    int * count);
+
+  /**
+   * Get lemmas need sync to a binary chunk, continuing the pull specified by
+   * token. A record is never split between two chunks. If there is room
+   * left, a zero byte is written after the last record.
+   *
+   * The sync list keeps its order while lemmas are removed from it, and the
+   * count of lemmas already got is kept by the dictionary, so a pull is not
+   * disturbed by lemmas added or removed between two chunks.
+   *
+   * @param token 0 to start a new pull, or the token returned by the
+   *        previous call. It is set to kUserDictSyncEnd after the last
+   *        lemma is got, or to 0 if the given token is not of the current
+   *        pull, in which case nothing is written.
+   * @param chunk buffer to write lemma records
+   * @param size buffer size in bytes, if it can not contain the next record,
+   *        nothing is written and token is not changed
+   * @param count output value of lemma returned
+   * @return bytes written
+   */
+  int get_sync_lemmas_in_chunk(uint32 * token, uint8 * chunk, int size,
+                               int * count);
+
+  // Token returned by get_sync_lemmas_in_chunk() when all lemmas are got.
+  static const uint32 kUserDictSyncEnd = 0xFFFFFFFF;
+
+  // Chunk format for each lemma, multi-byte fields are little endian and
+  // not aligned
+  // +-----------+----------------+------------------+-------------------+
+  // | Nchar (1) | Pinyin Len (1) | Pinyin (ASCII)   | Lemma (2 x Nchar) |
+  // +-----------+----------------+------------------+-------------------+
+  // +----------+---------+
+  // | Freq (2) | LMT (4) |
+  // +----------+---------+
+  // Pinyin is spelling strings separated by ' ', LMT is in second.
+  static const int kUserDictChunkMaxRecord = 2 + 255 + (kMaxLemmaSize << 1) + 6;
+
 #endif
 
+  // Make sure count lemmas with total size in bytes can be appended without
+  // flushing the dictionary.
+  bool reserve(uint32 count, uint32 size);
+
   struct UserDictStat {
     uint32 version;
     const char * file_name;
@@ -149,8 +245,22 @@ class UserDict : public AtomDictBase {
 
   // In-Memory-Only flag for each lemma
   static const uint8 kUserDictLemmaFlagRemove = 1;
-  // Inuse lemmas' offset
-  uint32 * offsets_;
+  // The part of an inuse lemma the search reads, 16 bytes. The file keeps
+  // offsets and scores as two arrays, they are only packed in memory.
+  struct UserDictSlot {
+    // Offset of the lemma in lemmas_
+    uint32 offset;
+    uint32 score;
+    // Initial letters of the first kUserDictSlotInitials spelling ids,
+    // packed as the signature of UserDictSearchable, 0 after the lemma.
+    uint32 initials;
+    uint8 nchar;
+    uint8 reserved[3];
+  };
+  static const uint16 kUserDictSlotInitials = 4;
+
+  // Inuse lemmas
+  UserDictSlot * slots_;
   // Highest bit in offset tells whether corresponding lemma is removed
   static const uint32 kUserDictOffsetFlagRemove = (1 << 31);
   // Maximum possible for the offset
@@ -173,9 +283,8 @@ class UserDict : public AtomDictBase {
   )
   static const uint64 kUserDictLMTSince = COARSE_UTC(2009, 1, 1, 0, 0, 0);
 
-  // Correspond to offsets_
-  uint32 * scores_;
-  // Following two fields are only valid in memory
+  // Correspond to slots_, the cold part of lemmas. Following two fields are
+  // only valid in memory
   uint32 * ids_;
 #ifdef ___PREDICT_ENABLED___
   uint32 * predicts_;
@@ -183,14 +292,59 @@ class UserDict : public AtomDictBase {
 #ifdef ___SYNC_ENABLED___
   uint32 * syncs_;
   size_t sync_count_size_;
+  // Lemmas at the head of syncs_ got by the current pull, and the token of
+  // that pull. Removing lemmas from syncs_ keeps the order of the others and
+  // decreases sync_got_ for each one before it, so sync_got_ always counts
+  // lemmas which have really been got.
+  uint32 sync_got_;
+  uint32 sync_pull_;
 #endif
   uint32 * offsets_by_id_;
+  // Position of each lemma in slots_, indexed by id - start_id_. Only valid
+  // in memory.
+  uint32 * offset_indexes_by_id_;
+
+  // Exact-match index from (splids, lemma) to lemma id, only valid in
+  // memory. It is an open addressing hash table, each slot keeps
+  // id - start_id_ + 1, 0 means an empty slot. Ids do not move when lemmas
+  // are inserted into slots_, so the table is not touched then.
+  uint32 * locates_;
+  // Slot count, always power of 2
+  uint32 locate_size_;
+  // Number of tombstones, the table is rebuilt when they fill a quarter of
+  // it.
+  uint32 locate_tombstones_;
+  static const uint32 kUserDictLocateTombstone = 0xFFFFFFFF;
+
+  // Progress of incremental defragment, lemmas before defrag_dst_ are
+  // compacted, lemmas from defrag_src_ are not touched yet. While it runs,
+  // predicts_ and syncs_ keep lemma ids minus start_id_ instead of offsets,
+  // so moving a lemma only changes its slot and offsets_by_id_.
+  bool defrag_running_;
+  size_t defrag_dst_;
+  size_t defrag_src_;
+  // The first lemma removed behind defrag_dst_ while the pass runs. The
+  // walk goes round again from it when it reaches the end, and skips the
+  // garbage from defrag_gap_ to defrag_gap_end_ left by the round before.
+  size_t defrag_hole_;
+  size_t defrag_gap_;
+  size_t defrag_gap_end_;
+  static const size_t kUserDictDefragNoHole = ~(size_t)0;
 
   size_t lemma_count_left_;
   size_t lemma_size_left_;
+  // Lemma size when loaded, lemmas after it are newly appended
+  size_t lemma_size_loaded_;
 
   const char * dict_file_;
 
+  // True if this is a copy made by copy_dict().
+  bool read_only_;
+  bool lpi_cache_notify_;
+
+  // Room for new lemmas kept by load_dict(), kUserDictPreAlloc by default.
+  uint32 prealloc_;
+
   // Be sure size is 4xN
   struct UserDictInfo {
     // When limitation reached, how much percentage will be reclaimed (1 ~ 100)
@@ -202,7 +356,7 @@ class UserDict : public AtomDictBase {
     // 0 means no limitation
     uint32 limit_lemma_size;
     // Total lemma count including deleted and inuse
-    // Also indicate offsets_ size
+    // Also indicate slots_ size
     uint32 lemma_count;
     // Total size of lemmas including used and freed
     uint32 lemma_size;
@@ -237,10 +391,22 @@ class UserDict : public AtomDictBase {
 
   struct UserDictSearchable {
     uint16 splids_len;
-    uint16 splid_start[kMaxLemmaSize];
-    uint16 splid_count[kMaxLemmaSize];
+    // The full ids each spelling id stands for.
+    const SplIdRange *id_ranges[kMaxLemmaSize];
+    uint16 id_range_num[kMaxLemmaSize];
     // Compact inital letters for both FuzzyCompareSpellId and cache system
     uint32 signature[kMaxLemmaSize / 4];
+    // With fuzzy Pinyin (n = l), the other initial letter a spelling id
+    // stands for, or 0. Those in use instead of the initial letters in
+    // signature are marked in fuzzy_letters_used.
+    char fuzzy_letters[kMaxLemmaSize];
+    uint16 fuzzy_letters_used;
+    // True if each spelling id stands for one range of full ids. Then the
+    // range of position i is [range_starts[i], range_starts[i] +
+    // range_lasts[i]], and the positions after splids_len take any id.
+    bool single_ranges;
+    uint16 range_starts[kMaxLemmaSize];
+    uint16 range_lasts[kMaxLemmaSize];
   };
 
 #ifdef ___CACHE_ENABLED___
@@ -307,6 +473,12 @@ class UserDict : public AtomDictBase {
   size_t _get_lpis(const uint16 *splid_str, uint16 splid_str_len,
                    LmaPsbItem *lpi_items, size_t lpi_max, bool * need_extend);
 
+  // Get the lemmas whose initial letters are those in the signature of
+  // searchable.
+  size_t get_lpis_by_signature(UserDictSearchable *searchable,
+                               LmaPsbItem *lpi_items, size_t lpi_max,
+                               bool *need_extend);
+
   int _get_lemma_score(char16 lemma_str[], uint16 splids[], uint16 lemma_len);
 
   int _get_lemma_score(LemmaIdType lemma_id);
@@ -327,6 +499,10 @@ class UserDict : public AtomDictBase {
 
   bool is_valid_state();
 
+  void invalidate_lpi_user();
+  void invalidate_lpi_lemma(const uint16 *splids, uint16 lemma_len);
+  void invalidate_lpi_all();
+
   bool is_valid_lemma_id(LemmaIdType id);
 
   LemmaIdType get_max_lemma_id();
@@ -345,6 +521,27 @@ class UserDict : public AtomDictBase {
   void prepare_locate(UserDictSearchable *searchable,
                       const uint16 * splids, uint16 len);
 
+  // Move the signature of searchable to the next combination of the initial
+  // letters made equal by fuzzy Pinyin. Return false if all of them have
+  // been used, and the signature is restored.
+  bool next_fuzzy_signature(UserDictSearchable *searchable);
+
+  // Compare the initial letters of the first searchable->splids_len ids
+  // with the signature of searchable, starting from the id at from, which
+  // is a multiple of 4.
+  int compare_initials(const uint16 *ids, uint16 from,
+                       const UserDictSearchable *searchable);
+
+  // The same for the lemma of slots_[index], which mostly needs no more
+  // than the slot.
+  int compare_slot_initials(uint32 index,
+                            const UserDictSearchable *searchable);
+
+  // Test if the first searchable->splids_len full ids are in the ranges of
+  // searchable.
+  bool in_id_ranges(const uint16 *fullids,
+                    const UserDictSearchable *searchable);
+
   // Compare initial letters only
   int32 fuzzy_compare_spell_id(const uint16 * id1, uint16 len1,
                                const UserDictSearchable *searchable);
@@ -364,7 +561,27 @@ class UserDict : public AtomDictBase {
   int32 locate_in_offsets(char16 lemma_str[],
                           uint16 splid_str[], uint16 lemma_len);
 
+  uint32 locate_hash(const char16 lemma_str[], const uint16 splid_str[],
+                     uint16 lemma_len);
+
+  // Rebuild the exact-match index from slots_. If memory is not enough,
+  // the index is dropped and locate_in_offsets() falls back to binary search.
+  void locate_index_rebuild();
+
+  void locate_index_insert(uint32 offset_index);
+
+  void locate_index_remove(uint32 offset_index);
+
+  // Return offset index of the lemma or -1 if it is not in dictionary.
+  // All spelling ids must be full ids.
+  int32 locate_in_index(char16 lemma_str[],
+                        uint16 splid_str[], uint16 lemma_len);
+
   bool remove_lemma_by_offset_index(int offset_index);
+
+  // Mark predict items of removed lemmas and drop them from sync list.
+  // Lemma flag of removed lemmas must have been set.
+  void sweep_removed_lemmas();
 #ifdef ___PREDICT_ENABLED___
   uint32 locate_where_to_insert_in_predicts(const uint16 * words,
                                             int lemma_len);
@@ -380,12 +597,34 @@ class UserDict : public AtomDictBase {
 
   void write_back_sync(int fd);
 #endif
+  // Write the given field of slots_ as an array of the file.
+  void write_slot_field(int fd, uint32 UserDictSlot::*field);
+  // Fill the fields of the slot which come from the lemma at offset.
+  void fill_slot(UserDictSlot *slot, uint32 offset);
   void write_back_score(int fd);
   void write_back_offset(int fd);
   void write_back_lemma(int fd);
   void write_back_all(int fd);
   void write_back();
 
+  // Defragment starts in idle time when removed lemmas take up
+  // 1/kUserDictDefragFreeRatio of the lemma buffer.
+  static const uint32 kUserDictDefragFreeRatio = 4;
+
+  // Called when the lemma at offset is removed, see defrag_hole_.
+  inline void defrag_note_removal(uint32 offset);
+
+  // Item of predicts_ or syncs_ for the given lemma, see defrag_running_.
+  inline uint32 list_item_of(LemmaIdType id);
+
+  // Lemma offset of an item of predicts_ or syncs_, the remove flag is kept.
+  inline uint32 list_item_offset(uint32 item);
+
+  // Switch predicts_ and syncs_ between offsets and ids, when a defragment
+  // starts and ends.
+  void list_items_to_ids();
+  void list_items_to_offsets();
+
   struct UserDictScoreOffsetPair {
     int score;
     uint32 offset_index;
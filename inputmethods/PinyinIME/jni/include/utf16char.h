@@ -33,21 +33,39 @@ extern "C" {
   char16* utf16_strtok(char16 *utf16_str, size_t *token_size,
                        char16 **utf16_str_next);
 
+  // Like utf16_strtok(), but the string ends at utf16_end, and it is not
+  // modified. The returned token is not '\0'-terminated.
+  const char16* utf16_strntok(const char16 *utf16_str,
+                              const char16 *utf16_end, size_t *token_size,
+                              const char16 **utf16_str_next);
+
   int utf16_atoi(const char16 *utf16_str);
 
   float utf16_atof(const char16 *utf16_str);
 
+  // Like utf16_atoi() and utf16_atof(), for a string of the given length
+  // which needs not be '\0'-terminated.
+  int utf16_strtoi(const char16 *utf16_str, size_t size);
+  double utf16_strtod(const char16 *utf16_str, size_t size);
+
   size_t utf16_strlen(const char16 *utf16_str);
 
   int utf16_strcmp(const char16 *str1, const char16 *str2);
   int utf16_strncmp(const char16 *str1, const char16 *str2, size_t size);
 
+  // Hash at most size characters of the string. Two strings which are equal
+  // for utf16_strncmp() with the same size get the same hash value.
+  size_t utf16_strhash(const char16 *str, size_t size);
+
   char16* utf16_strcpy(char16 *dst, const char16 *src);
   char16* utf16_strncpy(char16 *dst, const char16 *src, size_t size);
 
 
   char* utf16_strcpy_tochar(char *dst, const char16 *src);
 
+  // Copy size characters, and terminate dst with '\0'.
+  char* utf16_strncpy_tochar(char *dst, const char16 *src, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
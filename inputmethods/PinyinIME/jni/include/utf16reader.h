@@ -17,30 +17,42 @@
 #ifndef PINYINIME_INCLUDE_UTF16READER_H__
 #define PINYINIME_INCLUDE_UTF16READER_H__
 
-#include <stdio.h>
+#include <stdlib.h>
 #include "./utf16char.h"
 
 namespace ime_pinyin {
 
+// Reads the lines of a UTF-16 text file which starts with a byte order mark.
+// The whole file is mapped into memory, so the lines can be taken without
+// copying them.
 class Utf16Reader {
  private:
-  FILE *fp_;
-  char16 *buffer_;
-  size_t buffer_total_len_;
-  size_t buffer_next_pos_;
+  // The file, mapped into memory, or read into a buffer if it can not be
+  // mapped.
+  void *file_buf_;
+  size_t file_size_;
+  bool mapped_;
 
-  // Always less than buffer_total_len_ - buffer_next_pos_
-  size_t buffer_valid_len_;
+  // Where the next line starts, and where the file ends.
+  const char16 *line_pos_;
+  const char16 *file_end_;
 
  public:
   Utf16Reader();
   ~Utf16Reader();
 
   // filename is the name of the file to open.
-  // buffer_len specifies how long buffer should be allocated to speed up the
-  // future reading
-  bool open(const char* filename, size_t buffer_len);
+  bool open(const char* filename);
+
+  // Get the next line without copying it. The line is not '\0'-terminated,
+  // and it is valid until close(). *line_len does not count the "\n" or
+  // "\r\n" at the end. Return NULL at the end of the file.
+  const char16* next_line(size_t *line_len);
+
+  // Copy the next line into read_buf, and terminate it with '\0'. A line
+  // longer than max_len - 1 is truncated.
   char16* readline(char16* read_buf, size_t max_len);
+
   bool close();
 };
 }
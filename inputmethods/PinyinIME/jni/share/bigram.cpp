@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../include/bigram.h"
+#ifdef ___BUILD_MODEL___
+#include "../include/dicttrie.h"
+#include "../include/mystdlib.h"
+#include "../include/utf16reader.h"
+#endif
+
+namespace ime_pinyin {
+
+Bigram::Bigram() {
+  buf_ = NULL;
+  buf_size_ = 0;
+  mapped_ = false;
+  header_ = NULL;
+  codes_ = NULL;
+  slots_ = NULL;
+  items_ = NULL;
+}
+
+Bigram::~Bigram() {
+  free_resource();
+}
+
+void Bigram::free_resource() {
+  if (NULL != buf_) {
+    if (mapped_)
+      munmap(buf_, buf_size_);
+    else
+      free(buf_);
+  }
+  buf_ = NULL;
+  buf_size_ = 0;
+  mapped_ = false;
+  header_ = NULL;
+  codes_ = NULL;
+  slots_ = NULL;
+  items_ = NULL;
+}
+
+bool Bigram::attach(size_t size) {
+  if (NULL == buf_ || size < sizeof(BigramHeader))
+    return false;
+
+  const BigramHeader *header = static_cast<const BigramHeader*>(buf_);
+  if (kBigramMagic != header->magic || 0 == header->slot_num ||
+      0 != (header->slot_num & (header->slot_num - 1)) ||
+      header->min_delta > 0)
+    return false;
+
+  size_t expected = sizeof(BigramHeader) + sizeof(float) * kCodeBookSize +
+                    sizeof(BigramSlot) * header->slot_num +
+                    sizeof(uint32) * header->item_num;
+  if (size != expected)
+    return false;
+
+  header_ = header;
+  codes_ = reinterpret_cast<const float*>(header_ + 1);
+  slots_ = reinterpret_cast<const BigramSlot*>(codes_ + kCodeBookSize);
+  items_ = reinterpret_cast<const uint32*>(slots_ + header_->slot_num);
+  return true;
+}
+
+bool Bigram::load_bigram(const char *fn_bigram, size_t max_mb) {
+  if (NULL == fn_bigram)
+    return false;
+
+  free_resource();
+
+  if (0 == max_mb)
+    max_mb = kDefaultBudgetMb;
+
+  int fd = open(fn_bigram, O_RDONLY);
+  if (-1 == fd)
+    return false;
+
+  struct stat file_stat;
+  if (0 != fstat(fd, &file_stat) || file_stat.st_size <= 0 ||
+      static_cast<size_t>(file_stat.st_size) > (max_mb << 20)) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(file_stat.st_size);
+  void *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == buf)
+    return false;
+
+  buf_ = buf;
+  buf_size_ = size;
+  mapped_ = true;
+
+  if (!attach(size)) {
+    free_resource();
+    return false;
+  }
+  return true;
+}
+
+const uint32* Bigram::get_successors(LemmaIdType prev, size_t *num,
+                                     float *backoff) const {
+  *num = 0;
+  *backoff = 0;
+  if (NULL == header_ || 0 == prev)
+    return NULL;
+
+  uint32 mask = header_->slot_num - 1;
+  for (uint32 pos = hash(prev, header_->slot_num); ; pos = (pos + 1) & mask) {
+    const BigramSlot *slot = slots_ + pos;
+    if (0 == slot->prev)
+      return NULL;
+    if (prev == slot->prev) {
+      *num = slot->pos_num & 0xff;
+      *backoff = slot->backoff;
+      return items_ + (slot->pos_num >> 8);
+    }
+  }
+}
+
+float Bigram::get_delta(const uint32 *succ, size_t succ_num, float backoff,
+                        LemmaIdType cur) const {
+  size_t begin = 0;
+  size_t end = succ_num;
+  while (begin < end) {
+    size_t mid = (begin + end) / 2;
+    LemmaIdType id = succ[mid] >> 8;
+    if (id == cur)
+      return codes_[succ[mid] & 0xff];
+    if (id < cur)
+      begin = mid + 1;
+    else
+      end = mid;
+  }
+  return backoff;
+}
+
+float Bigram::get_delta(LemmaIdType prev, LemmaIdType cur) const {
+  size_t succ_num;
+  float backoff;
+  const uint32 *succ = get_successors(prev, &succ_num, &backoff);
+  if (NULL == succ)
+    return 0;
+  return get_delta(succ, succ_num, backoff, cur);
+}
+
+#ifdef ___BUILD_MODEL___
+struct BigramPair {
+  LemmaIdType prev;
+  LemmaIdType cur;
+  double count;
+  float delta;
+};
+
+int cmp_bigram_pair_with_count(const void *p1, const void *p2) {
+  const BigramPair *pair1 = static_cast<const BigramPair*>(p1);
+  const BigramPair *pair2 = static_cast<const BigramPair*>(p2);
+  if (pair1->count > pair2->count)
+    return -1;
+  if (pair1->count < pair2->count)
+    return 1;
+  return 0;
+}
+
+int cmp_bigram_pair_with_ids(const void *p1, const void *p2) {
+  const BigramPair *pair1 = static_cast<const BigramPair*>(p1);
+  const BigramPair *pair2 = static_cast<const BigramPair*>(p2);
+  if (pair1->prev != pair2->prev)
+    return pair1->prev < pair2->prev ? -1 : 1;
+  if (pair1->cur != pair2->cur)
+    return pair1->cur < pair2->cur ? -1 : 1;
+  return 0;
+}
+
+// The number of hash slots for prev_num lemmas, at most half of them used.
+static uint32 get_slot_num(size_t prev_num) {
+  uint32 slot_num = 1;
+  while (slot_num < prev_num * 2)
+    slot_num <<= 1;
+  return slot_num;
+}
+
+bool Bigram::build(LemmaIdType *prevs, LemmaIdType *curs, double *counts,
+                   size_t num, size_t max_bytes) {
+  if (NULL == prevs || NULL == curs || NULL == counts || 0 == num)
+    return false;
+
+  free_resource();
+
+  BigramPair *pairs = new BigramPair[num];
+  double *prev_totals = new double[kSysDictIdEnd];
+  uint16 *prev_nums = new uint16[kSysDictIdEnd];
+  assert(NULL != pairs && NULL != prev_totals && NULL != prev_nums);
+  memset(prev_totals, 0, sizeof(double) * kSysDictIdEnd);
+  memset(prev_nums, 0, sizeof(uint16) * kSysDictIdEnd);
+
+  size_t pair_num = 0;
+  for (size_t pos = 0; pos < num; pos++) {
+    if (0 == prevs[pos] || prevs[pos] >= kSysDictIdEnd ||
+        0 == curs[pos] || curs[pos] >= kSysDictIdEnd || counts[pos] <= 0)
+      continue;
+    pairs[pair_num].prev = prevs[pos];
+    pairs[pair_num].cur = curs[pos];
+    pairs[pair_num].count = counts[pos];
+    prev_totals[prevs[pos]] += counts[pos];
+    if (prev_nums[prevs[pos]] < 0xffff)
+      prev_nums[prevs[pos]]++;
+    pair_num++;
+  }
+
+  // The bigram probability is interpolated with the unigram one, using
+  // Witten-Bell weights. A cur never seen after prev only has the unigram
+  // part, (1 - lambda) * uni_psb, so its score difference is the score of
+  // (1 - lambda).
+  float *prev_backoffs = new float[kSysDictIdEnd];
+  assert(NULL != prev_backoffs);
+  for (LemmaIdType prev = 0; prev < kSysDictIdEnd; prev++) {
+    prev_backoffs[prev] = 0;
+    if (prev_nums[prev] > 0) {
+      double total = prev_totals[prev];
+      prev_backoffs[prev] =
+          NGram::convert_psb_to_score(prev_nums[prev] /
+                                      (total + prev_nums[prev]));
+    }
+  }
+
+  NGram &ngram = NGram::get_instance();
+  for (size_t pos = 0; pos < pair_num; pos++) {
+    BigramPair *pair = pairs + pos;
+    double total = prev_totals[pair->prev];
+    double lambda = total / (total + prev_nums[pair->prev]);
+    float uni_score = ngram.get_uni_psb(pair->cur);
+    double uni_psb = exp(uni_score / NGram::kLogValueAmplifier);
+    double psb = lambda * pair->count / total + (1 - lambda) * uni_psb;
+    pair->delta = NGram::convert_psb_to_score(psb) - uni_score;
+  }
+
+  // Keep the most frequent pairs within the memory budget.
+  myqsort(pairs, pair_num, sizeof(BigramPair), cmp_bigram_pair_with_count);
+  memset(prev_nums, 0, sizeof(uint16) * kSysDictIdEnd);
+  size_t prev_num = 0;
+  size_t item_num = 0;
+  for (size_t pos = 0; pos < pair_num; pos++) {
+    BigramPair *pair = pairs + pos;
+    if (prev_nums[pair->prev] >= kMaxSuccessorNum)
+      continue;
+    size_t prev_num_new = prev_num + (0 == prev_nums[pair->prev] ? 1 : 0);
+    size_t size = sizeof(BigramHeader) + sizeof(float) * kCodeBookSize +
+                  sizeof(BigramSlot) * get_slot_num(prev_num_new) +
+                  sizeof(uint32) * (item_num + 1);
+    if (size > max_bytes)
+      break;
+    prev_num = prev_num_new;
+    prev_nums[pair->prev]++;
+    pairs[item_num++] = *pair;
+  }
+
+  delete [] prev_totals;
+  delete [] prev_nums;
+
+  if (0 == item_num) {
+    delete [] pairs;
+    delete [] prev_backoffs;
+    return false;
+  }
+
+  myqsort(pairs, item_num, sizeof(BigramPair), cmp_bigram_pair_with_ids);
+
+  // Quantize the score differences uniformly.
+  float min_delta = 0;
+  float max_delta = 0;
+  for (size_t pos = 0; pos < item_num; pos++) {
+    if (pairs[pos].delta < min_delta)
+      min_delta = pairs[pos].delta;
+    if (pairs[pos].delta > max_delta)
+      max_delta = pairs[pos].delta;
+  }
+  float code_step = (max_delta - min_delta) / (kCodeBookSize - 1);
+
+  uint32 slot_num = get_slot_num(prev_num);
+  buf_size_ = sizeof(BigramHeader) + sizeof(float) * kCodeBookSize +
+              sizeof(BigramSlot) * slot_num + sizeof(uint32) * item_num;
+  buf_ = malloc(buf_size_);
+  assert(NULL != buf_);
+  memset(buf_, 0, buf_size_);
+  mapped_ = false;
+
+  BigramHeader *header = static_cast<BigramHeader*>(buf_);
+  header->magic = kBigramMagic;
+  header->slot_num = slot_num;
+  header->item_num = item_num;
+  header->min_delta = min_delta;
+
+  float *codes = reinterpret_cast<float*>(header + 1);
+  for (size_t code = 0; code < kCodeBookSize; code++)
+    codes[code] = min_delta + code_step * code;
+
+  BigramSlot *slots = reinterpret_cast<BigramSlot*>(codes + kCodeBookSize);
+  uint32 *items = reinterpret_cast<uint32*>(slots + slot_num);
+  size_t list_start = 0;
+  for (size_t pos = 0; pos < item_num; pos++) {
+    CODEBOOK_TYPE code = 0;
+    if (code_step > 0)
+      code = static_cast<CODEBOOK_TYPE>(
+          (pairs[pos].delta - min_delta) / code_step + 0.5);
+    items[pos] = (pairs[pos].cur << 8) | code;
+
+    if (pos + 1 < item_num && pairs[pos + 1].prev == pairs[pos].prev)
+      continue;
+
+    uint32 slot = hash(pairs[pos].prev, slot_num);
+    while (0 != slots[slot].prev)
+      slot = (slot + 1) & (slot_num - 1);
+    slots[slot].prev = pairs[pos].prev;
+    slots[slot].pos_num = (list_start << 8) | (pos + 1 - list_start);
+    slots[slot].backoff = prev_backoffs[pairs[pos].prev];
+    list_start = pos + 1;
+  }
+
+  delete [] pairs;
+  delete [] prev_backoffs;
+
+  if (kPrintDebug0) {
+    printf("---Bigram: %lu lemmas, %lu pairs, %lu bytes, delta [%.1f, %.1f]\n",
+           (unsigned long)prev_num, (unsigned long)item_num,
+           (unsigned long)buf_size_, min_delta, max_delta);
+  }
+
+  return attach(buf_size_);
+}
+
+bool Bigram::build_bigram(const char *fn_raw, DictTrie *dict_trie,
+                          size_t max_bytes) {
+  if (NULL == fn_raw || NULL == dict_trie)
+    return false;
+
+  Utf16Reader utf16_reader;
+  if (!utf16_reader.open(fn_raw))
+    return false;
+
+  size_t num_max = 65536;
+  size_t num = 0;
+  LemmaIdType *prevs = static_cast<LemmaIdType*>(
+      malloc(sizeof(LemmaIdType) * num_max));
+  LemmaIdType *curs = static_cast<LemmaIdType*>(
+      malloc(sizeof(LemmaIdType) * num_max));
+  double *counts = static_cast<double*>(malloc(sizeof(double) * num_max));
+  assert(NULL != prevs && NULL != curs && NULL != counts);
+
+  char16 read_buf[1024];
+  while (NULL != utf16_reader.readline(read_buf, 1024)) {
+    size_t token_size;
+    char16 *to_tokenize = read_buf;
+
+    char16 *token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    if (NULL == token)
+      continue;
+    LemmaIdType prev = dict_trie->get_lemma_id(token, token_size);
+
+    token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    if (NULL == token)
+      continue;
+    LemmaIdType cur = dict_trie->get_lemma_id(token, token_size);
+
+    token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    if (NULL == token || 0 == prev || 0 == cur)
+      continue;
+
+    if (num == num_max) {
+      num_max *= 2;
+      prevs = static_cast<LemmaIdType*>(
+          realloc(prevs, sizeof(LemmaIdType) * num_max));
+      curs = static_cast<LemmaIdType*>(
+          realloc(curs, sizeof(LemmaIdType) * num_max));
+      counts = static_cast<double*>(realloc(counts, sizeof(double) * num_max));
+      assert(NULL != prevs && NULL != curs && NULL != counts);
+    }
+    prevs[num] = prev;
+    curs[num] = cur;
+    counts[num] = utf16_atof(token);
+    num++;
+  }
+  utf16_reader.close();
+
+  bool ret = build(prevs, curs, counts, num, max_bytes);
+
+  free(prevs);
+  free(curs);
+  free(counts);
+  return ret;
+}
+
+bool Bigram::save_bigram(const char *fn_bigram) {
+  if (NULL == fn_bigram || NULL == header_)
+    return false;
+
+  FILE *fp = fopen(fn_bigram, "wb");
+  if (NULL == fp)
+    return false;
+
+  bool ret = fwrite(buf_, 1, buf_size_, fp) == buf_size_;
+  fclose(fp);
+  return ret;
+}
+#endif  // ___BUILD_MODEL___
+
+}  // namespace ime_pinyin
@@ -33,7 +33,6 @@ namespace ime_pinyin {
 
 #ifdef ___BUILD_MODEL___
 
-static const size_t kReadBufLen = 512;
 static const size_t kSplTableHashLen = 2000;
 
 // Compare a SingleCharItem, first by Hanzis, then by spelling ids, then by
@@ -371,11 +370,9 @@ size_t DictBuilder::read_raw_dict(const char* fn_raw,
   if (NULL == fn_raw) return 0;
 
   Utf16Reader utf16_reader;
-  if (!utf16_reader.open(fn_raw, kReadBufLen * 10))
+  if (!utf16_reader.open(fn_raw))
     return false;
 
-  char16 read_buf[kReadBufLen];
-
   // Read the number of lemmas in the file
   size_t lemma_num = 240000;
 
@@ -389,27 +386,31 @@ size_t DictBuilder::read_raw_dict(const char* fn_raw,
   size_t valid_hzs_num = 0;
   valid_hzs = read_valid_hanzis(fn_validhzs, &valid_hzs_num);
 
-  // Begin reading the lemma entries
+  // Begin reading the lemma entries. The lines are tokenized where they are
+  // in the file, without copying them.
   for (size_t i = 0; i < max_item; i++) {
     // read next entry
-    if (!utf16_reader.readline(read_buf, kReadBufLen)) {
+    size_t line_len;
+    const char16 *line = utf16_reader.next_line(&line_len);
+    if (NULL == line) {
       lemma_num = i;
       break;
     }
 
     size_t token_size;
-    char16 *token;
-    char16 *to_tokenize = read_buf;
+    const char16 *token;
+    const char16 *line_end = line + line_len;
+    const char16 *to_tokenize = line;
 
     // Get the Hanzi string
-    token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    token = utf16_strntok(to_tokenize, line_end, &token_size, &to_tokenize);
     if (NULL == token) {
       free_resource();
       utf16_reader.close();
       return false;
     }
 
-    size_t lemma_size = utf16_strlen(token);
+    size_t lemma_size = token_size;
 
     if (lemma_size > kMaxLemmaSize) {
       i--;
@@ -422,18 +423,19 @@ size_t DictBuilder::read_raw_dict(const char* fn_raw,
     }
 
     // Copy to the lemma entry
-    utf16_strcpy(lemma_arr_[i].hanzi_str, token);
+    utf16_strncpy(lemma_arr_[i].hanzi_str, token, token_size);
+    lemma_arr_[i].hanzi_str[token_size] = (char16)'\0';
 
     lemma_arr_[i].hz_str_len = token_size;
 
     // Get the freq string
-    token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    token = utf16_strntok(to_tokenize, line_end, &token_size, &to_tokenize);
     if (NULL == token) {
       free_resource();
       utf16_reader.close();
       return false;
     }
-    lemma_arr_[i].freq = utf16_atof(token);
+    lemma_arr_[i].freq = utf16_strtod(token, token_size);
 
     if (lemma_size > 1 && lemma_arr_[i].freq < 60) {
       i--;
@@ -443,9 +445,9 @@ size_t DictBuilder::read_raw_dict(const char* fn_raw,
     // Get GBK mark, if no valid Hanzi list available, all items which contains
     // GBK characters will be discarded. Otherwise, all items which contains
     // characters outside of the valid Hanzi list will be discarded.
-    token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    token = utf16_strntok(to_tokenize, line_end, &token_size, &to_tokenize);
     assert(NULL != token);
-    int gbk_flag = utf16_atoi(token);
+    int gbk_flag = utf16_strtoi(token, token_size);
     if (NULL == valid_hzs || 0 == valid_hzs_num) {
       if (0 != gbk_flag) {
         i--;
@@ -464,16 +466,17 @@ size_t DictBuilder::read_raw_dict(const char* fn_raw,
     for (size_t hz_pos = 0; hz_pos < (size_t)lemma_arr_[i].hz_str_len;
          hz_pos++) {
       // Get a Pinyin
-      token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+      token = utf16_strntok(to_tokenize, line_end, &token_size, &to_tokenize);
       if (NULL == token) {
         free_resource();
         utf16_reader.close();
         return false;
       }
 
-      assert(utf16_strlen(token) <= kMaxPinyinSize);
+      assert(token_size <= kMaxPinyinSize);
 
-      utf16_strcpy_tochar(lemma_arr_[i].pinyin_str[hz_pos], token);
+      utf16_strncpy_tochar(lemma_arr_[i].pinyin_str[hz_pos], token,
+                           token_size);
 
       format_spelling_str(lemma_arr_[i].pinyin_str[hz_pos]);
 
@@ -486,7 +489,7 @@ size_t DictBuilder::read_raw_dict(const char* fn_raw,
     }
 
     // The whole line must have been parsed fully, otherwise discard this one.
-    token = utf16_strtok(to_tokenize, &token_size, &to_tokenize);
+    token = utf16_strntok(to_tokenize, line_end, &token_size, &to_tokenize);
     if (spelling_not_support || NULL != token) {
       i--;
       continue;
@@ -573,6 +576,10 @@ bool DictBuilder::build_dict(const char *fn_raw,
   ngram.build_unigram(lemma_arr_, lemma_num_,
                       lemma_arr_[lemma_num_ - 1].idx_by_hz + 1);
 
+  // The prediction index is sorted by the scores of the unigram model.
+  bool pi_success = dict_trie->dict_list_->build_predict_index();
+  assert(pi_success);
+
   // sort the lemma items according to the spelling idx string
   myqsort(lemma_arr_, lemma_num_, sizeof(LemmaEntry), compare_py);
 
@@ -594,16 +601,20 @@ bool DictBuilder::build_dict(const char *fn_raw,
   stat_print();
 #endif
 
-  // Move the node data and homo data to the DictTrie
-  dict_trie->root_ = new LmaNodeLE0[lma_nds_used_num_le0_];
-  dict_trie->nodes_ge1_ = new LmaNodeGE1[lma_nds_used_num_ge1_];
+  // Move the node data and homo data to the DictTrie. The buffers are
+  // released by DictTrie with free().
   size_t lma_idx_num = homo_idx_num_eq1_ + homo_idx_num_gt1_ + top_lmas_num_;
-  dict_trie->lma_idx_buf_ = new unsigned char[lma_idx_num * kLemmaIdSize];
+  dict_trie->root_ = static_cast<LmaNodeLE0*>(
+      malloc(sizeof(LmaNodeLE0) * lma_nds_used_num_le0_));
+  dict_trie->nodes_ge1_ = static_cast<LmaNodeGE1*>(
+      malloc(sizeof(LmaNodeGE1) * lma_nds_used_num_ge1_));
+  dict_trie->lma_idx_buf_ = static_cast<uint32*>(
+      malloc(sizeof(uint32) * lma_idx_num));
   assert(NULL != dict_trie->root_);
   assert(NULL != dict_trie->lma_idx_buf_);
   dict_trie->lma_node_num_le0_ = lma_nds_used_num_le0_;
   dict_trie->lma_node_num_ge1_ = lma_nds_used_num_ge1_;
-  dict_trie->lma_idx_buf_len_ = lma_idx_num * kLemmaIdSize;
+  dict_trie->lma_idx_buf_len_ = lma_idx_num;
   dict_trie->top_lmas_num_ = top_lmas_num_;
 
   memcpy(dict_trie->root_, lma_nodes_le0_,
@@ -612,17 +623,20 @@ bool DictBuilder::build_dict(const char *fn_raw,
          sizeof(LmaNodeGE1) * lma_nds_used_num_ge1_);
 
   for (size_t pos = 0; pos < homo_idx_num_eq1_ + homo_idx_num_gt1_; pos++) {
-    id_to_charbuf(dict_trie->lma_idx_buf_ + pos * kLemmaIdSize,
-                  homo_idx_buf_[pos]);
+    dict_trie->lma_idx_buf_[pos] = static_cast<uint32>(homo_idx_buf_[pos]);
   }
 
   for (size_t pos = homo_idx_num_eq1_ + homo_idx_num_gt1_;
        pos < lma_idx_num; pos++) {
     LemmaIdType idx =
         top_lmas_[pos - homo_idx_num_eq1_ - homo_idx_num_gt1_].idx_by_hz;
-    id_to_charbuf(dict_trie->lma_idx_buf_ + pos * kLemmaIdSize, idx);
+    dict_trie->lma_idx_buf_[pos] = static_cast<uint32>(idx);
   }
 
+  // The nodes are built depth first, put them in the layout used to search.
+  dt_success = dict_trie->sort_nodes_bfs();
+  dict_trie->build_top_lmas();
+
   if (kPrintDebug0) {
     printf("homo_idx_num_eq1_: %d\n", homo_idx_num_eq1_);
     printf("homo_idx_num_gt1_: %d\n", homo_idx_num_gt1_);
@@ -637,22 +651,12 @@ bool DictBuilder::build_dict(const char *fn_raw,
   return dt_success;
 }
 
-void DictBuilder::id_to_charbuf(unsigned char *buf, LemmaIdType id) {
-  if (NULL == buf) return;
-  for (size_t pos = 0; pos < kLemmaIdSize; pos++) {
-    (buf)[pos] = (unsigned char)(id >> (pos * 8));
-  }
-}
-
 void DictBuilder::set_son_offset(LmaNodeGE1 *node, size_t offset) {
-  node->son_1st_off_l = static_cast<uint16>(offset);
-  node->son_1st_off_h = static_cast<unsigned char>(offset >> 16);
+  node->son_1st_off = static_cast<uint32>(offset);
 }
 
 void DictBuilder:: set_homo_id_buf_offset(LmaNodeGE1 *node, size_t offset) {
-  node->homo_idx_buf_off_l = static_cast<uint16>(offset);
-  node->homo_idx_buf_off_h = static_cast<unsigned char>(offset >> 16);
-
+  node->homo_idx_buf_off = static_cast<uint32>(offset);
 }
 
 // All spelling strings will be converted to upper case, except that
@@ -24,23 +24,36 @@
 
 namespace ime_pinyin {
 
+// Compare the first kLen characters of two strings, as cmp_hanzis_N() does,
+// but without a call through a function pointer.
+template <size_t kLen>
+static inline int cmp_hanzis_n(const char16 *str1, const char16 *str2) {
+  for (size_t pos = 0; pos < kLen; pos++) {
+    if (str1[pos] != str2[pos])
+      return static_cast<int>(str1[pos]) - static_cast<int>(str2[pos]);
+    if ((char16)'\0' == str1[pos])
+      return 0;
+  }
+  return 0;
+}
+
 DictList::DictList() {
   initialized_ = false;
   scis_num_ = 0;
   scis_hz_ = NULL;
   scis_splid_ = NULL;
+  hz_start_ = NULL;
   buf_ = NULL;
+  pre_key_num_ = 0;
+  pre_keys_ = NULL;
+  pre_pos_ = NULL;
+  pre_bases_ = NULL;
+  pre_items_len_ = 0;
+  pre_items_ = NULL;
   spl_trie_ = SpellingTrie::get_cpinstance();
 
   assert(kMaxLemmaSize == 8);
-  cmp_func_[0] = cmp_hanzis_1;
-  cmp_func_[1] = cmp_hanzis_2;
-  cmp_func_[2] = cmp_hanzis_3;
-  cmp_func_[3] = cmp_hanzis_4;
-  cmp_func_[4] = cmp_hanzis_5;
-  cmp_func_[5] = cmp_hanzis_6;
-  cmp_func_[6] = cmp_hanzis_7;
-  cmp_func_[7] = cmp_hanzis_8;
+  assert(kFullSplIdStart <= 32);
 }
 
 DictList::~DictList() {
@@ -80,6 +93,119 @@ void DictList::free_resource() {
   if (NULL != scis_splid_)
     free(scis_splid_);
   scis_splid_ = NULL;
+
+  if (NULL != hz_start_)
+    free(hz_start_);
+  hz_start_ = NULL;
+
+  free_predict_index();
+}
+
+void DictList::free_predict_index() {
+  if (NULL != pre_keys_)
+    free(pre_keys_);
+  pre_keys_ = NULL;
+
+  if (NULL != pre_pos_)
+    free(pre_pos_);
+  pre_pos_ = NULL;
+
+  if (NULL != pre_bases_)
+    free(pre_bases_);
+  pre_bases_ = NULL;
+
+  if (NULL != pre_items_)
+    free(pre_items_);
+  pre_items_ = NULL;
+
+  pre_key_num_ = 0;
+  pre_items_len_ = 0;
+}
+
+bool DictList::build_hz_index() {
+  // The positions are kept in uint16.
+  if (scis_num_ > 0xffff)
+    return false;
+
+  size_t page_num = 0;
+  for (size_t hi = 0; hi < 256; hi++)
+    hz_page_[hi] = kNoHzPage;
+  for (size_t pos = 0; pos < scis_num_; pos++) {
+    size_t hi = scis_hz_[pos] >> 8;
+    if (kNoHzPage == hz_page_[hi])
+      hz_page_[hi] = static_cast<uint16>(page_num++);
+  }
+
+  hz_start_ = static_cast<uint16*>
+      (malloc(page_num * kHzPageItems * sizeof(uint16)));
+  if (NULL == hz_start_)
+    return false;
+
+  // scis_hz_ is sorted, so the items of each hanzi are next to each other.
+  size_t pos = 0;
+  for (size_t hi = 0; hi < 256; hi++) {
+    if (kNoHzPage == hz_page_[hi])
+      continue;
+    uint16 *starts = hz_start_ + hz_page_[hi] * kHzPageItems;
+    for (size_t lo = 0; lo < kHzPageItems; lo++) {
+      size_t hz = (hi << 8) + lo;
+      while (pos < scis_num_ && scis_hz_[pos] < hz)
+        pos++;
+      starts[lo] = static_cast<uint16>(pos);
+    }
+  }
+
+  for (size_t full_splid = 0; full_splid < kFullSplIdStart + kMaxSpellingNum;
+       full_splid++) {
+    uint32 mask = 0;
+    for (uint16 half_splid = 1; half_splid < kFullSplIdStart; half_splid++) {
+      if (spl_trie_->is_full_id(full_splid) &&
+          spl_trie_->half_full_compatible(half_splid, full_splid))
+        mask |= static_cast<uint32>(1) << half_splid;
+    }
+    full_half_mask_[full_splid] = mask;
+  }
+
+  return true;
+}
+
+template <size_t kCmpLen>
+size_t DictList::find_first(const char16 *key, size_t word_len) const {
+  const char16 *words = buf_ + start_pos_[word_len - 1];
+  size_t low = 0;
+  size_t high = get_word_num(word_len);
+  while (low < high) {
+    size_t mid = (low + high) >> 1;
+    if (cmp_hanzis_n<kCmpLen>(words + mid * word_len, key) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+size_t DictList::find_first(const char16 *key, size_t cmp_len,
+                            size_t word_len) const {
+  assert(cmp_len > 0 && cmp_len <= word_len);
+
+  switch (cmp_len) {
+    case 1:
+      return find_first<1>(key, word_len);
+    case 2:
+      return find_first<2>(key, word_len);
+    case 3:
+      return find_first<3>(key, word_len);
+    case 4:
+      return find_first<4>(key, word_len);
+    case 5:
+      return find_first<5>(key, word_len);
+    case 6:
+      return find_first<6>(key, word_len);
+    case 7:
+      return find_first<7>(key, word_len);
+    default:
+      return find_first<8>(key, word_len);
+  }
 }
 
 #ifdef ___BUILD_MODEL___
@@ -90,8 +216,7 @@ bool DictList::init_list(const SingleCharItem *scis, size_t scis_num,
 
   initialized_ = false;
 
-  if (NULL != buf_)
-    free(buf_);
+  free_resource();
 
   // calculate the size
   size_t buf_size = calculate_size(lemma_arr, lemma_num);
@@ -102,6 +227,8 @@ bool DictList::init_list(const SingleCharItem *scis, size_t scis_num,
     return false;
 
   fill_scis(scis, scis_num);
+  if (!build_hz_index())
+    return false;
 
   // Copy the related content from the array to inner buffer
   fill_list(lemma_arr, lemma_num);
@@ -197,37 +324,229 @@ void DictList::fill_list(const LemmaEntry* lemma_arr, size_t lemma_num) {
   assert(id_num == start_id_[kMaxLemmaSize]);
 }
 
-char16* DictList::find_pos2_startedbyhz(char16 hz_char) {
-  char16 *found_2w = static_cast<char16*>
-                     (mybsearch(&hz_char, buf_ + start_pos_[1],
-                                (start_pos_[2] - start_pos_[1]) / 2,
-                                sizeof(char16) * 2, cmp_hanzis_1));
-  if (NULL == found_2w)
-    return NULL;
+// A word following a history, used to build the prediction index.
+struct PredictEntry {
+  uint32 key;
+  uint16 len;
+  uint32 index;
+  float psb;
+  char16 pre_hzs[kMaxPredictSize];
+};
+
+static int cmp_predict_entry(const void *p1, const void *p2) {
+  const PredictEntry *e1 = static_cast<const PredictEntry*>(p1);
+  const PredictEntry *e2 = static_cast<const PredictEntry*>(p2);
+  if (e1->key != e2->key)
+    return e1->key < e2->key ? -1 : 1;
+  if (e1->psb != e2->psb)
+    return e1->psb < e2->psb ? -1 : 1;
+  int ret_v = utf16_strncmp(e1->pre_hzs, e2->pre_hzs, kMaxPredictSize);
+  if (0 != ret_v)
+    return ret_v;
+  if (e1->len != e2->len)
+    return e1->len < e2->len ? -1 : 1;
+  if (e1->index != e2->index)
+    return e1->index < e2->index ? -1 : 1;
+  return 0;
+}
+
+// Get the smallest word position of each length among the entries of a key.
+// Return false if another position is max_offset or more after it.
+static bool get_predict_bases(const PredictEntry *entries, size_t entry_num,
+                              size_t max_offset, uint32 *bases) {
+  uint32 last[kMaxLemmaSize];
+  for (size_t len = 1; len <= kMaxLemmaSize; len++) {
+    bases[len - 1] = 0xffffffff;
+    last[len - 1] = 0;
+  }
+  for (size_t pos = 0; pos < entry_num; pos++) {
+    const PredictEntry *entry = entries + pos;
+    if (entry->index < bases[entry->len - 1])
+      bases[entry->len - 1] = entry->index;
+    if (entry->index > last[entry->len - 1])
+      last[entry->len - 1] = entry->index;
+  }
+  for (size_t len = 1; len <= kMaxLemmaSize; len++) {
+    if (0xffffffff == bases[len - 1])
+      bases[len - 1] = 0;
+    else if (last[len - 1] - bases[len - 1] >= max_offset)
+      return false;
+  }
+  return true;
+}
+
+bool DictList::build_predict_index() {
+  if (!initialized_)
+    return false;
+
+  free_predict_index();
+
+  size_t entry_num = 0;
+  for (uint16 key_len = 1; key_len <= kMaxPredictKeyLen; key_len++) {
+    for (size_t len = key_len + 1; len <= kMaxLemmaSize; len++)
+      entry_num += get_word_num(len);
+  }
+  if (0 == entry_num)
+    return true;
+
+  PredictEntry *entries = static_cast<PredictEntry*>(
+      malloc(entry_num * sizeof(PredictEntry)));
+  if (NULL == entries)
+    return false;
+
+  NGram &ngram = NGram::get_instance();
+  size_t entry_pos = 0;
+  for (uint16 key_len = 1; key_len <= kMaxPredictKeyLen; key_len++) {
+    for (size_t len = key_len + 1; len <= kMaxLemmaSize; len++) {
+      size_t word_num = get_word_num(len);
+      for (size_t index = 0; index < word_num; index++) {
+        const char16 *word = get_word(len, index);
+        PredictEntry *entry = entries + entry_pos;
+        entry_pos++;
+        memset(entry, 0, sizeof(PredictEntry));
+        entry->key = word[0];
+        if (2 == key_len)
+          entry->key = (entry->key << 16) | word[1];
+        entry->len = static_cast<uint16>(len);
+        entry->index = static_cast<uint32>(index);
+        entry->psb = ngram.get_uni_psb(index + start_id_[len - 1]);
+        utf16_strncpy(entry->pre_hzs, word + key_len, len - key_len);
+      }
+    }
+  }
+  assert(entry_pos == entry_num);
 
-  while (found_2w > buf_ + start_pos_[1] && *found_2w == *(found_2w - 1))
-    found_2w -= 2;
+  myqsort(entries, entry_num, sizeof(PredictEntry), cmp_predict_entry);
+
+  // Keep the best word of each string, and the first kMaxPredictIndexItems
+  // strings of each key. Drop the keys with few strings, it is as fast to
+  // search the word list for them. Also drop a key if the positions of its
+  // words are too far apart to be stored as offsets, which does not happen
+  // with the shipped dictionary.
+  const size_t max_offset = 1u << kPredictItemPosBits;
+  uint32 bases[kMaxLemmaSize];
+  size_t item_num = 0;
+  size_t key_begin = 0;
+  for (size_t pos = 0; pos <= entry_num; pos++) {
+    if (pos == entry_num || entries[pos].key != entries[key_begin].key) {
+      if (item_num - key_begin < kMinPredictIndexItems ||
+          !get_predict_bases(entries + key_begin, item_num - key_begin,
+                             max_offset, bases))
+        item_num = key_begin;
+      else
+        pre_key_num_++;
+      if (pos == entry_num)
+        break;
+      key_begin = item_num;
+    }
+
+    if (item_num - key_begin >= kMaxPredictIndexItems)
+      continue;
+    size_t kept_pos;
+    for (kept_pos = key_begin; kept_pos < item_num; kept_pos++) {
+      if (utf16_strncmp(entries[kept_pos].pre_hzs, entries[pos].pre_hzs,
+                        kMaxPredictSize) == 0)
+        break;
+    }
+    if (kept_pos < item_num)
+      continue;
+    if (item_num != pos)
+      entries[item_num] = entries[pos];
+    item_num++;
+  }
+
+  if (0 == pre_key_num_) {
+    free(entries);
+    return true;
+  }
+
+  pre_items_len_ = item_num;
+  pre_keys_ = static_cast<uint32*>(malloc(pre_key_num_ * sizeof(uint32)));
+  pre_pos_ = static_cast<uint32*>(malloc((pre_key_num_ + 1) *
+                                         sizeof(uint32)));
+  pre_bases_ = static_cast<uint32*>(malloc(pre_key_num_ * kMaxLemmaSize *
+                                           sizeof(uint32)));
+  pre_items_ = static_cast<uint16*>(malloc(pre_items_len_ * sizeof(uint16)));
+  if (NULL == pre_keys_ || NULL == pre_pos_ || NULL == pre_bases_ ||
+      NULL == pre_items_) {
+    free(entries);
+    free_predict_index();
+    return false;
+  }
+
+  key_begin = 0;
+  for (size_t key_pos = 0; key_pos < pre_key_num_; key_pos++) {
+    size_t key_end = key_begin + 1;
+    while (key_end < pre_items_len_ &&
+           entries[key_end].key == entries[key_begin].key)
+      key_end++;
+
+    uint32 *key_bases = pre_bases_ + key_pos * kMaxLemmaSize;
+    bool fit = get_predict_bases(entries + key_begin, key_end - key_begin,
+                                 max_offset, key_bases);
+    assert(fit);
+    pre_keys_[key_pos] = entries[key_begin].key;
+    pre_pos_[key_pos] = static_cast<uint32>(key_begin);
+    for (size_t pos = key_begin; pos < key_end; pos++) {
+      const PredictEntry *entry = entries + pos;
+      pre_items_[pos] = static_cast<uint16>(
+          ((entry->len - 1) << kPredictItemPosBits) |
+          (entry->index - key_bases[entry->len - 1]));
+    }
+    key_begin = key_end;
+  }
+  assert(key_begin == pre_items_len_);
+  pre_pos_[pre_key_num_] = static_cast<uint32>(pre_items_len_);
 
-  return found_2w;
+  free(entries);
+  return true;
 }
-#endif  // ___BUILD_MODEL___
 
-char16* DictList::find_pos_startedbyhzs(const char16 last_hzs[],
-    size_t word_len, int (*cmp_func)(const void *, const void *)) {
-  char16 *found_w = static_cast<char16*>
-                    (mybsearch(last_hzs, buf_ + start_pos_[word_len - 1],
-                               (start_pos_[word_len] - start_pos_[word_len - 1])
-                               / word_len,
-                               sizeof(char16) * word_len, cmp_func));
+#endif  // ___BUILD_MODEL___
 
-  if (NULL == found_w)
-    return NULL;
+bool DictList::predict_by_index(const char16 last_hzs[], uint16 hzs_len,
+                                NPredictItem *npre_items, size_t npre_max,
+                                size_t *item_num) {
+  if (NULL == pre_keys_ || hzs_len > kMaxPredictKeyLen)
+    return false;
 
-  while (found_w > buf_ + start_pos_[word_len -1] &&
-         cmp_func(found_w, found_w - word_len) == 0)
-    found_w -= word_len;
+  uint32 key = last_hzs[0];
+  if (2 == hzs_len)
+    key = (key << 16) | last_hzs[1];
+
+  size_t begin = 0;
+  size_t end = pre_key_num_;
+  while (begin < end) {
+    size_t middle = (begin + end) / 2;
+    if (pre_keys_[middle] < key)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+  if (begin >= pre_key_num_ || pre_keys_[begin] != key)
+    return false;
 
-  return found_w;
+  const uint32 *bases = pre_bases_ + begin * kMaxLemmaSize;
+  NGram& ngram = NGram::get_instance();
+  *item_num = 0;
+  for (size_t pos = pre_pos_[begin];
+       pos < pre_pos_[begin + 1] && *item_num < npre_max; pos++) {
+    size_t word_len = (pre_items_[pos] >> kPredictItemPosBits) + 1;
+    if (word_len <= hzs_len)
+      continue;
+    size_t index = bases[word_len - 1] +
+        (pre_items_[pos] & ((1u << kPredictItemPosBits) - 1));
+    if (index >= get_word_num(word_len))
+      continue;
+    const char16 *word = get_word(word_len, index);
+    NPredictItem *npre_item = npre_items + *item_num;
+    memset(npre_item, 0, sizeof(NPredictItem));
+    utf16_strncpy(npre_item->pre_hzs, word + hzs_len, word_len - hzs_len);
+    npre_item->psb = ngram.get_uni_psb(index + start_id_[word_len - 1]);
+    npre_item->his_len = hzs_len;
+    (*item_num)++;
+  }
+  return true;
 }
 
 size_t DictList::predict(const char16 last_hzs[], uint16 hzs_len,
@@ -236,51 +555,36 @@ size_t DictList::predict(const char16 last_hzs[], uint16 hzs_len,
   assert(hzs_len <= kMaxPredictSize && hzs_len > 0);
 
   // 1. Prepare work
-  int (*cmp_func)(const void *, const void *) = cmp_func_[hzs_len - 1];
-
   NGram& ngram = NGram::get_instance();
 
   size_t item_num = 0;
 
-  // 2. Do prediction
+  // 2. Do prediction, by the prediction index if the history is in it.
+  if (predict_by_index(last_hzs, hzs_len, npre_items, npre_max, &item_num))
+    return remove_b4_used_npre(npre_items, item_num, b4_used);
+
   for (uint16 pre_len = 1; pre_len <= kMaxPredictSize + 1 - hzs_len;
        pre_len++) {
     uint16 word_len = hzs_len + pre_len;
-    char16 *w_buf = find_pos_startedbyhzs(last_hzs, word_len, cmp_func);
-    if (NULL == w_buf)
-      continue;
-    while (w_buf < buf_ + start_pos_[word_len] &&
-           cmp_func(w_buf, last_hzs) == 0 &&
-           item_num < npre_max) {
+    size_t word_num = get_word_num(word_len);
+    // The words are sorted, so those started by last_hzs are next to each
+    // other.
+    for (size_t index = find_first(last_hzs, hzs_len, word_len);
+         index < word_num && item_num < npre_max; index++) {
+      const char16 *word = get_word(word_len, index);
+      if (utf16_strncmp(word, last_hzs, hzs_len) != 0)
+        break;
       memset(npre_items + item_num, 0, sizeof(NPredictItem));
-      utf16_strncpy(npre_items[item_num].pre_hzs, w_buf + hzs_len, pre_len);
+      utf16_strncpy(npre_items[item_num].pre_hzs, word + hzs_len, pre_len);
       npre_items[item_num].psb =
-        ngram.get_uni_psb((size_t)(w_buf - buf_ - start_pos_[word_len - 1])
-                          / word_len + start_id_[word_len - 1]);
+        ngram.get_uni_psb(index + start_id_[word_len - 1]);
       npre_items[item_num].his_len = hzs_len;
       item_num++;
-      w_buf += word_len;
     }
   }
 
-  size_t new_num = 0;
-  for (size_t i = 0; i < item_num; i++) {
-    // Try to find it in the existing items
-    size_t e_pos;
-    for (e_pos = 1; e_pos <= b4_used; e_pos++) {
-      if (utf16_strncmp((*(npre_items - e_pos)).pre_hzs, npre_items[i].pre_hzs,
-                        kMaxPredictSize) == 0)
-        break;
-    }
-    if (e_pos <= b4_used)
-      continue;
-
-    // If not found, append it to the buffer
-    npre_items[new_num] = npre_items[i];
-    new_num++;
-  }
-
-  return new_num;
+  // Remove the items which have been predicted before.
+  return remove_b4_used_npre(npre_items, item_num, b4_used);
 }
 
 uint16 DictList::get_lemma_str(LemmaIdType id_lemma, char16 *str_buf,
@@ -296,7 +600,7 @@ uint16 DictList::get_lemma_str(LemmaIdType id_lemma, char16 *str_buf,
     if (start_id_[i] <= id_lemma && start_id_[i + 1] > id_lemma) {
       size_t id_span = id_lemma - start_id_[i];
 
-      uint16 *buf = buf_ + start_pos_[i] + id_span * (i + 1);
+      const char16 *buf = get_word(i + 1, id_span);
       for (uint16 len = 0; len <= i; len++) {
         str_buf[len] = buf[len];
       }
@@ -309,55 +613,84 @@ uint16 DictList::get_lemma_str(LemmaIdType id_lemma, char16 *str_buf,
 
 uint16 DictList::get_splids_for_hanzi(char16 hanzi, uint16 half_splid,
                                       uint16 *splids, uint16 max_splids) {
-  char16 *hz_found = static_cast<char16*>
-      (mybsearch(&hanzi, scis_hz_, scis_num_, sizeof(char16), cmp_hanzis_1));
-  assert(NULL != hz_found && hanzi == *hz_found);
+  assert(half_splid < kFullSplIdStart);
 
-  // Move to the first one.
-  while (hz_found > scis_hz_ && hanzi == *(hz_found - 1))
-    hz_found--;
+  uint16 page = hz_page_[hanzi >> 8];
+  assert(kNoHzPage != page);
+  const uint16 *starts = hz_start_ + page * kHzPageItems + (hanzi & 0xff);
+  uint16 begin = starts[0];
+  uint16 end = starts[1];
+  assert(begin < end);
 
   // First try to found if strict comparison result is not zero.
-  char16 *hz_f = hz_found;
-  bool strict = false;
-  while (hz_f < scis_hz_ + scis_num_ && hanzi == *hz_f) {
-    uint16 pos = hz_f - scis_hz_;
-    if (0 == half_splid || scis_splid_[pos].half_splid == half_splid) {
+  bool strict = 0 == half_splid;
+  for (uint16 pos = begin; !strict && pos < end; pos++) {
+    if (scis_splid_[pos].half_splid == half_splid)
       strict = true;
-    }
-    hz_f++;
   }
 
+  uint32 half_bit = static_cast<uint32>(1) << half_splid;
   uint16 found_num = 0;
-  while (hz_found < scis_hz_ + scis_num_ && hanzi == *hz_found) {
-    uint16 pos = hz_found - scis_hz_;
+  for (uint16 pos = begin; pos < end; pos++) {
     if (0 == half_splid ||
         (strict && scis_splid_[pos].half_splid == half_splid) ||
-        (!strict && spl_trie_->half_full_compatible(half_splid,
-        scis_splid_[pos].full_splid))) {
+        (!strict &&
+         0 != (full_half_mask_[scis_splid_[pos].full_splid] & half_bit))) {
       assert(found_num + 1 < max_splids);
       splids[found_num] = scis_splid_[pos].full_splid;
       found_num++;
     }
-    hz_found++;
   }
 
   return found_num;
 }
 
 LemmaIdType DictList::get_lemma_id(const char16 *str, uint16 str_len) {
-  if (NULL == str || str_len > kMaxLemmaSize)
+  if (!initialized_ || NULL == str || 0 == str_len ||
+      str_len > kMaxLemmaSize)
+    return 0;
+
+  size_t index = find_first(str, str_len, str_len);
+  if (index >= get_word_num(str_len) ||
+      utf16_strncmp(get_word(str_len, index), str, str_len) != 0)
     return 0;
 
-  char16 *found = find_pos_startedbyhzs(str, str_len, cmp_func_[str_len - 1]);
-  if (NULL == found)
+  return static_cast<LemmaIdType>(start_id_[str_len - 1] + index);
+}
+
+uint16 DictList::get_lemma_pos(LemmaIdType id_lemma, size_t *pos) {
+  if (!initialized_ || id_lemma >= start_id_[kMaxLemmaSize] || NULL == pos)
     return 0;
 
-  assert(found > buf_);
-  assert(static_cast<size_t>(found - buf_) >= start_pos_[str_len - 1]);
-  return static_cast<LemmaIdType>
-      (start_id_[str_len - 1] +
-       (found - buf_ - start_pos_[str_len - 1]) / str_len);
+  for (uint16 i = 0; i < kMaxLemmaSize; i++) {
+    if (start_id_[i] <= id_lemma && start_id_[i + 1] > id_lemma) {
+      *pos = start_pos_[i] + (id_lemma - start_id_[i]) * (i + 1);
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+size_t DictList::get_mem_size() {
+  size_t size = sizeof(DictList);
+  if (!initialized_)
+    return size;
+
+  size += scis_num_ * (sizeof(char16) + sizeof(SpellingId));
+  for (size_t hi = 0; hi < 256; hi++) {
+    if (kNoHzPage != hz_page_[hi])
+      size += kHzPageItems * sizeof(uint16);
+  }
+
+  size += start_pos_[kMaxLemmaSize] * sizeof(char16);
+
+  if (NULL != pre_keys_) {
+    size += pre_key_num_ * sizeof(uint32) +
+            (pre_key_num_ + 1) * sizeof(uint32) +
+            pre_key_num_ * kMaxLemmaSize * sizeof(uint32) +
+            pre_items_len_ * sizeof(uint16);
+  }
+  return size;
 }
 
 void DictList::convert_to_hanzis(char16 *str, uint16 str_len) {
@@ -384,15 +717,15 @@ bool DictList::save_list(FILE *fp) {
       NULL == scis_hz_ || NULL == scis_splid_ || 0 == scis_num_)
     return false;
 
-  if (fwrite(&scis_num_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fwrite(start_pos_, sizeof(size_t), kMaxLemmaSize + 1, fp) !=
-      kMaxLemmaSize + 1)
-    return false;
-
-  if (fwrite(start_id_, sizeof(size_t), kMaxLemmaSize + 1, fp) !=
-      kMaxLemmaSize + 1)
+  // The sizes are stored as uint32, so that the file is the same on all
+  // hosts.
+  uint32 sizes[kListSizesNum];
+  sizes[0] = static_cast<uint32>(scis_num_);
+  for (size_t pos = 0; pos <= kMaxLemmaSize; pos++) {
+    sizes[1 + pos] = static_cast<uint32>(start_pos_[pos]);
+    sizes[kMaxLemmaSize + 2 + pos] = static_cast<uint32>(start_id_[pos]);
+  }
+  if (fwrite(sizes, sizeof(uint32), kListSizesNum, fp) != kListSizesNum)
     return false;
 
   if (fwrite(scis_hz_, sizeof(char16), scis_num_, fp) != scis_num_)
@@ -414,16 +747,14 @@ bool DictList::load_list(FILE *fp) {
 
   initialized_ = false;
 
-  if (fread(&scis_num_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fread(start_pos_, sizeof(size_t), kMaxLemmaSize + 1, fp) !=
-      kMaxLemmaSize + 1)
-    return false;
-
-  if (fread(start_id_, sizeof(size_t), kMaxLemmaSize + 1, fp) !=
-      kMaxLemmaSize + 1)
+  uint32 sizes[kListSizesNum];
+  if (fread(sizes, sizeof(uint32), kListSizesNum, fp) != kListSizesNum)
     return false;
+  scis_num_ = sizes[0];
+  for (size_t pos = 0; pos <= kMaxLemmaSize; pos++) {
+    start_pos_[pos] = sizes[1 + pos];
+    start_id_[pos] = sizes[kMaxLemmaSize + 2 + pos];
+  }
 
   free_resource();
 
@@ -436,6 +767,9 @@ bool DictList::load_list(FILE *fp) {
   if (fread(scis_splid_, sizeof(SpellingId), scis_num_, fp) != scis_num_)
     return false;
 
+  if (!build_hz_index())
+    return false;
+
   if (fread(buf_, sizeof(char16), start_pos_[kMaxLemmaSize], fp) !=
       start_pos_[kMaxLemmaSize])
     return false;
@@ -443,4 +777,84 @@ bool DictList::load_list(FILE *fp) {
   initialized_ = true;
   return true;
 }
+
+bool DictList::save_predict_index(FILE *fp) {
+  if (NULL == fp)
+    return false;
+
+  // Without an index, an empty one is written.
+  uint32 header[3];
+  header[0] = kPredictIndexMagic;
+  header[1] = static_cast<uint32>(pre_key_num_);
+  header[2] = static_cast<uint32>(pre_items_len_);
+  if (fwrite(header, sizeof(uint32), 3, fp) != 3)
+    return false;
+
+  if (NULL == pre_keys_)
+    return true;
+
+  if (fwrite(pre_keys_, sizeof(uint32), pre_key_num_, fp) != pre_key_num_)
+    return false;
+
+  if (fwrite(pre_pos_, sizeof(uint32), pre_key_num_ + 1, fp) !=
+      pre_key_num_ + 1)
+    return false;
+
+  if (fwrite(pre_bases_, sizeof(uint32), pre_key_num_ * kMaxLemmaSize, fp) !=
+      pre_key_num_ * kMaxLemmaSize)
+    return false;
+
+  if (fwrite(pre_items_, sizeof(uint16), pre_items_len_, fp) !=
+      pre_items_len_)
+    return false;
+
+  return true;
+}
+
+bool DictList::load_predict_index(FILE *fp) {
+  if (NULL == fp || !initialized_)
+    return false;
+
+  free_predict_index();
+
+  uint32 header[3];
+  if (fread(header, sizeof(uint32), 3, fp) != 3 ||
+      kPredictIndexMagic != header[0])
+    return false;
+
+  if (0 == header[1])
+    return 0 == header[2];
+
+  pre_key_num_ = header[1];
+  pre_items_len_ = header[2];
+  pre_keys_ = static_cast<uint32*>(malloc(pre_key_num_ * sizeof(uint32)));
+  pre_pos_ = static_cast<uint32*>(malloc((pre_key_num_ + 1) *
+                                         sizeof(uint32)));
+  pre_bases_ = static_cast<uint32*>(malloc(pre_key_num_ * kMaxLemmaSize *
+                                           sizeof(uint32)));
+  pre_items_ = static_cast<uint16*>(malloc(pre_items_len_ * sizeof(uint16)));
+
+  bool success = NULL != pre_keys_ && NULL != pre_pos_ &&
+      NULL != pre_bases_ && NULL != pre_items_ &&
+      fread(pre_keys_, sizeof(uint32), pre_key_num_, fp) == pre_key_num_ &&
+      fread(pre_pos_, sizeof(uint32), pre_key_num_ + 1, fp) ==
+      pre_key_num_ + 1 &&
+      fread(pre_bases_, sizeof(uint32), pre_key_num_ * kMaxLemmaSize, fp) ==
+      pre_key_num_ * kMaxLemmaSize &&
+      fread(pre_items_, sizeof(uint16), pre_items_len_, fp) ==
+      pre_items_len_ &&
+      0 == pre_pos_[0] && pre_items_len_ == pre_pos_[pre_key_num_];
+
+  // Make sure that the keys are sorted, and the items of each key are in
+  // the buffer. Whether the word of an item is in the word list is checked
+  // when it is used.
+  for (size_t key_pos = 0; success && key_pos < pre_key_num_; key_pos++) {
+    success = pre_pos_[key_pos] <= pre_pos_[key_pos + 1] &&
+        (0 == key_pos || pre_keys_[key_pos - 1] < pre_keys_[key_pos]);
+  }
+
+  if (!success)
+    free_predict_index();
+  return success;
+}
 }  // namespace ime_pinyin
@@ -37,6 +37,10 @@ DictTrie::DictTrie() {
   lma_idx_buf_len_ = 0;
   total_lma_num_ = 0;
   top_lmas_num_ = 0;
+  lma_splids_ = NULL;
+  lma_splids_len_ = 0;
+  top_lmas_ = NULL;
+  top_lmas_valid_num_ = 0;
   dict_list_ = NULL;
 
   parsing_marks_ = NULL;
@@ -61,9 +65,19 @@ void DictTrie::free_resource(bool free_dict_list) {
     free(nodes_ge1_);
   nodes_ge1_ = NULL;
 
-  if (NULL != nodes_ge1_)
-    free(nodes_ge1_);
-  nodes_ge1_ = NULL;
+  if (NULL != lma_idx_buf_)
+    free(lma_idx_buf_);
+  lma_idx_buf_ = NULL;
+
+  if (NULL != lma_splids_)
+    free(lma_splids_);
+  lma_splids_ = NULL;
+  lma_splids_len_ = 0;
+
+  if (NULL != top_lmas_)
+    free(top_lmas_);
+  top_lmas_ = NULL;
+  top_lmas_valid_num_ = 0;
 
   if (free_dict_list) {
     if (NULL != dict_list_) {
@@ -84,20 +98,15 @@ void DictTrie::free_resource(bool free_dict_list) {
 }
 
 inline size_t DictTrie::get_son_offset(const LmaNodeGE1 *node) {
-  return ((size_t)node->son_1st_off_l + ((size_t)node->son_1st_off_h << 16));
+  return node->son_1st_off;
 }
 
 inline size_t DictTrie::get_homo_idx_buf_offset(const LmaNodeGE1 *node) {
-  return ((size_t)node->homo_idx_buf_off_l +
-          ((size_t)node->homo_idx_buf_off_h << 16));
+  return node->homo_idx_buf_off;
 }
 
 inline LemmaIdType DictTrie::get_lemma_id(size_t id_offset) {
-  LemmaIdType id = 0;
-  for (uint16 pos = kLemmaIdSize - 1; pos > 0; pos--)
-    id = (id << 8) + lma_idx_buf_[id_offset * kLemmaIdSize + pos];
-  id = (id << 8) + lma_idx_buf_[id_offset * kLemmaIdSize];
-  return id;
+  return lma_idx_buf_[id_offset];
 }
 
 #ifdef ___BUILD_MODEL___
@@ -113,16 +122,13 @@ bool DictTrie::save_dict(FILE *fp) {
   if (NULL == fp)
     return false;
 
-  if (fwrite(&lma_node_num_le0_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fwrite(&lma_node_num_ge1_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fwrite(&lma_idx_buf_len_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fwrite(&top_lmas_num_, sizeof(size_t), 1, fp) != 1)
+  uint32 header[5];
+  header[0] = kDictTrieMagic;
+  header[1] = static_cast<uint32>(lma_node_num_le0_);
+  header[2] = static_cast<uint32>(lma_node_num_ge1_);
+  header[3] = static_cast<uint32>(lma_idx_buf_len_);
+  header[4] = static_cast<uint32>(top_lmas_num_);
+  if (fwrite(header, sizeof(uint32), 5, fp) != 5)
     return false;
 
   if (fwrite(root_, sizeof(LmaNodeLE0), lma_node_num_le0_, fp)
@@ -133,7 +139,7 @@ bool DictTrie::save_dict(FILE *fp) {
       != lma_node_num_ge1_)
     return false;
 
-  if (fwrite(lma_idx_buf_, sizeof(unsigned char), lma_idx_buf_len_, fp) !=
+  if (fwrite(lma_idx_buf_, sizeof(uint32), lma_idx_buf_len_, fp) !=
       lma_idx_buf_len_)
     return false;
 
@@ -155,41 +161,31 @@ bool DictTrie::save_dict(const char *filename) {
     return false;
 
   if (!spl_trie.save_spl_trie(fp) || !dict_list_->save_list(fp) ||
-      !save_dict(fp) || !ngram.save_ngram(fp)) {
+      !save_dict(fp) || !ngram.save_ngram(fp) ||
+      !dict_list_->save_predict_index(fp)) {
     fclose(fp);
+    remove(filename);
     return false;
   }
 
-  fclose(fp);
+  if (0 != fclose(fp)) {
+    remove(filename);
+    return false;
+  }
   return true;
 }
 #endif  // ___BUILD_MODEL___
 
-bool DictTrie::load_dict(FILE *fp) {
-  if (NULL == fp)
-    return false;
-
-  if (fread(&lma_node_num_le0_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fread(&lma_node_num_ge1_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fread(&lma_idx_buf_len_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fread(&top_lmas_num_, sizeof(size_t), 1, fp) != 1 ||
-      top_lmas_num_ >= lma_idx_buf_len_)
-    return false;
-
+bool DictTrie::alloc_resource() {
   free_resource(false);
 
   root_ = static_cast<LmaNodeLE0*>
           (malloc(lma_node_num_le0_ * sizeof(LmaNodeLE0)));
   nodes_ge1_ = static_cast<LmaNodeGE1*>
                (malloc(lma_node_num_ge1_ * sizeof(LmaNodeGE1)));
-  lma_idx_buf_ = (unsigned char*)malloc(lma_idx_buf_len_);
-  total_lma_num_ = lma_idx_buf_len_ / kLemmaIdSize;
+  lma_idx_buf_ = static_cast<uint32*>
+                 (malloc(lma_idx_buf_len_ * sizeof(uint32)));
+  total_lma_num_ = lma_idx_buf_len_;
 
   size_t buf_size = SpellingTrie::get_instance().get_spelling_num() + 1;
   assert(lma_node_num_le0_ <= buf_size);
@@ -206,19 +202,216 @@ bool DictTrie::load_dict(FILE *fp) {
     free_resource(false);
     return false;
   }
+  return true;
+}
 
-  if (fread(root_, sizeof(LmaNodeLE0), lma_node_num_le0_, fp)
-      != lma_node_num_le0_)
+bool DictTrie::load_dict_v1(FILE *fp) {
+  uint32 header[4];
+  if (fread(header, sizeof(uint32), 4, fp) != 4)
     return false;
 
-  if (fread(nodes_ge1_, sizeof(LmaNodeGE1), lma_node_num_ge1_, fp)
-      != lma_node_num_ge1_)
+  lma_node_num_le0_ = header[0];
+  lma_node_num_ge1_ = header[1];
+  lma_idx_buf_len_ = header[2] / kLemmaIdSize;
+  top_lmas_num_ = header[3];
+  if (top_lmas_num_ >= lma_idx_buf_len_)
     return false;
 
-  if (fread(lma_idx_buf_, sizeof(unsigned char), lma_idx_buf_len_, fp) !=
-      lma_idx_buf_len_)
+  if (!alloc_resource())
     return false;
 
+  LmaNodeLE0V1 *le0_v1 = static_cast<LmaNodeLE0V1*>
+                         (malloc(lma_node_num_le0_ * sizeof(LmaNodeLE0V1)));
+  LmaNodeGE1V1 *ge1_v1 = static_cast<LmaNodeGE1V1*>
+                         (malloc(lma_node_num_ge1_ * sizeof(LmaNodeGE1V1)));
+  unsigned char *idx_v1 = static_cast<unsigned char*>
+                          (malloc(lma_idx_buf_len_ * kLemmaIdSize));
+
+  bool success = NULL != le0_v1 && NULL != ge1_v1 && NULL != idx_v1 &&
+      fread(le0_v1, sizeof(LmaNodeLE0V1), lma_node_num_le0_, fp) ==
+      lma_node_num_le0_ &&
+      fread(ge1_v1, sizeof(LmaNodeGE1V1), lma_node_num_ge1_, fp) ==
+      lma_node_num_ge1_ &&
+      fread(idx_v1, kLemmaIdSize, lma_idx_buf_len_, fp) == lma_idx_buf_len_;
+
+  if (success) {
+    for (size_t pos = 0; pos < lma_node_num_le0_; pos++) {
+      LmaNodeLE0 *node = root_ + pos;
+      memset(node, 0, sizeof(LmaNodeLE0));
+      node->son_1st_off = static_cast<uint32>(le0_v1[pos].son_1st_off);
+      node->homo_idx_buf_off =
+          static_cast<uint32>(le0_v1[pos].homo_idx_buf_off);
+      node->spl_idx = le0_v1[pos].spl_idx;
+      node->num_of_son = le0_v1[pos].num_of_son;
+      node->num_of_homo = le0_v1[pos].num_of_homo;
+    }
+
+    for (size_t pos = 0; pos < lma_node_num_ge1_; pos++) {
+      LmaNodeGE1 *node = nodes_ge1_ + pos;
+      node->son_1st_off = ge1_v1[pos].son_1st_off_l +
+          (static_cast<uint32>(ge1_v1[pos].son_1st_off_h) << 16);
+      node->homo_idx_buf_off = ge1_v1[pos].homo_idx_buf_off_l +
+          (static_cast<uint32>(ge1_v1[pos].homo_idx_buf_off_h) << 16);
+      node->spl_idx = ge1_v1[pos].spl_idx;
+      node->num_of_son = ge1_v1[pos].num_of_son;
+      node->num_of_homo = ge1_v1[pos].num_of_homo;
+    }
+
+    for (size_t pos = 0; pos < lma_idx_buf_len_; pos++) {
+      uint32 id = 0;
+      for (size_t byte = kLemmaIdSize; byte > 0; byte--)
+        id = (id << 8) + idx_v1[pos * kLemmaIdSize + byte - 1];
+      lma_idx_buf_[pos] = id;
+    }
+  }
+
+  if (NULL != le0_v1)
+    free(le0_v1);
+  if (NULL != ge1_v1)
+    free(ge1_v1);
+  if (NULL != idx_v1)
+    free(idx_v1);
+
+  return success && sort_nodes_bfs();
+}
+
+bool DictTrie::sort_nodes_bfs() {
+  LmaNodeGE1 *nodes = static_cast<LmaNodeGE1*>
+                      (malloc(lma_node_num_ge1_ * sizeof(LmaNodeGE1)));
+  uint32 *ids = static_cast<uint32*>
+                (malloc(lma_idx_buf_len_ * sizeof(uint32)));
+  if (NULL == nodes || NULL == ids) {
+    if (NULL != nodes)
+      free(nodes);
+    if (NULL != ids)
+      free(ids);
+    return false;
+  }
+
+  size_t node_num = 0;
+  size_t id_num = 0;
+  bool success = true;
+
+  // The ids of the root and the first level, and the son lists of the first
+  // level.
+  for (size_t pos = 0; pos < lma_node_num_le0_ && success; pos++) {
+    LmaNodeLE0 *node = root_ + pos;
+    if (node->homo_idx_buf_off + node->num_of_homo >
+        lma_idx_buf_len_ - top_lmas_num_ ||
+        id_num + node->num_of_homo > lma_idx_buf_len_ - top_lmas_num_) {
+      success = false;
+      break;
+    }
+    memcpy(ids + id_num, lma_idx_buf_ + node->homo_idx_buf_off,
+           node->num_of_homo * sizeof(uint32));
+    node->homo_idx_buf_off = static_cast<uint32>(id_num);
+    id_num += node->num_of_homo;
+
+    // The sons of the root are LmaNodeLE0 nodes.
+    if (0 == pos || 0 == node->num_of_son)
+      continue;
+    if (node->son_1st_off + node->num_of_son > lma_node_num_ge1_ ||
+        node_num + node->num_of_son > lma_node_num_ge1_) {
+      success = false;
+      break;
+    }
+    memcpy(nodes + node_num, nodes_ge1_ + node->son_1st_off,
+           node->num_of_son * sizeof(LmaNodeGE1));
+    node->son_1st_off = static_cast<uint32>(node_num);
+    node_num += node->num_of_son;
+  }
+
+  // The nodes are visited in the order they are copied, so the son lists
+  // are appended level by level.
+  for (size_t pos = 0; pos < node_num && success; pos++) {
+    LmaNodeGE1 *node = nodes + pos;
+    if (node->homo_idx_buf_off + node->num_of_homo >
+        lma_idx_buf_len_ - top_lmas_num_ ||
+        id_num + node->num_of_homo > lma_idx_buf_len_ - top_lmas_num_) {
+      success = false;
+      break;
+    }
+    memcpy(ids + id_num, lma_idx_buf_ + node->homo_idx_buf_off,
+           node->num_of_homo * sizeof(uint32));
+    node->homo_idx_buf_off = static_cast<uint32>(id_num);
+    id_num += node->num_of_homo;
+
+    if (0 == node->num_of_son)
+      continue;
+    if (node->son_1st_off + node->num_of_son > lma_node_num_ge1_ ||
+        node_num + node->num_of_son > lma_node_num_ge1_) {
+      success = false;
+      break;
+    }
+    memcpy(nodes + node_num, nodes_ge1_ + node->son_1st_off,
+           node->num_of_son * sizeof(LmaNodeGE1));
+    node->son_1st_off = static_cast<uint32>(node_num);
+    node_num += node->num_of_son;
+  }
+
+  // The top lemmas are kept at the end.
+  if (success && node_num == lma_node_num_ge1_ &&
+      id_num + top_lmas_num_ == lma_idx_buf_len_) {
+    memcpy(ids + id_num, lma_idx_buf_ + lma_idx_buf_len_ - top_lmas_num_,
+           top_lmas_num_ * sizeof(uint32));
+  } else {
+    success = false;
+  }
+
+  if (!success) {
+    free(nodes);
+    free(ids);
+    return false;
+  }
+
+  free(nodes_ge1_);
+  nodes_ge1_ = nodes;
+  free(lma_idx_buf_);
+  lma_idx_buf_ = ids;
+  return true;
+}
+
+bool DictTrie::load_dict(FILE *fp) {
+  if (NULL == fp)
+    return false;
+
+  uint32 header[5];
+  if (fread(header, sizeof(uint32), 1, fp) != 1)
+    return false;
+
+  if (kDictTrieMagic != header[0]) {
+    if (0 != fseek(fp, -static_cast<long>(sizeof(uint32)), SEEK_CUR) ||
+        !load_dict_v1(fp))
+      return false;
+  } else {
+    if (fread(header + 1, sizeof(uint32), 4, fp) != 4)
+      return false;
+
+    lma_node_num_le0_ = header[1];
+    lma_node_num_ge1_ = header[2];
+    lma_idx_buf_len_ = header[3];
+    top_lmas_num_ = header[4];
+    if (top_lmas_num_ >= lma_idx_buf_len_)
+      return false;
+
+    if (!alloc_resource())
+      return false;
+
+    if (fread(root_, sizeof(LmaNodeLE0), lma_node_num_le0_, fp)
+        != lma_node_num_le0_)
+      return false;
+
+    if (fread(nodes_ge1_, sizeof(LmaNodeGE1), lma_node_num_ge1_, fp)
+        != lma_node_num_ge1_)
+      return false;
+
+    if (fread(lma_idx_buf_, sizeof(uint32), lma_idx_buf_len_, fp) !=
+        lma_idx_buf_len_)
+      return false;
+  }
+
+  size_t buf_size = SpellingTrie::get_instance().get_spelling_num() + 1;
+
   // The quick index for the first level sons
   uint16 last_splid = kFullSplIdStart;
   size_t last_pos = 0;
@@ -238,9 +431,111 @@ bool DictTrie::load_dict(FILE *fp) {
     splid_le0_index_[splid - kFullSplIdStart] = last_pos + 1;
   }
 
+  build_lma_splids();
+
   return true;
 }
 
+int DictTrie::cmp_top_lemma(const void *p1, const void *p2) {
+  NGram &ngram = NGram::get_instance();
+  const TopLemma *lma1 = static_cast<const TopLemma*>(p1);
+  const TopLemma *lma2 = static_cast<const TopLemma*>(p2);
+  float psb1 = ngram.get_uni_psb(lma1->id);
+  float psb2 = ngram.get_uni_psb(lma2->id);
+  if (psb1 != psb2)
+    return psb1 < psb2 ? -1 : 1;
+  return utf16_strncmp(lma1->str, lma2->str, kMaxPredictSize);
+}
+
+void DictTrie::build_top_lmas() {
+  if (NULL != top_lmas_)
+    free(top_lmas_);
+  top_lmas_ = NULL;
+  top_lmas_valid_num_ = 0;
+
+  if (NULL == dict_list_ || 0 == top_lmas_num_)
+    return;
+
+  top_lmas_ = static_cast<TopLemma*>(malloc(top_lmas_num_ *
+                                            sizeof(TopLemma)));
+  if (NULL == top_lmas_)
+    return;
+
+  size_t top_lmas_id_offset = lma_idx_buf_len_ - top_lmas_num_;
+  for (size_t pos = 0; pos < top_lmas_num_; pos++) {
+    TopLemma *top_lma = top_lmas_ + top_lmas_valid_num_;
+    memset(top_lma, 0, sizeof(TopLemma));
+    top_lma->id = get_lemma_id(top_lmas_id_offset + pos);
+    if (dict_list_->get_lemma_str(top_lma->id, top_lma->str,
+                                  kMaxLemmaSize - 1) > 0)
+      top_lmas_valid_num_++;
+  }
+
+  // The order does not change with the user dictionary, which adds the same
+  // compensation to the scores of all system lemmas.
+  myqsort(top_lmas_, top_lmas_valid_num_, sizeof(TopLemma), cmp_top_lemma);
+}
+
+void DictTrie::build_lma_splids() {
+  if (NULL != lma_splids_)
+    free(lma_splids_);
+  lma_splids_ = NULL;
+  lma_splids_len_ = 0;
+
+  if (NULL == dict_list_ || 0 == dict_list_->get_list_len())
+    return;
+
+  lma_splids_len_ = dict_list_->get_list_len();
+  lma_splids_ = static_cast<uint16*>(
+      malloc(lma_splids_len_ * sizeof(uint16)));
+  if (NULL == lma_splids_) {
+    lma_splids_len_ = 0;
+    return;
+  }
+  memset(lma_splids_, 0, lma_splids_len_ * sizeof(uint16));
+
+  uint16 splids[kMaxLemmaSize];
+  for (size_t i = 1; i < lma_node_num_le0_; i++) {
+    LmaNodeLE0 *node_le0 = root_ + i;
+    splids[0] = node_le0->spl_idx;
+    set_lma_splids(node_le0->homo_idx_buf_off, node_le0->num_of_homo,
+                   splids, 1);
+    for (uint16 son_pos = 0; son_pos < node_le0->num_of_son; son_pos++) {
+      fill_lma_splids(nodes_ge1_ + node_le0->son_1st_off + son_pos, splids,
+                      1);
+    }
+  }
+}
+
+void DictTrie::fill_lma_splids(const LmaNodeGE1 *node, uint16 splids[],
+                               uint16 level) {
+  if (level >= kMaxLemmaSize)
+    return;
+
+  splids[level] = node->spl_idx;
+  set_lma_splids(get_homo_idx_buf_offset(node), node->num_of_homo, splids,
+                 level + 1);
+
+  if (0 == node->num_of_son)
+    return;
+  size_t son_off = get_son_offset(node);
+  for (uint16 son_pos = 0; son_pos < node->num_of_son; son_pos++)
+    fill_lma_splids(nodes_ge1_ + son_off + son_pos, splids, level + 1);
+}
+
+void DictTrie::set_lma_splids(size_t homo_buf_off, size_t homo_num,
+                              const uint16 splids[], uint16 splid_num) {
+  for (size_t homo_pos = 0; homo_pos < homo_num; homo_pos++) {
+    size_t pos;
+    LemmaIdType id_lemma = get_lemma_id(homo_buf_off + homo_pos);
+    if (dict_list_->get_lemma_pos(id_lemma, &pos) != splid_num ||
+        pos + splid_num > lma_splids_len_)
+      continue;
+    for (uint16 i = 0; i < splid_num; i++)
+      lma_splids_[pos + i] = splids[i];
+  }
+}
+
 bool DictTrie::load_dict(const char *filename, LemmaIdType start_id,
                          LemmaIdType end_id) {
   if (NULL == filename || end_id <= start_id)
@@ -250,6 +545,13 @@ bool DictTrie::load_dict(const char *filename, LemmaIdType start_id,
   if (NULL == fp)
     return false;
 
+  long data_end = -1;
+  if (0 != fseek(fp, 0, SEEK_END) || (data_end = ftell(fp)) < 0 ||
+      0 != fseek(fp, 0, SEEK_SET)) {
+    fclose(fp);
+    return false;
+  }
+
   free_resource(true);
 
   dict_list_ = new DictList();
@@ -263,12 +565,15 @@ bool DictTrie::load_dict(const char *filename, LemmaIdType start_id,
 
   if (!spl_trie.load_spl_trie(fp) || !dict_list_->load_list(fp) ||
       !load_dict(fp) || !ngram.load_ngram(fp) ||
+      !load_predict_index(fp, data_end) ||
       total_lma_num_ > end_id - start_id + 1) {
     free_resource(true);
     fclose(fp);
     return false;
   }
 
+  build_top_lmas();
+
   fclose(fp);
   return true;
 }
@@ -301,6 +606,7 @@ bool DictTrie::load_dict_fd(int sys_fd, long start_offset,
 
   if (!spl_trie.load_spl_trie(fp) || !dict_list_->load_list(fp) ||
       !load_dict(fp) || !ngram.load_ngram(fp) ||
+      !load_predict_index(fp, start_offset + length) ||
       ftell(fp) < start_offset + length ||
       total_lma_num_ > end_id - start_id + 1) {
     free_resource(true);
@@ -308,10 +614,19 @@ bool DictTrie::load_dict_fd(int sys_fd, long start_offset,
     return false;
   }
 
+  build_top_lmas();
+
   fclose(fp);
   return true;
 }
 
+bool DictTrie::load_predict_index(FILE *fp, long data_end) {
+  // Dictionaries built before the index was added end here.
+  if (ftell(fp) >= data_end)
+    return true;
+  return dict_list_->load_predict_index(fp);
+}
+
 size_t DictTrie::fill_lpi_buffer(LmaPsbItem lpi_items[], size_t lpi_max,
                                  LmaNodeLE0 *node) {
   size_t lpi_num = 0;
@@ -392,8 +707,6 @@ MileStoneHandle DictTrie::extend_dict0(MileStoneHandle from_handle,
   MileStoneHandle ret_handle = 0;
 
   uint16 splid = dep->splids[dep->splids_extended];
-  uint16 id_start = dep->id_start;
-  uint16 id_num = dep->id_num;
 
   LpiCache& lpi_cache = LpiCache::get_instance();
   bool cached = lpi_cache.is_cached(splid);
@@ -401,41 +714,52 @@ MileStoneHandle DictTrie::extend_dict0(MileStoneHandle from_handle,
   // 2. Begin exgtending
   // 2.1 Get the LmaPsbItem list
   LmaNodeLE0 *node = root_;
-  size_t son_start = splid_le0_index_[id_start - kFullSplIdStart];
-  size_t son_end = splid_le0_index_[id_start + id_num - kFullSplIdStart];
-  for (size_t son_pos = son_start; son_pos < son_end; son_pos++) {
-    assert(1 == node->son_1st_off);
-    LmaNodeLE0 *son = root_ + son_pos;
-    assert(son->spl_idx >= id_start && son->spl_idx < id_start + id_num);
-
-    if (!cached && *lpi_num < lpi_max) {
-      bool need_lpi = true;
-      if (spl_trie_->is_half_id_yunmu(splid) && son_pos != son_start)
-        need_lpi = false;
-
-      if (need_lpi)
-        *lpi_num += fill_lpi_buffer(lpi_items + (*lpi_num),
-                                    lpi_max - *lpi_num, son);
-    }
+  for (uint16 range_pos = 0; range_pos < dep->id_range_num; range_pos++) {
+    uint16 id_start = dep->id_ranges[range_pos].start;
+    uint16 id_num = dep->id_ranges[range_pos].num;
+    size_t son_start = splid_le0_index_[id_start - kFullSplIdStart];
+    size_t son_end = splid_le0_index_[id_start + id_num - kFullSplIdStart];
+    for (size_t son_pos = son_start; son_pos < son_end; son_pos++) {
+      assert(1 == node->son_1st_off);
+      LmaNodeLE0 *son = root_ + son_pos;
+      assert(son->spl_idx >= id_start && son->spl_idx < id_start + id_num);
+
+      if (!cached && *lpi_num < lpi_max) {
+        bool need_lpi = true;
+        if (spl_trie_->is_half_id_yunmu(splid) &&
+            (son_pos != son_start || range_pos > 0))
+          need_lpi = false;
+
+        if (need_lpi)
+          *lpi_num += fill_lpi_buffer(lpi_items + (*lpi_num),
+                                      lpi_max - *lpi_num, son);
+      }
 
-    // If necessary, fill in a new mile stone.
-    if (son->spl_idx == id_start) {
-      if (mile_stones_pos_ < kMaxMileStone &&
-          parsing_marks_pos_ < kMaxParsingMark) {
-        parsing_marks_[parsing_marks_pos_].node_offset = son_pos;
-        parsing_marks_[parsing_marks_pos_].node_num = id_num;
-        mile_stones_[mile_stones_pos_].mark_start = parsing_marks_pos_;
-        mile_stones_[mile_stones_pos_].mark_num = 1;
-        ret_handle = mile_stones_pos_;
-        parsing_marks_pos_++;
-        mile_stones_pos_++;
+      // If necessary, fill in a new mile stone. Each range gets a parsing
+      // mark of the mile stone.
+      if (son->spl_idx == id_start) {
+        if (mile_stones_pos_ < kMaxMileStone &&
+            parsing_marks_pos_ < kMaxParsingMark) {
+          parsing_marks_[parsing_marks_pos_].node_offset = son_pos;
+          parsing_marks_[parsing_marks_pos_].node_num = id_num;
+          if (0 == ret_handle) {
+            mile_stones_[mile_stones_pos_].mark_start = parsing_marks_pos_;
+            mile_stones_[mile_stones_pos_].mark_num = 0;
+            ret_handle = mile_stones_pos_;
+          }
+          mile_stones_[mile_stones_pos_].mark_num++;
+          parsing_marks_pos_++;
+        }
       }
-    }
 
-    if (son->spl_idx >= id_start + id_num -1)
-      break;
+      if (son->spl_idx >= id_start + id_num -1)
+        break;
+    }
   }
 
+  if (ret_handle > 0)
+    mile_stones_pos_++;
+
   //  printf("----- parsing marks: %d, mile stone: %d \n", parsing_marks_pos_,
   //      mile_stones_pos_);
   return ret_handle;
@@ -453,8 +777,9 @@ MileStoneHandle DictTrie::extend_dict1(MileStoneHandle from_handle,
   // number of full Id.
   size_t ret_val = 0;
 
-  uint16 id_start = dep->id_start;
-  uint16 id_num = dep->id_num;
+  const SplIdRange *ranges = dep->id_ranges;
+  uint16 range_num = dep->id_range_num;
+  uint16 id_last = ranges[range_num - 1].start + ranges[range_num - 1].num - 1;
 
   // 2. Begin extending.
   MileStone *mile_stone = mile_stones_ + from_handle;
@@ -469,8 +794,9 @@ MileStoneHandle DictTrie::extend_dict1(MileStoneHandle from_handle,
       for (size_t son_pos = 0; son_pos < (size_t)node->num_of_son; son_pos++) {
         assert(node->son_1st_off <= lma_node_num_ge1_);
         LmaNodeGE1 *son = nodes_ge1_ + node->son_1st_off + son_pos;
-        if (son->spl_idx >= id_start
-            && son->spl_idx < id_start + id_num) {
+        bool found = SpellingTrie::in_id_ranges(son->spl_idx, ranges,
+                                                range_num);
+        if (found) {
           if (*lpi_num < lpi_max) {
             size_t homo_buf_off = get_homo_idx_buf_offset(son);
             *lpi_num += fill_lpi_buffer(lpi_items + (*lpi_num),
@@ -484,27 +810,30 @@ MileStoneHandle DictTrie::extend_dict1(MileStoneHandle from_handle,
           }
           found_num++;
         }
-        if (son->spl_idx >= id_start + id_num - 1 || son_pos ==
-            (size_t)node->num_of_son - 1) {
-          if (found_num > 0) {
-            if (mile_stones_pos_ < kMaxMileStone &&
-                parsing_marks_pos_ < kMaxParsingMark) {
-              parsing_marks_[parsing_marks_pos_].node_offset =
-                node->son_1st_off + found_start;
-              parsing_marks_[parsing_marks_pos_].node_num = found_num;
-              if (0 == ret_val)
-                mile_stones_[mile_stones_pos_].mark_start =
-                  parsing_marks_pos_;
-              parsing_marks_pos_++;
-            }
-
-            ret_val++;
+        bool last = son->spl_idx >= id_last ||
+            son_pos == (size_t)node->num_of_son - 1;
+        // With fuzzy Pinyin, the found sons may not be next to each other,
+        // and each run of them gets a parsing mark.
+        if (found_num > 0 && (!found || last)) {
+          if (mile_stones_pos_ < kMaxMileStone &&
+              parsing_marks_pos_ < kMaxParsingMark) {
+            parsing_marks_[parsing_marks_pos_].node_offset =
+              node->son_1st_off + found_start;
+            parsing_marks_[parsing_marks_pos_].node_num = found_num;
+            if (0 == ret_val)
+              mile_stones_[mile_stones_pos_].mark_start =
+                parsing_marks_pos_;
+            parsing_marks_pos_++;
           }
+
+          ret_val++;
+          found_num = 0;
+        }
+        if (last)
           break;
-        }  // for son_pos
-      }  // for ext_pos
-    }  // for h_pos
-  }
+      }  // for son_pos
+    }  // for ext_pos
+  }  // for h_pos
 
   if (ret_val > 0) {
     mile_stones_[mile_stones_pos_].mark_num = ret_val;
@@ -530,8 +859,9 @@ MileStoneHandle DictTrie::extend_dict2(MileStoneHandle from_handle,
   // number of full Id.
   size_t ret_val = 0;
 
-  uint16 id_start = dep->id_start;
-  uint16 id_num = dep->id_num;
+  const SplIdRange *ranges = dep->id_ranges;
+  uint16 range_num = dep->id_range_num;
+  uint16 id_last = ranges[range_num - 1].start + ranges[range_num - 1].num - 1;
 
   // 2. Begin extending.
   MileStone *mile_stone = mile_stones_ + from_handle;
@@ -545,10 +875,11 @@ MileStoneHandle DictTrie::extend_dict2(MileStoneHandle from_handle,
       size_t found_num = 0;
 
       for (size_t son_pos = 0; son_pos < (size_t)node->num_of_son; son_pos++) {
-        assert(node->son_1st_off_l > 0 || node->son_1st_off_h > 0);
+        assert(node->son_1st_off > 0);
         LmaNodeGE1 *son = nodes_ge1_ + get_son_offset(node) + son_pos;
-        if (son->spl_idx >= id_start
-            && son->spl_idx < id_start + id_num) {
+        bool found = SpellingTrie::in_id_ranges(son->spl_idx, ranges,
+                                                range_num);
+        if (found) {
           if (*lpi_num < lpi_max) {
             size_t homo_buf_off = get_homo_idx_buf_offset(son);
             *lpi_num += fill_lpi_buffer(lpi_items + (*lpi_num),
@@ -562,24 +893,25 @@ MileStoneHandle DictTrie::extend_dict2(MileStoneHandle from_handle,
           }
           found_num++;
         }
-        if (son->spl_idx >= id_start + id_num - 1 || son_pos ==
-            (size_t)node->num_of_son - 1) {
-          if (found_num > 0) {
-            if (mile_stones_pos_ < kMaxMileStone &&
-                parsing_marks_pos_ < kMaxParsingMark) {
-              parsing_marks_[parsing_marks_pos_].node_offset =
-                get_son_offset(node) + found_start;
-              parsing_marks_[parsing_marks_pos_].node_num = found_num;
-              if (0 == ret_val)
-                mile_stones_[mile_stones_pos_].mark_start =
-                  parsing_marks_pos_;
-              parsing_marks_pos_++;
-            }
-
-            ret_val++;
+        bool last = son->spl_idx >= id_last ||
+            son_pos == (size_t)node->num_of_son - 1;
+        if (found_num > 0 && (!found || last)) {
+          if (mile_stones_pos_ < kMaxMileStone &&
+              parsing_marks_pos_ < kMaxParsingMark) {
+            parsing_marks_[parsing_marks_pos_].node_offset =
+              get_son_offset(node) + found_start;
+            parsing_marks_[parsing_marks_pos_].node_num = found_num;
+            if (0 == ret_val)
+              mile_stones_[mile_stones_pos_].mark_start =
+                parsing_marks_pos_;
+            parsing_marks_pos_++;
           }
-          break;
+
+          ret_val++;
+          found_num = 0;
         }
+        if (last)
+          break;
       }  // for son_pos
     }  // for ext_pos
   }  // for h_pos
@@ -625,7 +957,7 @@ bool DictTrie::try_extend(const uint16 *splids, uint16 splid_num,
       uint16 son_pos;
       for (son_pos = 0; son_pos < static_cast<uint16>(node_ge1->num_of_son);
            son_pos++) {
-        assert(node_ge1->son_1st_off_l > 0 || node_ge1->son_1st_off_h > 0);
+        assert(node_ge1->son_1st_off > 0);
         node_son = nodes_ge1_ + get_son_offset(node_ge1) + son_pos;
         if (node_son->spl_idx == splids[pos])
           break;
@@ -684,35 +1016,38 @@ size_t DictTrie::get_lpis(const uint16* splid_str, uint16 splid_str_len,
   size_t spl_pos = 0;
 
   while (spl_pos < splid_str_len) {
-    uint16 id_num = 1;
-    uint16 id_start = splid_str[spl_pos];
-    // If it is a half id
-    if (spl_trie_->is_half_id(splid_str[spl_pos])) {
-      id_num = spl_trie_->half_to_full(splid_str[spl_pos], &id_start);
-      assert(id_num > 0);
-    }
+    // The full ids the spelling id stands for.
+    const SplIdRange *ranges;
+    uint16 range_num = spl_trie_->get_id_ranges(splid_str[spl_pos], &ranges);
+    assert(range_num > 0);
+    uint16 id_last = ranges[range_num - 1].start +
+        ranges[range_num - 1].num - 1;
 
     // Extend the nodes
     if (0 == spl_pos) {  // From LmaNodeLE0 (root) to LmaNodeLE0 nodes
       for (size_t node_fr_pos = 0; node_fr_pos < node_fr_num; node_fr_pos++) {
         LmaNodeLE0 *node = node_fr_le0[node_fr_pos];
         assert(node == root_ && 1 == node_fr_num);
-        size_t son_start = splid_le0_index_[id_start - kFullSplIdStart];
-        size_t son_end =
-            splid_le0_index_[id_start + id_num - kFullSplIdStart];
-        for (size_t son_pos = son_start; son_pos < son_end; son_pos++) {
-          assert(1 == node->son_1st_off);
-          LmaNodeLE0 *node_son = root_ + son_pos;
-          assert(node_son->spl_idx >= id_start
-                 && node_son->spl_idx < id_start + id_num);
-          if (node_to_num < MAX_EXTENDBUF_LEN) {
-            node_to_le0[node_to_num] = node_son;
-            node_to_num++;
+        for (uint16 range_pos = 0; range_pos < range_num; range_pos++) {
+          uint16 id_start = ranges[range_pos].start;
+          uint16 id_num = ranges[range_pos].num;
+          size_t son_start = splid_le0_index_[id_start - kFullSplIdStart];
+          size_t son_end =
+              splid_le0_index_[id_start + id_num - kFullSplIdStart];
+          for (size_t son_pos = son_start; son_pos < son_end; son_pos++) {
+            assert(1 == node->son_1st_off);
+            LmaNodeLE0 *node_son = root_ + son_pos;
+            assert(node_son->spl_idx >= id_start
+                   && node_son->spl_idx < id_start + id_num);
+            if (node_to_num < MAX_EXTENDBUF_LEN) {
+              node_to_le0[node_to_num] = node_son;
+              node_to_num++;
+            }
+            // id_start + id_num - 1 is the last one, which has just been
+            // recorded.
+            if (node_son->spl_idx >= id_start + id_num - 1)
+              break;
           }
-          // id_start + id_num - 1 is the last one, which has just been
-          // recorded.
-          if (node_son->spl_idx >= id_start + id_num - 1)
-            break;
         }
       }
 
@@ -733,16 +1068,15 @@ size_t DictTrie::get_lpis(const uint16* splid_str, uint16 splid_str_len,
           assert(node->son_1st_off <= lma_node_num_ge1_);
           LmaNodeGE1 *node_son = nodes_ge1_ + node->son_1st_off
                                   + son_pos;
-          if (node_son->spl_idx >= id_start
-              && node_son->spl_idx < id_start + id_num) {
+          if (SpellingTrie::in_id_ranges(node_son->spl_idx, ranges,
+                                         range_num)) {
             if (node_to_num < MAX_EXTENDBUF_LEN) {
               node_to_ge1[node_to_num] = node_son;
               node_to_num++;
             }
           }
-          // id_start + id_num - 1 is the last one, which has just been
-          // recorded.
-          if (node_son->spl_idx >= id_start + id_num - 1)
+          // id_last is the last one, which has just been recorded.
+          if (node_son->spl_idx >= id_last)
             break;
         }
       }
@@ -761,19 +1095,18 @@ size_t DictTrie::get_lpis(const uint16* splid_str, uint16 splid_str_len,
         LmaNodeGE1 *node = node_fr_ge1[node_fr_pos];
         for (size_t son_pos = 0; son_pos < (size_t)node->num_of_son;
              son_pos++) {
-          assert(node->son_1st_off_l > 0 || node->son_1st_off_h > 0);
+          assert(node->son_1st_off > 0);
           LmaNodeGE1 *node_son = nodes_ge1_
                                   + get_son_offset(node) + son_pos;
-          if (node_son->spl_idx >= id_start
-              && node_son->spl_idx < id_start + id_num) {
+          if (SpellingTrie::in_id_ranges(node_son->spl_idx, ranges,
+                                         range_num)) {
             if (node_to_num < MAX_EXTENDBUF_LEN) {
               node_to_ge1[node_to_num] = node_son;
               node_to_num++;
             }
           }
-          // id_start + id_num - 1 is the last one, which has just been
-          // recorded.
-          if (node_son->spl_idx >= id_start + id_num - 1)
+          // id_last is the last one, which has just been recorded.
+          if (node_son->spl_idx >= id_last)
             break;
         }
       }
@@ -856,6 +1189,37 @@ uint16 DictTrie::get_lemma_splids(LemmaIdType id_lemma, uint16 *splids,
   uint16 lma_len = get_lemma_str(id_lemma, lma_str, kMaxLemmaSize + 1);
   assert((!arg_valid && splids_max >= lma_len) || lma_len == splids_max);
 
+  // The spelling ids recorded when the dictionary was loaded. If some of the
+  // given ids do not agree with them, search the trie as below.
+  size_t lma_pos;
+  if (NULL != lma_splids_ &&
+      dict_list_->get_lemma_pos(id_lemma, &lma_pos) == lma_len &&
+      0 != lma_splids_[lma_pos]) {
+    const uint16 *lma_splids = lma_splids_ + lma_pos;
+    bool agreed = true;
+    for (uint16 pos = 0; arg_valid && agreed && pos < lma_len; pos++) {
+      if (spl_trie_->is_full_id(splids[pos])) {
+        agreed = spl_trie_->id_covers(splids[pos], lma_splids[pos]);
+      } else {
+        uint16 cand_splids[kMaxLemmaSize * 5];
+        uint16 cand_num = dict_list_->get_splids_for_hanzi(lma_str[pos],
+            splids[pos], cand_splids, kMaxLemmaSize * 5);
+        agreed = false;
+        for (uint16 cand = 0; cand < cand_num; cand++) {
+          if (cand_splids[cand] == lma_splids[pos]) {
+            agreed = true;
+            break;
+          }
+        }
+      }
+    }
+    if (agreed) {
+      for (uint16 pos = 0; pos < lma_len; pos++)
+        splids[pos] = lma_splids[pos];
+      return lma_len;
+    }
+  }
+
   uint16 spl_mtrx[kMaxLemmaSize * 5];
   uint16 spl_start[kMaxLemmaSize + 1];
   spl_start[0] = 0;
@@ -863,7 +1227,18 @@ uint16 DictTrie::get_lemma_splids(LemmaIdType id_lemma, uint16 *splids,
 
   for (uint16 pos = 0; pos < lma_len; pos++) {
     uint16 cand_splids_this = 0;
-    if (arg_valid && spl_trie_->is_full_id(splids[pos])) {
+    if (arg_valid && spl_trie_->is_fuzzy_id(splids[pos])) {
+      // Keep the readings of the hanzi which the fuzzy id stands for.
+      uint16 *cands = spl_mtrx + spl_start[pos];
+      uint16 cand_num = dict_list_->get_splids_for_hanzi(lma_str[pos], 0,
+          cands, kMaxLemmaSize * 5 - spl_start[pos]);
+      for (uint16 cand = 0; cand < cand_num; cand++) {
+        if (spl_trie_->id_covers(splids[pos], cands[cand]))
+          cands[cand_splids_this++] = cands[cand];
+      }
+      if (0 == cand_splids_this)
+        return 0;
+    } else if (arg_valid && spl_trie_->is_full_id(splids[pos])) {
       spl_mtrx[spl_start[pos]] = splids[pos];
       cand_splids_this = 1;
     } else {
@@ -893,7 +1268,11 @@ uint16 DictTrie::get_lemma_splids(LemmaIdType id_lemma, uint16 *splids,
 
 void DictTrie::set_total_lemma_count_of_others(size_t count) {
   NGram& ngram = NGram::get_instance();
+  if (count == ngram.get_total_freq_none_sys())
+    return;
   ngram.set_total_freq_none_sys(count);
+  // The scores of all system lemmas change, so do the cached lists.
+  LpiCache::invalidate_all();
 }
 
 void DictTrie::convert_to_hanzis(char16 *str, uint16 str_len) {
@@ -916,24 +1295,48 @@ size_t DictTrie::predict_top_lmas(size_t his_len, NPredictItem *npre_items,
   NGram &ngram = NGram::get_instance();
 
   size_t item_num = 0;
-  size_t top_lmas_id_offset = lma_idx_buf_len_ / kLemmaIdSize - top_lmas_num_;
-  size_t top_lmas_pos = 0;
-  while (item_num < npre_max && top_lmas_pos < top_lmas_num_) {
+  while (item_num < npre_max && item_num < top_lmas_valid_num_) {
+    const TopLemma *top_lma = top_lmas_ + item_num;
     memset(npre_items + item_num, 0, sizeof(NPredictItem));
-    LemmaIdType top_lma_id = get_lemma_id(top_lmas_id_offset + top_lmas_pos);
-    top_lmas_pos += 1;
-    if (dict_list_->get_lemma_str(top_lma_id,
-                                  npre_items[item_num].pre_hzs,
-                                  kMaxLemmaSize - 1) == 0) {
-      continue;
-    }
-    npre_items[item_num].psb = ngram.get_uni_psb(top_lma_id);
+    utf16_strncpy(npre_items[item_num].pre_hzs, top_lma->str,
+                  kMaxPredictSize);
+    npre_items[item_num].psb = ngram.get_uni_psb(top_lma->id);
     npre_items[item_num].his_len = his_len;
     item_num++;
   }
   return item_num;
 }
 
+size_t DictTrie::get_mem_size() {
+  size_t size = sizeof(DictTrie);
+  if (NULL == root_)
+    return size;
+
+  size += lma_node_num_le0_ * sizeof(LmaNodeLE0) +
+          lma_node_num_ge1_ * sizeof(LmaNodeGE1) +
+          lma_idx_buf_len_ * sizeof(uint32) +
+          (SpellingTrie::get_instance().get_spelling_num() + 1) *
+          sizeof(uint16) +
+          kMaxParsingMark * sizeof(ParsingMark) +
+          kMaxMileStone * sizeof(MileStone) +
+          lma_splids_len_ * sizeof(uint16);
+  if (NULL != top_lmas_)
+    size += top_lmas_num_ * sizeof(TopLemma);
+  if (NULL != dict_list_)
+    size += dict_list_->get_mem_size();
+  return size;
+}
+
+void DictTrie::free_extra_index() {
+  if (NULL != lma_splids_)
+    free(lma_splids_);
+  lma_splids_ = NULL;
+  lma_splids_len_ = 0;
+
+  if (NULL != dict_list_)
+    dict_list_->free_predict_index();
+}
+
 size_t DictTrie::predict(const char16 *last_hzs, uint16 hzs_len,
                          NPredictItem *npre_items, size_t npre_max,
                          size_t b4_used) {
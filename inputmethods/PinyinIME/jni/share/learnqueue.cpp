@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2009 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include "../include/learnqueue.h"
+
+namespace ime_pinyin {
+
+LearnQueue::LearnQueue() {
+  assert((kQueueSize & (kQueueSize - 1)) == 0);
+  clear();
+}
+
+void LearnQueue::clear() {
+  head_ = 0;
+  tail_ = 0;
+}
+
+bool LearnQueue::push(const LearnEvent *event) {
+  uint32 tail = tail_;
+  if (tail - head_ >= kQueueSize)
+    return false;
+
+  events_[tail & (kQueueSize - 1)] = *event;
+  // The item must be complete before the consumer can see the new tail.
+  __sync_synchronize();
+  tail_ = tail + 1;
+  return true;
+}
+
+bool LearnQueue::pop(LearnEvent *event) {
+  uint32 head = head_;
+  if (head == tail_)
+    return false;
+
+  // Do not read the item before the tail which covers it.
+  __sync_synchronize();
+  *event = events_[head & (kQueueSize - 1)];
+  // The item must be copied before the producer can overwrite it.
+  __sync_synchronize();
+  head_ = head + 1;
+  return true;
+}
+
+}  // namespace ime_pinyin
@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "../include/lpicache.h"
 
 namespace ime_pinyin {
@@ -22,20 +23,31 @@ namespace ime_pinyin {
 LpiCache* LpiCache::instance_ = NULL;
 
 LpiCache::LpiCache() {
-  lpi_cache_ = new LmaPsbItem[kFullSplIdStart * kMaxLpiCachePerId];
-  lpi_cache_len_ = new uint16[kFullSplIdStart];
-  assert(NULL != lpi_cache_);
-  assert(NULL != lpi_cache_len_);
-  for (uint16 id = 0; id < kFullSplIdStart; id++)
-    lpi_cache_len_[id] = 0;
+  lpi_buf_ = NULL;
+  lpi_buf_size_ = 0;
+  lpi_buf_used_ = 0;
+  entries_ = new LpiCacheEntry[kFullSplIdStart + kMaxSpellingNum];
+  pair_keys_ = new uint32[kPairSlotNum];
+  pair_entries_ = new LpiCacheEntry[kPairSlotNum];
+  assert(NULL != entries_);
+  assert(NULL != pair_keys_);
+  assert(NULL != pair_entries_);
+  user_version_ = 1;
+  configure(kMaxLpiCachePerId, kMaxLpiCacheFullLen, kDefaultBudget);
 }
 
 LpiCache::~LpiCache() {
-  if (NULL != lpi_cache_)
-    delete [] lpi_cache_;
+  if (NULL != lpi_buf_)
+    delete [] lpi_buf_;
 
-  if (NULL != lpi_cache_len_)
-    delete [] lpi_cache_len_;
+  if (NULL != entries_)
+    delete [] entries_;
+
+  if (NULL != pair_keys_)
+    delete [] pair_keys_;
+
+  if (NULL != pair_entries_)
+    delete [] pair_entries_;
 }
 
 LpiCache& LpiCache::get_instance() {
@@ -46,36 +58,200 @@ LpiCache& LpiCache::get_instance() {
   return *instance_;
 }
 
+bool LpiCache::configure(uint16 half_depth, uint16 full_depth,
+                         size_t budget) {
+  size_t buf_size = budget / sizeof(LmaPsbItem);
+  if (buf_size < half_depth)
+    return false;
+
+  if (NULL != lpi_buf_)
+    delete [] lpi_buf_;
+  lpi_buf_ = new LmaPsbItem[buf_size];
+  if (NULL == lpi_buf_) {
+    lpi_buf_size_ = 0;
+    return false;
+  }
+  lpi_buf_size_ = buf_size;
+  half_depth_ = half_depth;
+  full_depth_ = full_depth;
+  clear();
+  return true;
+}
+
+bool LpiCache::set_budget(size_t budget) {
+  if (0 == budget)
+    budget = kDefaultBudget;
+  if (budget / sizeof(LmaPsbItem) == lpi_buf_size_)
+    return true;
+  return configure(half_depth_, full_depth_, budget);
+}
+
+size_t LpiCache::get_mem_size() const {
+  return sizeof(LpiCache) + lpi_buf_size_ * sizeof(LmaPsbItem) +
+      (kFullSplIdStart + kMaxSpellingNum + kPairSlotNum) *
+      sizeof(LpiCacheEntry) + kPairSlotNum * sizeof(uint32);
+}
+
+void LpiCache::clear() {
+  lpi_buf_used_ = 0;
+  memset(entries_, 0,
+         sizeof(LpiCacheEntry) * (kFullSplIdStart + kMaxSpellingNum));
+  memset(pair_keys_, 0, sizeof(uint32) * kPairSlotNum);
+  memset(pair_entries_, 0, sizeof(LpiCacheEntry) * kPairSlotNum);
+}
+
+bool LpiCache::is_valid(const LpiCacheEntry *entry) const {
+  if (NULL == entry || 0 == entry->len)
+    return false;
+  return 0 == entry->user_version || user_version_ == entry->user_version;
+}
+
+LpiCache::LpiCacheEntry* LpiCache::find_pair(uint16 splid0, uint16 splid1,
+                                             bool add) {
+  uint32 key = ((uint32)splid0 << 16) | splid1;
+  uint32 slot = (key * 2654435761U) & (kPairSlotNum - 1);
+  for (uint16 probe = 0; probe < kPairSlotNum; probe++) {
+    if (key == pair_keys_[slot])
+      return pair_entries_ + slot;
+    if (0 == pair_keys_[slot]) {
+      if (!add)
+        return NULL;
+      pair_keys_[slot] = key;
+      return pair_entries_ + slot;
+    }
+    slot = (slot + 1) & (kPairSlotNum - 1);
+  }
+  return NULL;
+}
+
+bool LpiCache::store(LpiCacheEntry *entry, LmaPsbItem lpi_items[],
+                     size_t lpi_num) {
+  if (lpi_num > entry->capacity) {
+    if (lpi_buf_used_ + lpi_num > lpi_buf_size_)
+      return false;
+    entry->pos = lpi_buf_used_;
+    entry->capacity = static_cast<uint16>(lpi_num);
+    lpi_buf_used_ += lpi_num;
+  }
+
+  LmaPsbItem *lpi_cache_this = lpi_buf_ + entry->pos;
+  entry->user_version = 0;
+  for (size_t pos = 0; pos < lpi_num; pos++) {
+    lpi_cache_this[pos] = lpi_items[pos];
+    if (lpi_items[pos].id >= kUserDictIdStart)
+      entry->user_version = user_version_;
+  }
+  entry->len = static_cast<uint16>(lpi_num);
+  return true;
+}
+
+size_t LpiCache::load(const LpiCacheEntry *entry, LmaPsbItem lpi_items[],
+                      size_t lpi_max) {
+  if (lpi_max > entry->len)
+    lpi_max = entry->len;
+
+  LmaPsbItem *lpi_cache_this = lpi_buf_ + entry->pos;
+  for (size_t pos = 0; pos < lpi_max; pos++) {
+    lpi_items[pos] = lpi_cache_this[pos];
+  }
+  return lpi_max;
+}
+
 bool LpiCache::is_cached(uint16 splid) {
-  if (splid >= kFullSplIdStart)
+  if (splid >= kFullSplIdStart + kMaxSpellingNum)
     return false;
-  return lpi_cache_len_[splid] != 0;
+  return is_valid(entries_ + splid);
+}
+
+bool LpiCache::is_cached(uint16 splid0, uint16 splid1) {
+  return is_valid(find_pair(splid0, splid1, false));
 }
 
 size_t LpiCache::put_cache(uint16 splid, LmaPsbItem lpi_items[],
                            size_t lpi_num) {
-  uint16 num = kMaxLpiCachePerId;
-  if (num > lpi_num)
-    num = static_cast<uint16>(lpi_num);
+  if (splid < kFullSplIdStart) {
+    if (lpi_num > half_depth_)
+      lpi_num = half_depth_;
+  } else if (lpi_num > full_depth_ ||
+             splid >= kFullSplIdStart + kMaxSpellingNum) {
+    return lpi_num;
+  }
 
-  LmaPsbItem *lpi_cache_this = lpi_cache_ + splid * kMaxLpiCachePerId;
-  for (uint16 pos = 0; pos < num; pos++)
-    lpi_cache_this[pos] = lpi_items[pos];
+  if (!store(entries_ + splid, lpi_items, lpi_num)) {
+    clear();
+    store(entries_ + splid, lpi_items, lpi_num);
+  }
+  return lpi_num;
+}
+
+size_t LpiCache::put_cache(uint16 splid0, uint16 splid1,
+                           LmaPsbItem lpi_items[], size_t lpi_num) {
+  if (lpi_num > full_depth_)
+    return lpi_num;
 
-  lpi_cache_len_[splid] = num;
-  return num;
+  LpiCacheEntry *entry = find_pair(splid0, splid1, true);
+  if (NULL == entry || !store(entry, lpi_items, lpi_num)) {
+    clear();
+    entry = find_pair(splid0, splid1, true);
+    store(entry, lpi_items, lpi_num);
+  }
+  return lpi_num;
 }
 
 size_t LpiCache::get_cache(uint16 splid, LmaPsbItem lpi_items[],
                            size_t lpi_max) {
-  if (lpi_max > lpi_cache_len_[splid])
-    lpi_max = lpi_cache_len_[splid];
+  return load(entries_ + splid, lpi_items, lpi_max);
+}
 
-  LmaPsbItem *lpi_cache_this = lpi_cache_ + splid * kMaxLpiCachePerId;
-  for (uint16 pos = 0; pos < lpi_max; pos++) {
-    lpi_items[pos] = lpi_cache_this[pos];
+size_t LpiCache::get_cache(uint16 splid0, uint16 splid1,
+                           LmaPsbItem lpi_items[], size_t lpi_max) {
+  LpiCacheEntry *entry = find_pair(splid0, splid1, false);
+  if (NULL == entry)
+    return 0;
+  return load(entry, lpi_items, lpi_max);
+}
+
+bool LpiCache::key_covers(uint16 key, uint16 full_id) {
+  if (key == full_id)
+    return true;
+  return SpellingTrie::get_cpinstance()->id_covers(key, full_id);
+}
+
+void LpiCache::invalidate_user() {
+  if (NULL == instance_)
+    return;
+  instance_->user_version_++;
+  if (0 == instance_->user_version_)
+    instance_->user_version_ = 1;
+}
+
+void LpiCache::invalidate_lemma(const uint16 *splids, uint16 lemma_len) {
+  if (NULL == instance_)
+    return;
+  invalidate_user();
+
+  // Only the lists of the first two steps are cached, and they only contain
+  // lemmas with one or two characters respectively.
+  if (1 == lemma_len) {
+    // With fuzzy Pinyin, the lists of other full ids may contain it too.
+    for (uint16 id = 1; id < kFullSplIdStart + kMaxSpellingNum; id++) {
+      if (key_covers(id, splids[0]))
+        instance_->entries_[id].len = 0;
+    }
+  } else if (2 == lemma_len) {
+    for (uint16 slot = 0; slot < kPairSlotNum; slot++) {
+      uint32 key = instance_->pair_keys_[slot];
+      if (0 != key && key_covers(key >> 16, splids[0]) &&
+          key_covers(key & 0xffff, splids[1]))
+        instance_->pair_entries_[slot].len = 0;
+    }
   }
-  return lpi_max;
+}
+
+void LpiCache::invalidate_all() {
+  if (NULL == instance_)
+    return;
+  instance_->clear();
 }
 
 }  // namespace ime_pinyin
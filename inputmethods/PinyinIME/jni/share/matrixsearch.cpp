@@ -18,6 +18,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 #include "../include/lpicache.h"
 #include "../include/matrixsearch.h"
 #include "../include/mystdlib.h"
@@ -34,27 +36,47 @@ MatrixSearch::MatrixSearch() {
 
   reset_pointers_to_null();
 
+  learn_thread_started_ = false;
+  learn_stop_ = false;
+  learn_flush_ = false;
+  learn_reload_ = false;
+  learn_defrag_ = false;
+  learn_dict_size_ = 0;
+  sem_init(&learn_sem_, 0, 0);
+
   pys_decoded_len_ = 0;
   mtrx_nd_pool_used_ = 0;
   dmi_pool_used_ = 0;
   xi_an_enabled_ = false;
+  beam_width_ = kMaxNodeARow;
+  beam_score_gap_ = PRUMING_SCORE;
   dmi_c_phrase_ = false;
+  lpi_num_full_match_ = 0;
+  lpi_sorted_ = 0;
 
   assert(kMaxSearchSteps > 0);
   max_sps_len_ = kMaxSearchSteps - 1;
   max_hzs_len_ = kMaxSearchSteps;
+  mem_cap_ = 0;
+  mem_reduced_ = false;
+  mem_reduced_usr_ = false;
 }
 
 MatrixSearch::~MatrixSearch() {
   free_resource();
+  sem_destroy(&learn_sem_);
 }
 
 void MatrixSearch::reset_pointers_to_null() {
   dict_trie_ = NULL;
   user_dict_ = NULL;
+  learn_dict_ = NULL;
+  ready_dict_ = NULL;
+  bigram_ = NULL;
   spl_parser_ = NULL;
 
   share_buf_ = NULL;
+  share_buf_len_ = 0;
 
   // The following four buffers are used for decoding, and they are based on
   // share_buf_, no need to delete them.
@@ -71,7 +93,8 @@ bool MatrixSearch::alloc_resource() {
   free_resource();
 
   dict_trie_ = new DictTrie();
-  user_dict_ = static_cast<AtomDictBase*>(new UserDict());
+  learn_dict_ = new UserDict();
+  user_dict_ = static_cast<AtomDictBase*>(learn_dict_);
   spl_parser_ = new SpellingParser();
 
   size_t mtrx_nd_size = sizeof(MatrixNode) * kMtrxNdPoolSize;
@@ -84,7 +107,8 @@ bool MatrixSearch::alloc_resource() {
   dep_size = align_to_size_t(dep_size) / sizeof(size_t);
 
   // share_buf's size is determined by the buffers for search.
-  share_buf_ = new size_t[mtrx_nd_size + dmi_size + matrix_size + dep_size];
+  share_buf_len_ = mtrx_nd_size + dmi_size + matrix_size + dep_size;
+  share_buf_ = new size_t[share_buf_len_];
 
   if (NULL == dict_trie_ || NULL == user_dict_ || NULL == spl_parser_ ||
       NULL == share_buf_)
@@ -99,18 +123,36 @@ bool MatrixSearch::alloc_resource() {
 
   // The prediction buffer is also based on the share buffer.
   npre_items_ = reinterpret_cast<NPredictItem*>(share_buf_);
-  npre_items_len_ = (mtrx_nd_size + dmi_size + matrix_size + dep_size) *
-      sizeof(size_t) / sizeof(NPredictItem);
+  npre_items_len_ = share_buf_len_ * sizeof(size_t) / sizeof(NPredictItem);
+
+  // What a cap of the previous decoder has shrunk is given back.
+  LpiCache::get_instance().set_budget(0);
+  mem_reduced_ = false;
+  mem_reduced_usr_ = false;
   return true;
 }
 
 void MatrixSearch::free_resource() {
+  // What is still queued is learned before the dictionaries are gone.
+  stop_learning();
+  apply_pending_learning();
+  learn_queue_.clear();
+
   if (NULL != dict_trie_)
     delete dict_trie_;
 
-  if (NULL != user_dict_)
+  if (NULL != user_dict_ && user_dict_ != learn_dict_)
     delete user_dict_;
 
+  if (NULL != learn_dict_)
+    delete learn_dict_;
+
+  if (NULL != ready_dict_)
+    delete ready_dict_;
+
+  if (NULL != bigram_)
+    delete bigram_;
+
   if (NULL != spl_parser_)
     delete spl_parser_;
 
@@ -135,10 +177,18 @@ bool MatrixSearch::init(const char *fn_sys_dict, const char *fn_usr_dict) {
   if (!user_dict_->load_dict(fn_usr_dict, kUserDictIdStart, kUserDictIdEnd)) {
     delete user_dict_;
     user_dict_ = NULL;
+    learn_dict_ = NULL;
   } else{
     user_dict_->set_total_lemma_count_of_others(NGram::kSysDictTotalFreq);
   }
 
+  // The copy made for the learning thread is counted by the memory cap.
+  if (NULL != user_dict_)
+    start_learning();
+
+  apply_mem_cap();
+  // The cached lists are filled as the spelling ids are searched.
+  LpiCache::invalidate_all();
   reset_search0();
 
   inited_ = true;
@@ -159,16 +209,125 @@ bool MatrixSearch::init_fd(int sys_fd, long start_offset, long length,
   if (!user_dict_->load_dict(fn_usr_dict, kUserDictIdStart, kUserDictIdEnd)) {
     delete user_dict_;
     user_dict_ = NULL;
+    learn_dict_ = NULL;
   } else {
     user_dict_->set_total_lemma_count_of_others(NGram::kSysDictTotalFreq);
   }
 
+  // The copy made for the learning thread is counted by the memory cap.
+  if (NULL != user_dict_)
+    start_learning();
+
+  apply_mem_cap();
+  // The cached lists are filled as the spelling ids are searched.
+  LpiCache::invalidate_all();
   reset_search0();
 
   inited_ = true;
   return true;
 }
 
+bool MatrixSearch::load_bigram(const char *fn_bigram, size_t max_mb) {
+  if (!inited_ || NULL == fn_bigram)
+    return false;
+
+  if (NULL != bigram_)
+    delete bigram_;
+
+  bigram_ = new Bigram();
+  if (!bigram_->load_bigram(fn_bigram, max_mb)) {
+    delete bigram_;
+    bigram_ = NULL;
+    return false;
+  }
+
+  reset_search0();
+
+  // The model is unloaded if it does not fit in the memory cap.
+  apply_mem_cap();
+  return NULL != bigram_;
+}
+
+bool MatrixSearch::set_mem_cap(size_t mem_cap) {
+  mem_cap_ = mem_cap;
+  if (!inited_)
+    return true;
+
+  return apply_mem_cap();
+}
+
+void MatrixSearch::get_mem_stats(MemStats *stats) {
+  if (NULL == stats)
+    return;
+
+  fill_mem_stats(stats);
+}
+
+void MatrixSearch::fill_mem_stats(MemStats *stats) {
+  memset(stats, 0, sizeof(MemStats));
+  stats->spl_trie = SpellingTrie::get_instance().get_mem_size();
+  if (NULL != dict_trie_)
+    stats->sys_dict = dict_trie_->get_mem_size();
+  stats->ngram = NGram::get_instance().get_mem_size();
+  if (NULL != bigram_)
+    stats->bigram = bigram_->get_size();
+  if (NULL != user_dict_)
+    stats->user_dict = user_dict_->get_mem_size();
+  // The copy the decoder reads and learn_dict_ are both counted.
+  if (learn_thread_started_)
+    stats->user_dict += learn_dict_size_;
+  stats->lpi_cache = LpiCache::get_instance().get_mem_size();
+  stats->search = sizeof(MatrixSearch) + share_buf_len_ * sizeof(size_t);
+  if (NULL != spl_parser_)
+    stats->search += sizeof(SpellingParser);
+
+  stats->total = stats->spl_trie + stats->sys_dict + stats->ngram +
+      stats->bigram + stats->user_dict + stats->lpi_cache + stats->search;
+  stats->cap = mem_cap_;
+  stats->reduced = mem_reduced_;
+}
+
+bool MatrixSearch::apply_mem_cap() {
+  MemStats stats;
+  fill_mem_stats(&stats);
+  if (0 == mem_cap_ || stats.total <= mem_cap_)
+    return true;
+
+  // What only makes the decoder faster goes first. The bigram model goes
+  // last, because the sentences may be worse without it.
+  mem_reduced_ = true;
+  LpiCache::get_instance().set_budget(kLowMemLpiCacheBudget);
+  dict_trie_->free_extra_index();
+  fill_mem_stats(&stats);
+  if (stats.total <= mem_cap_)
+    return true;
+
+  // Then the copies of the user dictionary made for the learning thread,
+  // and most of the room kept for new lemmas. Without the thread, the
+  // learning is done in choose().
+  if (NULL != learn_dict_ && !mem_reduced_usr_) {
+    mem_reduced_usr_ = true;
+    stop_learning();
+    apply_pending_learning();
+    learn_dict_->set_prealloc(kLowMemUserDictPreAlloc);
+    // Reload with the smaller room. The lemma ids may change.
+    learn_dict_->flush_cache();
+    LpiCache::invalidate_all();
+    reset_search0();
+    fill_mem_stats(&stats);
+    if (stats.total <= mem_cap_)
+      return true;
+  }
+
+  if (NULL != bigram_) {
+    delete bigram_;
+    bigram_ = NULL;
+    reset_search0();
+    fill_mem_stats(&stats);
+  }
+  return stats.total <= mem_cap_;
+}
+
 void MatrixSearch::set_max_lens(size_t max_sps_len, size_t max_hzs_len) {
   if (0 != max_sps_len)
     max_sps_len_ = max_sps_len;
@@ -176,15 +335,252 @@ void MatrixSearch::set_max_lens(size_t max_sps_len, size_t max_hzs_len) {
     max_hzs_len_ = max_hzs_len;
 }
 
+bool MatrixSearch::set_fuzzy(uint32 fuzzy_flags) {
+  if (!inited_)
+    return false;
+
+  if (!SpellingTrie::get_instance().set_fuzzy(fuzzy_flags))
+    return false;
+
+  // The searched paths and the cached lemma lists depend on the options.
+  LpiCache::invalidate_all();
+  reset_search();
+  return true;
+}
+
 void MatrixSearch::close() {
+  // Without the thread, what is still queued is applied and written here.
+  stop_learning();
   flush_cache();
   free_resource();
   inited_ = false;
 }
 
 void MatrixSearch::flush_cache() {
-  if (NULL != user_dict_)
-    user_dict_->flush_cache();
+  if (learn_thread_started_) {
+    learn_flush_ = true;
+    sem_post(&learn_sem_);
+    return;
+  }
+
+  apply_pending_learning();
+  if (NULL != learn_dict_)
+    learn_dict_->flush_cache();
+}
+
+bool MatrixSearch::defragment_user_dict() {
+  if (!inited_ || NULL == learn_dict_)
+    return true;
+
+  // The thread does the whole defragment in the background, and the new
+  // searches see it when they take the next copy of the dictionary.
+  if (learn_thread_started_) {
+    learn_defrag_ = true;
+    sem_post(&learn_sem_);
+    return true;
+  }
+
+  if (!learn_dict_->need_defragment())
+    return true;
+
+  if (!learn_dict_->defragment_step(kUserDictDefragStepBytes))
+    return false;
+  reset_search0();
+  return true;
+}
+
+void MatrixSearch::start_learning() {
+  // On a single core the thread can not run at the same time as the
+  // decoding, and waking it up only adds a context switch to choose(). The
+  // events are applied at once instead.
+  if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+    return;
+
+  // The decoder reads a copy of the user dictionary while the thread
+  // changes learn_dict_, so that neither of them waits for the other. The
+  // cached lemma lists belong to the decoder, they are dropped when it takes
+  // a newer copy.
+  UserDict *user_dict = new UserDict();
+  if (!user_dict->copy_dict(learn_dict_)) {
+    delete user_dict;
+    return;
+  }
+  learn_dict_->set_lpi_cache_notify(false);
+  learn_dict_size_ = learn_dict_->get_mem_size();
+
+  learn_stop_ = false;
+  learn_thread_started_ =
+      0 == pthread_create(&learn_thread_, NULL, learn_thread_proc, this);
+  if (learn_thread_started_) {
+    user_dict_ = static_cast<AtomDictBase*>(user_dict);
+  } else {
+    learn_dict_->set_lpi_cache_notify(true);
+    delete user_dict;
+  }
+}
+
+void MatrixSearch::stop_learning() {
+  if (!learn_thread_started_)
+    return;
+
+  learn_stop_ = true;
+  sem_post(&learn_sem_);
+  pthread_join(learn_thread_, NULL);
+  learn_thread_started_ = false;
+  learn_stop_ = false;
+
+  // The decoder uses learn_dict_ itself again.
+  delete user_dict_;
+  user_dict_ = static_cast<AtomDictBase*>(learn_dict_);
+  if (NULL != ready_dict_) {
+    delete ready_dict_;
+    ready_dict_ = NULL;
+  }
+  learn_dict_->set_lpi_cache_notify(true);
+  LpiCache::invalidate_all();
+}
+
+void* MatrixSearch::learn_thread_proc(void *arg) {
+  MatrixSearch *ms = static_cast<MatrixSearch*>(arg);
+  // Run as a background thread. Otherwise, on a single core, waking it up
+  // preempts the decoding thread, and choose() waits for it after all.
+  setpriority(PRIO_PROCESS, gettid(), kLearnThreadNice);
+  while (true) {
+    // Each wake-up does all the work given so far, so later posts may find
+    // nothing to do.
+    if (0 != sem_wait(&ms->learn_sem_))
+      continue;
+    if (ms->learn_stop_)
+      break;
+
+    ms->run_learning();
+  }
+  return NULL;
+}
+
+void MatrixSearch::run_learning() {
+  bool changed = false;
+  if (__sync_bool_compare_and_swap(&learn_reload_, true, false))
+    changed = learn_dict_->reload_if_outdated();
+
+  LearnEvent event;
+  while (learn_queue_.pop(&event)) {
+    apply_learning(&event);
+    changed = true;
+  }
+
+  if (__sync_bool_compare_and_swap(&learn_defrag_, true, false) &&
+      learn_dict_->need_defragment()) {
+    // The events queued meanwhile do not wait for the whole defragment.
+    while (!learn_stop_ &&
+           !learn_dict_->defragment_step(kUserDictDefragStepBytes)) {
+      while (learn_queue_.pop(&event))
+        apply_learning(&event);
+    }
+    changed = true;
+  }
+
+  if (__sync_bool_compare_and_swap(&learn_flush_, true, false)) {
+    learn_dict_->flush_cache();
+    changed = true;
+  }
+
+  if (changed)
+    publish_user_dict();
+}
+
+void MatrixSearch::publish_user_dict() {
+  learn_dict_size_ = learn_dict_->get_mem_size();
+
+  UserDict *user_dict = new UserDict();
+  if (!user_dict->copy_dict(learn_dict_)) {
+    delete user_dict;
+    return;
+  }
+  // The copy must be complete before the decoder can take it.
+  __sync_synchronize();
+  user_dict = __sync_lock_test_and_set(&ready_dict_, user_dict);
+  // An older copy which the decoder has not taken is not needed.
+  if (NULL != user_dict)
+    delete user_dict;
+}
+
+void MatrixSearch::adopt_user_dict() {
+  if (!learn_thread_started_)
+    return;
+
+  UserDict *user_dict = __sync_lock_test_and_set(&ready_dict_,
+                                                 static_cast<UserDict*>(NULL));
+  if (NULL == user_dict) {
+    // Another dictionary, e.g. the one used to sync, may have written the
+    // file. The thread reloads it and makes a new copy.
+    if (static_cast<UserDict*>(user_dict_)->is_outdated()) {
+      learn_reload_ = true;
+      sem_post(&learn_sem_);
+    }
+    return;
+  }
+
+  delete user_dict_;
+  user_dict_ = static_cast<AtomDictBase*>(user_dict);
+  // The lists cached from the old copy are stale, and so is the total
+  // frequency given to the system dictionary.
+  LpiCache::invalidate_all();
+  update_dict_freq();
+}
+
+void MatrixSearch::queue_learning(LearnEvent *event) {
+  if (!learn_thread_started_) {
+    apply_learning(event);
+    return;
+  }
+
+  // The decoder never waits for the thread. If the thread is so far behind
+  // that the queue is full, the event is dropped.
+  if (learn_queue_.push(event))
+    sem_post(&learn_sem_);
+}
+
+void MatrixSearch::queue_lemma_hit(LemmaIdType lma_id) {
+  LearnEvent event;
+  event.type = LearnQueue::kLearnHit;
+  event.hit_num = 0;
+  event.lma_len = get_lemma_str(lma_id, event.lma_str, kMaxLemmaSize + 1);
+  if (0 == event.lma_len ||
+      get_lemma_splids(lma_id, event.spl_ids, event.lma_len, false) !=
+      event.lma_len)
+    return;
+  queue_learning(&event);
+}
+
+void MatrixSearch::apply_pending_learning() {
+  LearnEvent event;
+  while (learn_queue_.pop(&event))
+    apply_learning(&event);
+}
+
+bool MatrixSearch::apply_learning(LearnEvent *event) {
+  if (NULL == learn_dict_)
+    return false;
+
+  // The lemma ids of the decoder may belong to an older copy of the
+  // dictionary, so the lemmas are found by their strings.
+  if (LearnQueue::kLearnHit == event->type) {
+    LemmaIdType lma_id = learn_dict_->get_lemma_id(event->lma_str,
+        event->spl_ids, event->lma_len);
+    return 0 != lma_id && 0 != learn_dict_->update_lemma(lma_id, 1, true);
+  }
+
+  for (uint16 pos = 0; pos < event->hit_num; pos++) {
+    uint16 start = event->hit_starts[pos];
+    LemmaIdType lma_id = learn_dict_->get_lemma_id(event->lma_str + start,
+        event->spl_ids + start, event->hit_lens[pos]);
+    if (0 != lma_id)
+      learn_dict_->update_lemma(lma_id, 1, true);
+  }
+
+  return 0 != learn_dict_->put_lemma(event->lma_str, event->spl_ids,
+                                     event->lma_len, 1);
 }
 
 void MatrixSearch::set_xi_an_switch(bool xi_an_enabled) {
@@ -195,9 +591,37 @@ bool MatrixSearch::get_xi_an_switch() {
   return xi_an_enabled_;
 }
 
+void MatrixSearch::set_beam(size_t beam_width, float score_gap) {
+  if (0 != beam_width)
+    beam_width_ = beam_width > kMaxNodeARow ? kMaxNodeARow : beam_width;
+  if (score_gap > 0)
+    beam_score_gap_ = score_gap;
+}
+
+size_t MatrixSearch::get_mtrx_nd_expanded(size_t step) {
+  if (!inited_ || step >= kMaxRowNum || step > pys_decoded_len_)
+    return 0;
+  return mtrx_nd_expanded_[step];
+}
+
+size_t MatrixSearch::get_mtrx_nd_pool_used() {
+  return inited_ ? mtrx_nd_pool_used_ : 0;
+}
+
+size_t MatrixSearch::get_dmi_pool_used() {
+  return inited_ ? dmi_pool_used_ : 0;
+}
+
 bool MatrixSearch::reset_search() {
   if (!inited_)
     return false;
+
+  // A new search takes the newest copy of the user dictionary, with what
+  // has been learned from the previous ones. The user dictionary may have
+  // grown since the memory cap was checked.
+  adopt_user_dict();
+  if (0 != mem_cap_)
+    apply_mem_cap();
   return reset_search0();
 }
 
@@ -208,6 +632,7 @@ bool MatrixSearch::reset_search0() {
     pys_decoded_len_ = 0;
     mtrx_nd_pool_used_ = 0;
     dmi_pool_used_ = 0;
+    memset(mtrx_nd_expanded_, 0, sizeof(mtrx_nd_expanded_));
 
     // Get a MatrixNode from the pool
     matrix_[0].mtrx_nd_pos = mtrx_nd_pool_used_;
@@ -427,7 +852,7 @@ size_t MatrixSearch::search(const char *py, size_t py_len) {
   // Compare the new string with the previous one. Find their prefix to
   // increase search efficiency.
   size_t ch_pos = 0;
-  for (ch_pos = 0; ch_pos < pys_decoded_len_; ch_pos++) {
+  for (ch_pos = 0; ch_pos < pys_decoded_len_ && ch_pos < py_len; ch_pos++) {
     if ('\0' == py[ch_pos] || py[ch_pos] != pys_[ch_pos])
       break;
   }
@@ -454,6 +879,16 @@ size_t MatrixSearch::search(const char *py, size_t py_len) {
 
   // If there are too many spellings, remove the last letter until the spelling
   // number is acceptable.
+  // The rows of shorter strings are still in the matrix, so those lengths
+  // which still have too many spellings are skipped without resetting the
+  // search; otherwise each reset may decode again from the last fixed lemma.
+  if (spl_id_num_ > 9) {
+    size_t fixed_pos = fixed_hzs_ > 0 ? spl_start_[fixed_hzs_] : 0;
+    if (py_len > pys_decoded_len_)
+      py_len = pys_decoded_len_;
+    while (py_len > fixed_pos + 1 && get_spl_num(py_len - 1) > 9)
+      py_len--;
+  }
   while (spl_id_num_ > 9) {
     py_len--;
     reset_search(py_len, false, false, false);
@@ -619,6 +1054,8 @@ char16* MatrixSearch::get_candidate(size_t cand_id, char16 *cand_str,
     return get_candidate0(cand_str, max_len, NULL, false);
   }
 
+  sort_candidates(cand_id + 1);
+
   LemmaIdType id = lpi_items_[cand_id].id;
   char16 s[kMaxLemmaSize + 1];
 
@@ -654,24 +1091,30 @@ bool MatrixSearch::add_lma_to_userdict(uint16 lma_fr, uint16 lma_to,
   if (lma_to - lma_fr <= 1 || NULL == user_dict_)
     return false;
 
-  char16 word_str[kMaxLemmaSize + 1];
-  uint16 spl_ids[kMaxLemmaSize];
+  LearnEvent event;
+  event.type = LearnQueue::kLearnAdd;
+  event.hit_num = 0;
 
   uint16 spl_id_fr = 0;
 
   for (uint16 pos = lma_fr; pos < lma_to; pos++) {
     LemmaIdType lma_id = lma_id_[pos];
+    uint16 lma_len = lma_start_[pos + 1] - lma_start_[pos];
     if (is_user_lemma(lma_id)) {
-      user_dict_->update_lemma(lma_id, 1, true);
+      event.hit_starts[event.hit_num] = spl_id_fr;
+      event.hit_lens[event.hit_num] = lma_len;
+      event.hit_num++;
     }
-    uint16 lma_len = lma_start_[pos + 1] - lma_start_[pos];
-    utf16_strncpy(spl_ids + spl_id_fr, spl_id_ + lma_start_[pos], lma_len);
+    utf16_strncpy(event.spl_ids + spl_id_fr, spl_id_ + lma_start_[pos],
+                  lma_len);
 
-    uint16 tmp = get_lemma_str(lma_id, word_str + spl_id_fr,
+    uint16 tmp = get_lemma_str(lma_id, event.lma_str + spl_id_fr,
                                kMaxLemmaSize + 1 - spl_id_fr);
-    assert(tmp == lma_len);
+    if (tmp != lma_len) {
+      return false;
+    }
 
-    tmp = get_lemma_splids(lma_id, spl_ids + spl_id_fr, lma_len, true);
+    tmp = get_lemma_splids(lma_id, event.spl_ids + spl_id_fr, lma_len, true);
     if (tmp != lma_len) {
       return false;
     }
@@ -681,8 +1124,9 @@ bool MatrixSearch::add_lma_to_userdict(uint16 lma_fr, uint16 lma_to,
 
   assert(spl_id_fr <= kMaxLemmaSize);
 
-  return user_dict_->put_lemma(static_cast<char16*>(word_str), spl_ids,
-                                 spl_id_fr, 1);
+  event.lma_len = spl_id_fr;
+  queue_learning(&event);
+  return true;
 }
 
 void MatrixSearch::debug_print_dmi(PoolPosType dmi_pos, uint16 nest_level) {
@@ -792,7 +1236,7 @@ size_t MatrixSearch::choose(size_t cand_id) {
         // 1.1.1. The first choice is a user lemma, notify the user dictionary
         // that it is hit.
         if (NULL != user_dict_)
-          user_dict_->update_lemma(lma_id_[0], 1, true);
+          queue_lemma_hit(lma_id_[0]);
       } else {
         // 1.1.2. do thing for a system lemma.
       }
@@ -812,6 +1256,7 @@ size_t MatrixSearch::choose(size_t cand_id) {
 
   // 2. It is not the full sentence candidate.
   // Find the length of the candidate.
+  sort_candidates(cand_id + 1);
   LemmaIdType id_chosen = lpi_items_[cand_id].id;
   LmaScoreType score_chosen = lpi_items_[cand_id].psb;
   size_t cand_len = lpi_items_[cand_id].lma_len;
@@ -821,7 +1266,7 @@ size_t MatrixSearch::choose(size_t cand_id) {
   // Notify the atom dictionary that this item is hit.
   if (is_user_lemma(id_chosen)) {
     if (NULL != user_dict_) {
-      user_dict_->update_lemma(id_chosen, 1, true);
+      queue_lemma_hit(id_chosen);
     }
     update_dict_freq();
   }
@@ -841,6 +1286,7 @@ size_t MatrixSearch::choose(size_t cand_id) {
   // information will be kept, while the MTRX information will be re-extended,
   // and only one node will be extended.
   matrix_[step_to].mtrx_nd_num = 0;
+  mtrx_nd_expanded_[step_to] = 0;
 
   LmaPsbItem lpi_item;
   lpi_item.psb = score_chosen;
@@ -970,6 +1416,7 @@ bool MatrixSearch::add_char(char ch) {
 
 bool MatrixSearch::add_char_qwerty() {
   matrix_[pys_decoded_len_].mtrx_nd_num = 0;
+  mtrx_nd_expanded_[pys_decoded_len_] = 0;
 
   bool spl_matched = false;
   uint16 longest_ext = 0;
@@ -1074,13 +1521,10 @@ bool MatrixSearch::add_char_qwerty() {
       dep_->ext_len = ext_len;
       dep_->splid_end_split = splid_end_split;
 
-      dep_->id_num = 1;
-      dep_->id_start = spl_idx;
-      if (spl_trie_->is_half_id(spl_idx)) {
-        // Get the full id list
-        dep_->id_num = spl_trie_->half_to_full(spl_idx, &(dep_->id_start));
-        assert(dep_->id_num > 0);
-      }
+      // Get the full id list
+      dep_->id_range_num = spl_trie_->get_id_ranges(spl_idx,
+                                                     &(dep_->id_ranges));
+      assert(dep_->id_range_num > 0);
 
       uint16 new_dmi_num;
 
@@ -1099,6 +1543,9 @@ bool MatrixSearch::add_char_qwerty() {
 
       // If get candiate lemmas, try to extend the path
       if (lpi_total_ > 0) {
+        // The bigram model can make an extension better than its unigram
+        // score by at most this value.
+        float min_delta = NULL == bigram_ ? 0 : bigram_->get_min_delta();
         uint16 fr_row;
         if (NULL == dmi) {
           fr_row = oldrow;
@@ -1111,11 +1558,21 @@ bool MatrixSearch::add_char_qwerty() {
              matrix_[fr_row].mtrx_nd_num;
              mtrx_nd_pos++) {
           MatrixNode *mtrx_nd = mtrx_nd_pool_ + mtrx_nd_pos;
+          if (longest_ext == 0)
+            longest_ext = ext_len;
+
+          // The nodes of a row are sorted by score, and so are the lemma
+          // items. Once the best extension of a node cannot get into the
+          // full beam, neither can the following nodes.
+          MatrixRow *res_row = matrix_ + pys_decoded_len_;
+          if (res_row->mtrx_nd_num >= beam_width_ &&
+              mtrx_nd->score + lpi_items_[0].psb + min_delta >=
+              mtrx_nd_pool_[res_row->mtrx_nd_pos +
+                            res_row->mtrx_nd_num - 1].score)
+            break;
 
           extend_mtrx_nd(mtrx_nd, lpi_items_, lpi_total_,
                          dmi_pool_used_ - new_dmi_num, pys_decoded_len_);
-          if (longest_ext == 0)
-            longest_ext = ext_len;
         }
       }
     }  // for dmi_pos
@@ -1156,7 +1613,7 @@ void MatrixSearch::prepare_candidates() {
     lma_num = get_lpis(spl_id_ + fixed_hzs_, lma_size,
                        lpi_items_ + lpi_total_,
                        size_t(kMaxLmaPsbItems - lpi_total_),
-                       pfullsent, lma_size == lma_size_max);
+                       pfullsent, false);
 
     if (lma_num > 0) {
       lpi_total_ += lma_num;
@@ -1170,11 +1627,14 @@ void MatrixSearch::prepare_candidates() {
     lma_size--;
   }
 
-  // Sort those partially-matched items by their unified scores.
-  myqsort(lpi_items_ + lpi_num_full_match, lpi_total_ - lpi_num_full_match,
-          sizeof(LmaPsbItem), cmp_lpi_with_unified_psb);
+  // Only the first page is sorted here, other pages are sorted when they are
+  // requested.
+  lpi_num_full_match_ = lpi_num_full_match;
+  lpi_sorted_ = 0;
+  sort_candidates(kCandidatePageSize);
 
   if (kPrintDebug0) {
+    sort_candidates(lpi_total_);
     printf("-----Prepare candidates, score:\n");
     for (size_t a = 0; a < lpi_total_; a++) {
       printf("[%03d]%d    ", a, lpi_items_[a].psb);
@@ -1296,6 +1756,27 @@ void MatrixSearch::merge_fixed_lmas(size_t del_spl_pos) {
   return;
 }
 
+size_t MatrixSearch::get_spl_num(size_t ch_pos) {
+  if (!inited_ || 0 == ch_pos || ch_pos > pys_decoded_len_ ||
+      0 == matrix_[ch_pos].mtrx_nd_num)
+    return 0;
+
+  size_t spl_num = fixed_hzs_;
+  MatrixNode *mtrx_nd = mtrx_nd_pool_ + matrix_[ch_pos].mtrx_nd_pos;
+  while (mtrx_nd != mtrx_nd_pool_) {
+    if (fixed_hzs_ > 0 && mtrx_nd->step <= spl_start_[fixed_hzs_])
+      break;
+
+    PoolPosType dmi_fr = mtrx_nd->dmi_fr;
+    while ((PoolPosType)-1 != dmi_fr) {
+      spl_num++;
+      dmi_fr = dmi_pool_[dmi_fr].dmi_fr;
+    }
+    mtrx_nd = mtrx_nd->from;
+  }
+  return spl_num;
+}
+
 void MatrixSearch::get_spl_start_id() {
   lma_id_num_ = 0;
   lma_start_[0] = 0;
@@ -1409,6 +1890,8 @@ size_t MatrixSearch::extend_dmi(DictExtPara *dep, DictMatchInfo *dmi_s) {
   bool cached = false;
   if (0 == dep->splids_extended)
     cached = lpi_cache.is_cached(splid);
+  else if (1 == dep->splids_extended)
+    cached = lpi_cache.is_cached(dep->splids[0], splid);
 
   // 1. If this is a half Id, get its corresponding full starting Id and
   // number of full Id.
@@ -1431,8 +1914,10 @@ size_t MatrixSearch::extend_dmi(DictExtPara *dep, DictMatchInfo *dmi_s) {
   MileStoneHandle handles[2];
   handles[0] = handles[1] = 0;
   if (from_h[0] > 0 || NULL == dmi_s) {
+    // If the list is cached, only the mile stones are needed.
     handles[0] = dict_trie_->extend_dict(from_h[0], dep, lpi_items_,
-                                         kMaxLmaPsbItems, &lpi_num);
+                                         cached ? 0 : kMaxLmaPsbItems,
+                                         &lpi_num);
   }
   if (handles[0] > 0)
     lpi_total_ = lpi_num;
@@ -1488,11 +1973,16 @@ size_t MatrixSearch::extend_dmi(DictExtPara *dep, DictMatchInfo *dmi_s) {
     }
 
     myqsort(lpi_items_, lpi_total_, sizeof(LmaPsbItem), cmp_lpi_with_psb);
-    if (NULL == dmi_s && spl_trie_->is_half_id(splid))
+    if (NULL == dmi_s)
       lpi_total_ = lpi_cache.put_cache(splid, lpi_items_, lpi_total_);
-  } else {
-    assert(spl_trie_->is_half_id(splid));
+    else if (1 == dep->splids_extended)
+      lpi_total_ = lpi_cache.put_cache(dep->splids[0], splid, lpi_items_,
+                                       lpi_total_);
+  } else if (0 == dep->splids_extended) {
     lpi_total_ = lpi_cache.get_cache(splid, lpi_items_, kMaxLmaPsbItems);
+  } else {
+    lpi_total_ = lpi_cache.get_cache(dep->splids[0], splid, lpi_items_,
+                                     kMaxLmaPsbItems);
   }
 
   return ret_val;
@@ -1543,36 +2033,64 @@ size_t MatrixSearch::extend_mtrx_nd(MatrixNode *mtrx_nd, LmaPsbItem lpi_items[],
 
   if (0 == mtrx_nd->step) {
     // Because the list is sorted, if the source step is 0, it is only
-    // necessary to pick up the first kMaxNodeARow items.
-    if (lpi_num > kMaxNodeARow)
-      lpi_num = kMaxNodeARow;
+    // necessary to pick up the first beam_width_ items.
+    if (lpi_num > beam_width_)
+      lpi_num = beam_width_;
+  }
+
+  // Successors of this node in the bigram model. The items are sorted by
+  // their unigram scores, and the bigram model can make an item better by at
+  // most min_delta, so the bound of an item is its unigram score plus it.
+  // The system lemmas not in the list get the backoff penalty.
+  const uint32 *succ = NULL;
+  size_t succ_num = 0;
+  float backoff = 0;
+  float min_delta = 0;
+  if (NULL != bigram_ && mtrx_nd->id < kSysDictIdEnd) {
+    succ = bigram_->get_successors(mtrx_nd->id, &succ_num, &backoff);
+    if (NULL != succ)
+      min_delta = bigram_->get_min_delta();
   }
 
   MatrixNode *mtrx_nd_res_min = mtrx_nd_pool_ + matrix_[res_row].mtrx_nd_pos;
   for (size_t pos = 0; pos < lpi_num; pos++) {
     float score = mtrx_nd->score + lpi_items[pos].psb;
-    if (pos > 0 && score - PRUMING_SCORE > mtrx_nd_res_min->score)
+    if (pos > 0 &&
+        score + min_delta - beam_score_gap_ > mtrx_nd_res_min->score)
       break;
 
     // Try to add a new node
     size_t mtrx_nd_num = matrix_[res_row].mtrx_nd_num;
+
+    // The beam is full, and the items left are not better than its worst
+    // node.
+    if (mtrx_nd_num >= beam_width_ &&
+        score + min_delta >= mtrx_nd_res_min[mtrx_nd_num - 1].score)
+      break;
+
+    mtrx_nd_expanded_[res_row]++;
+
+    if (NULL != succ && lpi_items[pos].id < kSysDictIdEnd)
+      score += bigram_->get_delta(succ, succ_num, backoff,
+                                  lpi_items[pos].id);
+
     MatrixNode *mtrx_nd_res = mtrx_nd_res_min + mtrx_nd_num;
     bool replace = false;
     // Find its position
     while (mtrx_nd_res > mtrx_nd_res_min && score < (mtrx_nd_res - 1)->score) {
-      if (static_cast<size_t>(mtrx_nd_res - mtrx_nd_res_min) < kMaxNodeARow)
+      if (static_cast<size_t>(mtrx_nd_res - mtrx_nd_res_min) < beam_width_)
         *mtrx_nd_res = *(mtrx_nd_res - 1);
       mtrx_nd_res--;
       replace = true;
     }
-    if (replace || (mtrx_nd_num < kMaxNodeARow &&
+    if (replace || (mtrx_nd_num < beam_width_ &&
         matrix_[res_row].mtrx_nd_pos + mtrx_nd_num < kMtrxNdPoolSize)) {
       mtrx_nd_res->id = lpi_items[pos].id;
       mtrx_nd_res->score = score;
       mtrx_nd_res->from = mtrx_nd;
       mtrx_nd_res->dmi_fr = dmi_fr;
       mtrx_nd_res->step = res_row;
-      if (matrix_[res_row].mtrx_nd_num < kMaxNodeARow)
+      if (matrix_[res_row].mtrx_nd_num < beam_width_)
         matrix_[res_row].mtrx_nd_num++;
     }
   }
@@ -1608,6 +2126,29 @@ PoolPosType MatrixSearch::match_dmi(size_t step_to, uint16 spl_ids[],
   return static_cast<PoolPosType>(-1);
 }
 
+void MatrixSearch::sort_candidates(size_t num) {
+  if (num > lpi_total_)
+    num = lpi_total_;
+
+  while (lpi_sorted_ < num) {
+    size_t seg_end = lpi_total_;
+    int (*cmp_func)(const void *, const void *) = cmp_lpi_with_unified_psb;
+    if (lpi_sorted_ < lpi_num_full_match_) {
+      seg_end = lpi_num_full_match_;
+      cmp_func = cmp_lpi_with_psb;
+    }
+
+    size_t sel_num = num - lpi_sorted_;
+    if (sel_num < kCandidatePageSize)
+      sel_num = kCandidatePageSize;
+    if (sel_num > seg_end - lpi_sorted_)
+      sel_num = seg_end - lpi_sorted_;
+
+    lpi_sorted_ += partial_sort_lpi(lpi_items_ + lpi_sorted_,
+                                    seg_end - lpi_sorted_, sel_num, cmp_func);
+  }
+}
+
 char16* MatrixSearch::get_candidate0(char16 *cand_str, size_t max_len,
                                      uint16 *retstr_len,
                                      bool only_unfixed) {
@@ -1678,6 +2219,186 @@ char16* MatrixSearch::get_candidate0(char16 *cand_str, size_t max_len,
   return cand_str;
 }
 
+size_t MatrixSearch::get_nbest_preds(size_t fr_row, PoolPosType *preds) {
+  size_t pred_num = 0;
+  MatrixRow *row = matrix_ + fr_row;
+  for (PoolPosType pos = row->mtrx_nd_pos;
+       pos < row->mtrx_nd_pos + row->mtrx_nd_num; pos++) {
+    MatrixNode *mtrx_nd = mtrx_nd_pool_ + pos;
+    // Nodes of the same lemma from the same step give the same sentences,
+    // and the first one is the best.
+    bool repeated = false;
+    for (size_t i = 0; i < pred_num && !repeated; i++) {
+      MatrixNode *prev = mtrx_nd_pool_ + preds[i];
+      repeated = prev->id == mtrx_nd->id && NULL != prev->from &&
+                 NULL != mtrx_nd->from &&
+                 prev->from->step == mtrx_nd->from->step;
+    }
+    if (!repeated)
+      preds[pred_num++] = pos;
+  }
+  return pred_num;
+}
+
+void MatrixSearch::fill_nbest(PoolPosType nd_pos, size_t k,
+                              NBestEntry *entries, uint16 *nums) {
+  if (nums[nd_pos] != static_cast<uint16>(-1))
+    return;
+
+  MatrixNode *mtrx_nd = mtrx_nd_pool_ + nd_pos;
+  NBestEntry *res = entries + nd_pos * k;
+  if (NULL == mtrx_nd->from) {
+    res->score = mtrx_nd->score;
+    res->pred = static_cast<PoolPosType>(-1);
+    res->rank = 0;
+    nums[nd_pos] = 1;
+    return;
+  }
+
+  // Every node of the row the node is extended from is extended with the
+  // same lemma, so any of them can precede it. The part up to the fixed
+  // lemmas has only one path, the one the user has chosen.
+  PoolPosType preds[kMaxNodeARow];
+  float shifts[kMaxNodeARow];
+  size_t pred_num;
+  size_t fr_row = mtrx_nd->from->step;
+  if (fr_row <= spl_start_[fixed_hzs_]) {
+    preds[0] = mtrx_nd->from - mtrx_nd_pool_;
+    shifts[0] = mtrx_nd->score - mtrx_nd->from->score;
+    pred_num = 1;
+  } else {
+    bool use_bigram = NULL != bigram_ && mtrx_nd->id < kSysDictIdEnd;
+    // The score of the lemma itself, without the bigram delta it got from
+    // the node it is extended from.
+    float lma_score = mtrx_nd->score - mtrx_nd->from->score;
+    if (use_bigram && mtrx_nd->from->id < kSysDictIdEnd)
+      lma_score -= bigram_->get_delta(mtrx_nd->from->id, mtrx_nd->id);
+
+    pred_num = get_nbest_preds(fr_row, preds);
+    for (size_t i = 0; i < pred_num; i++) {
+      LemmaIdType pred_id = mtrx_nd_pool_[preds[i]].id;
+      shifts[i] = lma_score;
+      if (use_bigram && pred_id < kSysDictIdEnd)
+        shifts[i] += bigram_->get_delta(pred_id, mtrx_nd->id);
+    }
+  }
+
+  for (size_t i = 0; i < pred_num; i++)
+    fill_nbest(preds[i], k, entries, nums);
+  nums[nd_pos] = merge_nbest(preds, shifts, pred_num, k, entries, nums, res);
+}
+
+size_t MatrixSearch::merge_nbest(const PoolPosType *preds, const float *shifts,
+                                 size_t pred_num, size_t k,
+                                 const NBestEntry *entries, const uint16 *nums,
+                                 NBestEntry *res) {
+  uint16 ranks[kMaxNodeARow];
+  for (size_t i = 0; i < pred_num; i++)
+    ranks[i] = 0;
+
+  size_t res_num = 0;
+  while (res_num < k) {
+    size_t best = pred_num;
+    float best_score = 0;
+    for (size_t i = 0; i < pred_num; i++) {
+      if (ranks[i] >= nums[preds[i]])
+        continue;
+      float score = entries[preds[i] * k + ranks[i]].score + shifts[i];
+      if (best == pred_num || score < best_score) {
+        best = i;
+        best_score = score;
+      }
+    }
+    if (best == pred_num)
+      break;
+
+    res[res_num].score = best_score;
+    res[res_num].pred = preds[best];
+    res[res_num].rank = ranks[best];
+    ranks[best]++;
+    res_num++;
+  }
+  return res_num;
+}
+
+size_t MatrixSearch::get_nbest(NBestSentence *sents, size_t max_num) {
+  if (NULL == sents || 0 == max_num || pys_decoded_len_ == 0 ||
+      matrix_[pys_decoded_len_].mtrx_nd_num == 0)
+    return 0;
+
+  size_t k = max_num > kMaxNBest ? kMaxNBest : max_num;
+
+  // The k best paths to each node are only worked out when a path through
+  // the node is needed.
+  NBestEntry *entries = static_cast<NBestEntry*>(
+      malloc(sizeof(NBestEntry) * k * mtrx_nd_pool_used_));
+  uint16 *nums = static_cast<uint16*>(
+      malloc(sizeof(uint16) * mtrx_nd_pool_used_));
+  if (NULL == entries || NULL == nums) {
+    free(entries);
+    free(nums);
+    return 0;
+  }
+  for (size_t pos = 0; pos < mtrx_nd_pool_used_; pos++)
+    nums[pos] = static_cast<uint16>(-1);
+
+  PoolPosType ends[kMaxNodeARow];
+  float shifts[kMaxNodeARow];
+  size_t end_num = get_nbest_preds(pys_decoded_len_, ends);
+  for (size_t i = 0; i < end_num; i++) {
+    fill_nbest(ends[i], k, entries, nums);
+    shifts[i] = 0;
+  }
+
+  NBestEntry best[kMaxNBest];
+  size_t best_num = merge_nbest(ends, shifts, end_num, k, entries, nums, best);
+
+  size_t sent_num = 0;
+  for (size_t n = 0; n < best_num; n++) {
+    // Trace the path back to the root.
+    PoolPosType path[kMaxRowNum];
+    size_t path_len = 0;
+    PoolPosType nd_pos = best[n].pred;
+    uint16 rank = best[n].rank;
+    while (nd_pos != static_cast<PoolPosType>(-1) && path_len < kMaxRowNum) {
+      path[path_len++] = nd_pos;
+      const NBestEntry *entry = entries + nd_pos * k + rank;
+      nd_pos = entry->pred;
+      rank = entry->rank;
+    }
+
+    NBestSentence *sent = sents + sent_num;
+    sent->score = best[n].score;
+    sent->lma_num = 0;
+    sent->py_start[0] = 0;
+    sent->hz_start[0] = 0;
+    bool ok = true;
+    while (path_len > 0 && ok) {
+      MatrixNode *mtrx_nd = mtrx_nd_pool_ + path[--path_len];
+      if (0 == mtrx_nd->id)
+        continue;
+
+      uint16 hz_pos = sent->hz_start[sent->lma_num];
+      uint16 str_len = get_lemma_str(mtrx_nd->id, sent->str + hz_pos,
+                                     kMaxSearchSteps + 1 - hz_pos);
+      ok = str_len > 0 && sent->lma_num < kMaxSearchSteps;
+      if (ok) {
+        sent->lma_num++;
+        sent->py_start[sent->lma_num] = mtrx_nd->step;
+        sent->hz_start[sent->lma_num] = hz_pos + str_len;
+      }
+    }
+    if (ok && sent->lma_num > 0) {
+      sent->str[sent->hz_start[sent->lma_num]] = (char16)'\0';
+      sent_num++;
+    }
+  }
+
+  free(entries);
+  free(nums);
+  return sent_num;
+}
+
 size_t MatrixSearch::get_lpis(const uint16* splid_str, size_t splid_str_len,
                               LmaPsbItem* lma_buf, size_t max_lma_buf,
                               const char16 *pfullsent, bool sort_by_psb) {
@@ -1697,80 +2418,77 @@ size_t MatrixSearch::get_lpis(const uint16* splid_str, size_t splid_str_len,
   if (0 == num)
     return 0;
 
-  // Remove repeated items.
+  // Remove repeated items. Items with the same string are merged into the one
+  // with the smallest score, and the items which are the same as the full
+  // sentence candidate are removed. A hash set keyed by the strings is used,
+  // so that the remaining items keep their original order.
+  //
+  // For single character, some characters have more than one spelling, for
+  // example, "de" and "di" are all valid for a Chinese character, so when
+  // the user input  "d", repeated items are generated.
+  // For single character lemmas, Hanzis will be gotten, and they are used as
+  // the keys directly.
+  uint16 slots[kLpiHashSlots];
+  memset(slots, 0, sizeof(slots));
+  size_t remain_num = 0;
+
   if (splid_str_len > 1) {
-    LmaPsbStrItem *lpsis = reinterpret_cast<LmaPsbStrItem*>(lma_buf + num);
-    size_t lpsi_num = (max_lma_buf - num) * sizeof(LmaPsbItem) /
-        sizeof(LmaPsbStrItem);
-    assert(lpsi_num > num);
-    if (num > lpsi_num) num = lpsi_num;
-    lpsi_num = num;
-
-    for (size_t pos = 0; pos < lpsi_num; pos++) {
-      lpsis[pos].lpi = lma_buf[pos];
-      get_lemma_str(lma_buf[pos].id, lpsis[pos].str, kMaxLemmaSize + 1);
-    }
-
-    myqsort(lpsis, lpsi_num, sizeof(LmaPsbStrItem), cmp_lpsi_with_str);
-
-    size_t remain_num = 0;
-    for (size_t pos = 0; pos < lpsi_num; pos++) {
-      if (pos > 0 && utf16_strcmp(lpsis[pos].str, lpsis[pos - 1].str) == 0) {
-        if (lpsis[pos].lpi.psb < lpsis[pos - 1].lpi.psb) {
-          assert(remain_num > 0);
-          lma_buf[remain_num - 1] = lpsis[pos].lpi;
-        }
-        continue;
-      }
-      if (NULL != pfullsent && utf16_strcmp(lpsis[pos].str, pfullsent) == 0)
+    // The strings of the remaining items are kept in the free part of lma_buf.
+    char16 (*strs)[kMaxLemmaSize + 1] =
+        reinterpret_cast<char16 (*)[kMaxLemmaSize + 1]>(lma_buf + num);
+    size_t str_num = (max_lma_buf - num) * sizeof(LmaPsbItem) /
+        sizeof(*strs);
+    assert(str_num > num);
+    if (num > str_num) num = str_num;
+
+    for (size_t pos = 0; pos < num; pos++) {
+      char16 *str = strs[remain_num];
+      get_lemma_str(lma_buf[pos].id, str, kMaxLemmaSize + 1);
+      if (NULL != pfullsent && utf16_strcmp(str, pfullsent) == 0)
         continue;
 
-      lma_buf[remain_num] = lpsis[pos].lpi;
+      size_t slot = utf16_strhash(str, kMaxLemmaSize) & (kLpiHashSlots - 1);
+      while (0 != slots[slot] && utf16_strcmp(strs[slots[slot] - 1], str) != 0)
+        slot = (slot + 1) & (kLpiHashSlots - 1);
+
+      if (0 != slots[slot]) {
+        if (lma_buf[pos].psb < lma_buf[slots[slot] - 1].psb)
+          lma_buf[slots[slot] - 1] = lma_buf[pos];
+        continue;
+      }
+      lma_buf[remain_num] = lma_buf[pos];
       remain_num++;
+      slots[slot] = static_cast<uint16>(remain_num);
     }
-
-    // Update the result number
-    num = remain_num;
   } else {
-    // For single character, some characters have more than one spelling, for
-    // example, "de" and "di" are all valid for a Chinese character, so when
-    // the user input  "d", repeated items are generated.
-    // For single character lemmas, Hanzis will be gotten
     for (size_t pos = 0; pos < num; pos++) {
       char16 hanzis[2];
       get_lemma_str(lma_buf[pos].id, hanzis, 2);
       lma_buf[pos].hanzi = hanzis[0];
-    }
-
-    myqsort(lma_buf, num, sizeof(LmaPsbItem), cmp_lpi_with_hanzi);
-
-    size_t remain_num = 0;
-    for (size_t pos = 0; pos < num; pos++) {
-      if (pos > 0 && lma_buf[pos].hanzi == lma_buf[pos - 1].hanzi) {
-        if (NULL != pfullsent &&
-            static_cast<char16>(0) == pfullsent[1] &&
-            lma_buf[pos].hanzi == pfullsent[0])
-          continue;
-
-        if (lma_buf[pos].psb < lma_buf[pos - 1].psb) {
-          assert(remain_num > 0);
-          assert(lma_buf[remain_num - 1].hanzi == lma_buf[pos].hanzi);
-          lma_buf[remain_num - 1] = lma_buf[pos];
-        }
-        continue;
-      }
       if (NULL != pfullsent &&
           static_cast<char16>(0) == pfullsent[1] &&
           lma_buf[pos].hanzi == pfullsent[0])
-          continue;
+        continue;
 
+      size_t slot = (lma_buf[pos].hanzi * 2654435761U) & (kLpiHashSlots - 1);
+      while (0 != slots[slot] &&
+             lma_buf[slots[slot] - 1].hanzi != lma_buf[pos].hanzi)
+        slot = (slot + 1) & (kLpiHashSlots - 1);
+
+      if (0 != slots[slot]) {
+        if (lma_buf[pos].psb < lma_buf[slots[slot] - 1].psb)
+          lma_buf[slots[slot] - 1] = lma_buf[pos];
+        continue;
+      }
       lma_buf[remain_num] = lma_buf[pos];
       remain_num++;
+      slots[slot] = static_cast<uint16>(remain_num);
     }
-
-    num = remain_num;
   }
 
+  // Update the result number
+  num = remain_num;
+
   if (sort_by_psb) {
     myqsort(lma_buf, num, sizeof(LmaPsbItem), cmp_lpi_with_psb);
   }
@@ -1809,8 +2527,10 @@ uint16 MatrixSearch::get_lemma_splids(LemmaIdType id_lemma, uint16 *splids,
   uint16 splid_num = 0;
 
   if (arg_valid) {
+    // With fuzzy Pinyin, a full id may not be the real reading either.
     for (splid_num = 0; splid_num < splids_max; splid_num++) {
-      if (spl_trie_->is_half_id(splids[splid_num]))
+      if (spl_trie_->is_half_id(splids[splid_num]) ||
+          spl_trie_->is_fuzzy_id(splids[splid_num]))
         break;
     }
     if (splid_num == splids_max)
@@ -1910,19 +2630,8 @@ size_t MatrixSearch::inner_predict(const char16 *fixed_buf, uint16 fixed_len,
     res_total += res_this;
   }
 
-  res_total = remove_duplicate_npre(npre_items_, res_total);
-
-  if (kPreferLongHistoryPredict) {
-    myqsort(npre_items_, res_total, sizeof(NPredictItem),
-            cmp_npre_by_hislen_score);
-  } else {
-    myqsort(npre_items_, res_total, sizeof(NPredictItem),
-            cmp_npre_by_score);
-  }
-
-  if (buf_len < res_total) {
-    res_total = buf_len;
-  }
+  res_total = select_top_npre(npre_items_, res_total, buf_len,
+                              kPreferLongHistoryPredict);
 
   if (kPrintDebug2) {
     printf("/////////////////Predicted Items Begin////////////////////>>\n");
@@ -164,7 +164,8 @@ bool NGram::save_ngram(FILE *fp) {
   if (0 == idx_num_ || NULL == freq_codes_ ||  NULL == lma_freq_idx_)
     return false;
 
-  if (fwrite(&idx_num_, sizeof(size_t), 1, fp) != 1)
+  uint32 idx_num = static_cast<uint32>(idx_num_);
+  if (fwrite(&idx_num, sizeof(uint32), 1, fp) != 1)
     return false;
 
   if (fwrite(freq_codes_, sizeof(LmaScoreType), kCodeBookSize, fp) !=
@@ -183,8 +184,10 @@ bool NGram::load_ngram(FILE *fp) {
 
   initialized_ = false;
 
-  if (fread(&idx_num_, sizeof(size_t), 1, fp) != 1 )
+  uint32 idx_num;
+  if (fread(&idx_num, sizeof(uint32), 1, fp) != 1)
     return false;
+  idx_num_ = idx_num;
 
   if (NULL != lma_freq_idx_)
     free(lma_freq_idx_);
@@ -231,6 +234,13 @@ float NGram::get_uni_psb(LemmaIdType lma_id) {
       sys_score_compensation_;
 }
 
+size_t NGram::get_mem_size() {
+  if (!initialized_)
+    return sizeof(NGram);
+  return sizeof(NGram) + idx_num_ * sizeof(CODEBOOK_TYPE) +
+      kCodeBookSize * sizeof(LmaScoreType);
+}
+
 float NGram::convert_psb_to_score(double psb) {
   float score = static_cast<float>(
       log(psb) * static_cast<double>(kLogValueAmplifier));
@@ -26,14 +26,14 @@ extern "C" {
 
   using namespace ime_pinyin;
 
-  // The maximum number of the prediction items.
-  static const size_t kMaxPredictNum = 500;
-
   // Used to search Pinyin string and give the best candidate.
   MatrixSearch* matrix_search = NULL;
 
   char16 predict_buf[kMaxPredictNum][kMaxPredictSize + 1];
 
+  // The memory cap for the decoder, 0 means there is none.
+  size_t memory_cap = 0;
+
   bool im_open_decoder(const char *fn_sys_dict, const char *fn_usr_dict) {
     if (NULL != matrix_search)
       delete matrix_search;
@@ -43,6 +43,7 @@ extern "C" {
       return false;
     }
 
+    matrix_search->set_mem_cap(memory_cap);
     return matrix_search->init(fn_sys_dict, fn_usr_dict);
   }
 
@@ -55,6 +56,7 @@ extern "C" {
     if (NULL == matrix_search)
       return false;
 
+    matrix_search->set_mem_cap(memory_cap);
     return matrix_search->init_fd(sys_fd, start_offset, length, fn_usr_dict);
   }
 
@@ -66,6 +68,13 @@ extern "C" {
     matrix_search = NULL;
   }
 
+  bool im_load_bigram(const char *fn_bigram, size_t max_mb) {
+    if (NULL == matrix_search)
+      return false;
+
+    return matrix_search->load_bigram(fn_bigram, max_mb);
+  }
+
   void im_set_max_lens(size_t max_sps_len, size_t max_hzs_len) {
     if (NULL != matrix_search) {
       matrix_search->set_max_lens(max_sps_len, max_hzs_len);
@@ -77,6 +86,13 @@ extern "C" {
       matrix_search->flush_cache();
   }
 
+  bool im_defragment_user_dict() {
+    if (NULL == matrix_search)
+      return true;
+
+    return matrix_search->defragment_user_dict();
+  }
+
   // To be updated.
   size_t im_search(const char* pybuf, size_t pylen) {
     if (NULL == matrix_search)
@@ -128,6 +144,13 @@ extern "C" {
     return matrix_search->get_spl_start(spl_start);
   }
 
+  size_t im_get_nbest(NBestSentence *sents, size_t max_num) {
+    if (NULL == matrix_search)
+      return 0;
+
+    return matrix_search->get_nbest(sents, max_num);
+  }
+
   size_t im_choose(size_t choice_id) {
     if (NULL == matrix_search)
       return 0;
@@ -181,6 +204,29 @@ extern "C" {
     spl_trie.szm_enable_ym(enable);
   }
 
+  bool im_set_fuzzy(unsigned int fuzzy_flags) {
+    if (NULL == matrix_search)
+      return false;
+
+    return matrix_search->set_fuzzy(fuzzy_flags);
+  }
+
+  bool im_set_memory_cap(size_t cap) {
+    memory_cap = cap;
+    if (NULL == matrix_search)
+      return true;
+
+    return matrix_search->set_mem_cap(cap);
+  }
+
+  bool im_get_memory_stats(MemStats *stats) {
+    if (NULL == matrix_search || NULL == stats)
+      return false;
+
+    matrix_search->get_mem_stats(stats);
+    return true;
+  }
+
 #ifdef __cplusplus
 }
 #endif
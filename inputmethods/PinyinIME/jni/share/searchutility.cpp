@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "../include/mystdlib.h"
 #include "../include/searchutility.h"
 
@@ -202,6 +203,244 @@ size_t remove_duplicate_npre(NPredictItem *npre_items, size_t npre_num) {
   return remain_num;
 }
 
+// The maximum number of items selected by partial_sort_lpi() in one call.
+// For more items, the whole list is sorted.
+static const size_t kMaxPartialSortNum = 256;
+
+static int cmp_uint16(const void *p1, const void *p2) {
+  return static_cast<int>(*static_cast<const uint16*>(p1)) -
+      static_cast<int>(*static_cast<const uint16*>(p2));
+}
+
+// Test if the item at pos1 should be placed after the item at pos2.
+static bool lpi_after(const LmaPsbItem *lpi_items, uint16 pos1, uint16 pos2,
+                      int (*cmp_func)(const void *, const void *)) {
+  int ret_v = cmp_func(lpi_items + pos1, lpi_items + pos2);
+  return ret_v > 0 || (0 == ret_v && pos1 > pos2);
+}
+
+// Sift down in a heap of positions whose top is the last one in order.
+static void sift_down_lpi(const LmaPsbItem *lpi_items, uint16 *heap,
+                          size_t pos, size_t num,
+                          int (*cmp_func)(const void *, const void *)) {
+  uint16 item = heap[pos];
+  while (true) {
+    size_t child = 2 * pos + 1;
+    if (child >= num)
+      break;
+    if (child + 1 < num &&
+        lpi_after(lpi_items, heap[child + 1], heap[child], cmp_func))
+      child++;
+    if (!lpi_after(lpi_items, heap[child], item, cmp_func))
+      break;
+    heap[pos] = heap[child];
+    pos = child;
+  }
+  heap[pos] = item;
+}
+
+size_t partial_sort_lpi(LmaPsbItem *lpi_items, size_t lpi_num, size_t sel_num,
+                        int (*cmp_func)(const void *, const void *)) {
+  if (NULL == lpi_items || 0 == sel_num)
+    return 0;
+
+  if (sel_num > kMaxPartialSortNum || sel_num * 2 >= lpi_num ||
+      lpi_num > 0xffff) {
+    myqsort(lpi_items, lpi_num, sizeof(LmaPsbItem), cmp_func);
+    return lpi_num;
+  }
+
+  // 1. Select the positions of the first sel_num items with a heap.
+  uint16 heap[kMaxPartialSortNum];
+  for (size_t pos = 0; pos < sel_num; pos++)
+    heap[pos] = static_cast<uint16>(pos);
+  for (size_t pos = sel_num / 2; pos > 0; pos--)
+    sift_down_lpi(lpi_items, heap, pos - 1, sel_num, cmp_func);
+  for (size_t pos = sel_num; pos < lpi_num; pos++) {
+    if (lpi_after(lpi_items, heap[0], static_cast<uint16>(pos), cmp_func)) {
+      heap[0] = static_cast<uint16>(pos);
+      sift_down_lpi(lpi_items, heap, 0, sel_num, cmp_func);
+    }
+  }
+
+  // 2. Sort the selected positions in their final order, and save the items.
+  for (size_t num = sel_num; num > 1; num--) {
+    uint16 tmp = heap[0];
+    heap[0] = heap[num - 1];
+    heap[num - 1] = tmp;
+    sift_down_lpi(lpi_items, heap, 0, num - 1, cmp_func);
+  }
+  LmaPsbItem sel_items[kMaxPartialSortNum];
+  for (size_t pos = 0; pos < sel_num; pos++)
+    sel_items[pos] = lpi_items[heap[pos]];
+
+  // 3. Move the other items to the end, keeping their order.
+  myqsort(heap, sel_num, sizeof(uint16), cmp_uint16);
+  size_t sel_pos = sel_num;
+  size_t dst = lpi_num;
+  for (size_t pos = lpi_num; pos > 0; pos--) {
+    if (sel_pos > 0 && heap[sel_pos - 1] == pos - 1) {
+      sel_pos--;
+      continue;
+    }
+    dst--;
+    if (dst != pos - 1)
+      lpi_items[dst] = lpi_items[pos - 1];
+  }
+
+  for (size_t pos = 0; pos < sel_num; pos++)
+    lpi_items[pos] = sel_items[pos];
+  return sel_num;
+}
+
+// Number of slots of the hash sets used to remove duplicated predictions. It
+// must be a power of 2, and the sets are only used when they are at most half
+// full.
+static const size_t kNpreHashSlots = 4096;
+
+// Look up the Hanzi string of item in the hash set. If it is found, return
+// the slot which stores its position + 1; otherwise return the empty slot
+// where the position should be put.
+static uint16* find_npre_slot(uint16 *slots, const NPredictItem *npre_items,
+                              const NPredictItem *item) {
+  size_t slot = utf16_strhash(item->pre_hzs, kMaxPredictSize) &
+      (kNpreHashSlots - 1);
+  while (0 != slots[slot]) {
+    if (utf16_strncmp(npre_items[slots[slot] - 1].pre_hzs, item->pre_hzs,
+                      kMaxPredictSize) == 0)
+      break;
+    slot = (slot + 1) & (kNpreHashSlots - 1);
+  }
+  return slots + slot;
+}
+
+size_t remove_b4_used_npre(NPredictItem *npre_items, size_t npre_num,
+                           size_t b4_used) {
+  if (0 == b4_used)
+    return npre_num;
+
+  NPredictItem *b4_items = npre_items - b4_used;
+  size_t new_num = 0;
+
+  if (b4_used > kNpreHashSlots / 2) {
+    for (size_t i = 0; i < npre_num; i++) {
+      size_t e_pos;
+      for (e_pos = 0; e_pos < b4_used; e_pos++) {
+        if (utf16_strncmp(b4_items[e_pos].pre_hzs, npre_items[i].pre_hzs,
+                          kMaxPredictSize) == 0)
+          break;
+      }
+      if (e_pos < b4_used)
+        continue;
+      npre_items[new_num] = npre_items[i];
+      new_num++;
+    }
+    return new_num;
+  }
+
+  uint16 slots[kNpreHashSlots];
+  memset(slots, 0, sizeof(slots));
+  for (size_t pos = 0; pos < b4_used; pos++) {
+    uint16 *slot = find_npre_slot(slots, b4_items, b4_items + pos);
+    if (0 == *slot)
+      *slot = static_cast<uint16>(pos + 1);
+  }
+
+  for (size_t i = 0; i < npre_num; i++) {
+    if (0 != *find_npre_slot(slots, b4_items, npre_items + i))
+      continue;
+    npre_items[new_num] = npre_items[i];
+    new_num++;
+  }
+  return new_num;
+}
+
+static int cmp_npre_for_top(const NPredictItem *p1, const NPredictItem *p2,
+                            bool by_hislen) {
+  int ret_v = by_hislen ? cmp_npre_by_hislen_score(p1, p2) :
+      cmp_npre_by_score(p1, p2);
+  if (0 != ret_v)
+    return ret_v;
+  return utf16_strncmp(p1->pre_hzs, p2->pre_hzs, kMaxPredictSize);
+}
+
+// Sift down in a heap whose top is the worst item.
+static void sift_down_npre(NPredictItem *npre_items, size_t pos, size_t num,
+                           bool by_hislen) {
+  NPredictItem item = npre_items[pos];
+  while (true) {
+    size_t child = 2 * pos + 1;
+    if (child >= num)
+      break;
+    if (child + 1 < num &&
+        cmp_npre_for_top(npre_items + child + 1, npre_items + child,
+                         by_hislen) > 0)
+      child++;
+    if (cmp_npre_for_top(npre_items + child, &item, by_hislen) <= 0)
+      break;
+    npre_items[pos] = npre_items[child];
+    pos = child;
+  }
+  npre_items[pos] = item;
+}
+
+size_t select_top_npre(NPredictItem *npre_items, size_t npre_num,
+                       size_t top_k, bool by_hislen) {
+  if (NULL == npre_items || 0 == npre_num || 0 == top_k)
+    return 0;
+
+  size_t remain_num;
+  if (npre_num > kNpreHashSlots / 2) {
+    remain_num = remove_duplicate_npre(npre_items, npre_num);
+  } else {
+    uint16 slots[kNpreHashSlots];
+    memset(slots, 0, sizeof(slots));
+    remain_num = 0;
+    for (size_t pos = 0; pos < npre_num; pos++) {
+      uint16 *slot = find_npre_slot(slots, npre_items, npre_items + pos);
+      if (0 == *slot) {
+        if (remain_num != pos)
+          npre_items[remain_num] = npre_items[pos];
+        remain_num++;
+        *slot = static_cast<uint16>(remain_num);
+      } else if (npre_items[pos].psb < npre_items[*slot - 1].psb) {
+        npre_items[*slot - 1] = npre_items[pos];
+      }
+    }
+  }
+
+  if (top_k > remain_num)
+    top_k = remain_num;
+
+  // Items from the prediction index are in order already.
+  size_t sorted_num = 1;
+  while (sorted_num < remain_num &&
+         cmp_npre_for_top(npre_items + sorted_num - 1,
+                          npre_items + sorted_num, by_hislen) <= 0)
+    sorted_num++;
+  if (sorted_num == remain_num)
+    return top_k;
+
+  // Keep the best top_k items in a heap whose top is the worst one.
+  for (size_t pos = top_k / 2; pos > 0; pos--)
+    sift_down_npre(npre_items, pos - 1, top_k, by_hislen);
+  for (size_t pos = top_k; pos < remain_num; pos++) {
+    if (cmp_npre_for_top(npre_items + pos, npre_items, by_hislen) < 0) {
+      npre_items[0] = npre_items[pos];
+      sift_down_npre(npre_items, 0, top_k, by_hislen);
+    }
+  }
+
+  // Heap sort, the worst item is moved to the end in each round.
+  for (size_t num = top_k; num > 1; num--) {
+    NPredictItem item = npre_items[0];
+    npre_items[0] = npre_items[num - 1];
+    npre_items[num - 1] = item;
+    sift_down_npre(npre_items, 0, num - 1, by_hislen);
+  }
+  return top_k;
+}
+
 size_t align_to_size_t(size_t size) {
   size_t s = sizeof(size_t);
   return (size + s -1) / s * s;
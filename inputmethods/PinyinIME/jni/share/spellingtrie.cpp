@@ -63,7 +63,15 @@ SpellingTrie::SpellingTrie() {
   splitter_node_ = NULL;
   instance_ = NULL;
   ym_buf_ = NULL;
+  ym_size_ = 0;
+  ym_num_ = 0;
   f2h_ = NULL;
+  dfa_next_ = NULL;
+  dfa_splid_ = NULL;
+  dfa_state_num_ = 0;
+  fuzzy_flags_ = 0;
+  id_ranges_ = NULL;
+  id_range_num_ = NULL;
 
   szm_enable_shm(true);
   szm_enable_ym(true);
@@ -109,6 +117,18 @@ SpellingTrie::~SpellingTrie() {
 
   if (NULL != f2h_)
     delete [] f2h_;
+
+  if (NULL != dfa_next_)
+    delete [] dfa_next_;
+
+  if (NULL != dfa_splid_)
+    delete [] dfa_splid_;
+
+  if (NULL != id_ranges_)
+    delete [] id_ranges_;
+
+  if (NULL != id_range_num_)
+    delete [] id_range_num_;
 }
 
 bool SpellingTrie::if_valid_id_update(uint16 *splid) const {
@@ -257,6 +277,226 @@ uint16 SpellingTrie::full_to_half(uint16 full_id) const {
   return f2h_[full_id - kFullSplIdStart];
 }
 
+size_t SpellingTrie::count_nodes(const SpellingNode *node) {
+  size_t num = 1;
+  for (size_t pos = 0; pos < node->num_of_son; pos++)
+    num += count_nodes(node->first_son + pos);
+  return num;
+}
+
+uint16 SpellingTrie::fill_dfa(const SpellingNode *node, uint16 &next_state) {
+  uint16 state = next_state++;
+  dfa_splid_[state] = node->spelling_idx;
+
+  for (size_t pos = 0; pos < node->num_of_son; pos++) {
+    const SpellingNode *son = node->first_son + pos;
+    uint16 son_state = fill_dfa(son, next_state);
+    // If two sons only differ in case, the first one is used, as the parser
+    // used to scan them in order.
+    size_t ch_pos = (son->char_this_node & ~0x20) - 'A';
+    assert(ch_pos < kValidSplCharNum);
+    if (0 == dfa_next_[state * kValidSplCharNum + ch_pos])
+      dfa_next_[state * kValidSplCharNum + ch_pos] = son_state;
+  }
+  return state;
+}
+
+bool SpellingTrie::build_dfa() {
+  if (NULL != dfa_next_)
+    delete [] dfa_next_;
+  if (NULL != dfa_splid_)
+    delete [] dfa_splid_;
+  dfa_next_ = NULL;
+  dfa_splid_ = NULL;
+
+  dfa_state_num_ = count_nodes(root_);
+  if (dfa_state_num_ > 0xffff)
+    return false;
+
+  dfa_next_ = new uint16[dfa_state_num_ * kValidSplCharNum];
+  dfa_splid_ = new uint16[dfa_state_num_];
+  if (NULL == dfa_next_ || NULL == dfa_splid_)
+    return false;
+  memset(dfa_next_, 0, sizeof(uint16) * dfa_state_num_ * kValidSplCharNum);
+
+  uint16 next_state = 0;
+  fill_dfa(root_, next_state);
+  assert(next_state == dfa_state_num_);
+  return true;
+}
+
+uint16 SpellingTrie::get_full_id(const char *spl_str) const {
+  // The spellings are sorted.
+  size_t begin = 0;
+  size_t end = spelling_num_;
+  while (begin < end) {
+    size_t middle = (begin + end) / 2;
+    int cmp = strcmp(spelling_buf_ + middle * spelling_size_, spl_str);
+    if (0 == cmp)
+      return static_cast<uint16>(middle + kFullSplIdStart);
+    if (cmp < 0)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+  return 0;
+}
+
+void SpellingTrie::mark_fuzzy_ids(uint16 full_id, uint32 *id_bits) {
+  static const char *kFinalPairs[][2] = {
+    {"ANG", "AN"}, {"AN", "ANG"}, {"ENG", "EN"}, {"EN", "ENG"},
+    {"ING", "IN"}, {"IN", "ING"}
+  };
+  static const uint32 kFinalFlags[] = {
+    kFuzzyAnAng, kFuzzyAnAng, kFuzzyEnEng, kFuzzyEnEng,
+    kFuzzyInIng, kFuzzyInIng
+  };
+
+  const char *spl_str = spelling_buf_ +
+      (full_id - kFullSplIdStart) * spelling_size_;
+
+  // The spelling itself, and the one with the other initial.
+  char spl_strs[2][kMaxPinyinSize + 3];
+  size_t spl_num = 1;
+  snprintf(spl_strs[0], sizeof(spl_strs[0]), "%s", spl_str);
+
+  char ch = spl_str[0];
+  bool has_h = 'h' == spl_str[1];
+  if ((('Z' == ch && 0 != (fuzzy_flags_ & kFuzzyZZh)) ||
+       ('C' == ch && 0 != (fuzzy_flags_ & kFuzzyCCh)) ||
+       ('S' == ch && 0 != (fuzzy_flags_ & kFuzzySSh)))) {
+    if (has_h)
+      snprintf(spl_strs[1], sizeof(spl_strs[1]), "%c%s", ch, spl_str + 2);
+    else
+      snprintf(spl_strs[1], sizeof(spl_strs[1]), "%ch%s", ch, spl_str + 1);
+    spl_num++;
+  } else if (('N' == ch || 'L' == ch) && 0 != (fuzzy_flags_ & kFuzzyNL)) {
+    snprintf(spl_strs[1], sizeof(spl_strs[1]), "%c%s", 'N' == ch ? 'L' : 'N',
+             spl_str + 1);
+    spl_num++;
+  }
+
+  for (size_t spl_pos = 0; spl_pos < spl_num; spl_pos++) {
+    char *str = spl_strs[spl_pos];
+    uint16 id = get_full_id(str);
+    if (0 != id)
+      id_bits[id >> 5] |= static_cast<uint32>(1) << (id & 0x1f);
+
+    // Change the final.
+    size_t len = strlen(str);
+    for (size_t pair = 0; pair < sizeof(kFinalFlags) / sizeof(uint32);
+         pair++) {
+      size_t from_len = strlen(kFinalPairs[pair][0]);
+      if (0 == (fuzzy_flags_ & kFinalFlags[pair]) || len < from_len ||
+          0 != strcmp(str + len - from_len, kFinalPairs[pair][0]))
+        continue;
+
+      char fuzzy_str[kMaxPinyinSize + 3];
+      snprintf(fuzzy_str, sizeof(fuzzy_str), "%.*s%s",
+               static_cast<int>(len - from_len), str, kFinalPairs[pair][1]);
+      id = get_full_id(fuzzy_str);
+      if (0 != id)
+        id_bits[id >> 5] |= static_cast<uint32>(1) << (id & 0x1f);
+      break;
+    }
+  }
+}
+
+bool SpellingTrie::build_id_ranges() {
+  if (NULL != id_ranges_)
+    delete [] id_ranges_;
+  if (NULL != id_range_num_)
+    delete [] id_range_num_;
+  id_ranges_ = NULL;
+  id_range_num_ = NULL;
+
+  size_t id_num = kFullSplIdStart + spelling_num_;
+  if (id_num > kFullSplIdStart + kMaxSpellingNum)
+    return false;
+
+  id_ranges_ = new SplIdRange[id_num * kMaxIdRangeNum];
+  id_range_num_ = new uint16[id_num];
+  if (NULL == id_ranges_ || NULL == id_range_num_)
+    return false;
+
+  const size_t kBitsLen = (kFullSplIdStart + kMaxSpellingNum + 31) / 32;
+  uint32 id_bits[kBitsLen];
+  for (uint16 splid = 0; splid < id_num; splid++) {
+    memset(id_bits, 0, sizeof(id_bits));
+
+    if (splid >= kFullSplIdStart) {
+      mark_fuzzy_ids(splid, id_bits);
+    } else if (splid > 0) {
+      // A half id stands for its full ids, and those of the half id paired
+      // with it. Half ids Z/C/S already stand for Zh/Ch/Sh.
+      char ch = kHalfId2Sc_[splid];
+      char pair_ch = '\0';
+      if (('z' == ch && 0 != (fuzzy_flags_ & kFuzzyZZh)) ||
+          ('c' == ch && 0 != (fuzzy_flags_ & kFuzzyCCh)) ||
+          ('s' == ch && 0 != (fuzzy_flags_ & kFuzzySSh)))
+        pair_ch = ch & ~0x20;
+      else if (('N' == ch || 'L' == ch) && 0 != (fuzzy_flags_ & kFuzzyNL))
+        pair_ch = 'N' == ch ? 'L' : 'N';
+
+      for (uint16 half_id = 1; half_id < kFullSplIdStart; half_id++) {
+        if (half_id != splid && (0 == pair_ch ||
+                                 kHalfId2Sc_[half_id] != pair_ch))
+          continue;
+        for (uint16 id = h2f_start_[half_id];
+             id < h2f_start_[half_id] + h2f_num_[half_id]; id++)
+          id_bits[id >> 5] |= static_cast<uint32>(1) << (id & 0x1f);
+      }
+    }
+
+    // Turn the bits into ranges.
+    SplIdRange *ranges = id_ranges_ + splid * kMaxIdRangeNum;
+    uint16 range_num = 0;
+    for (uint16 id = kFullSplIdStart; id < id_num; id++) {
+      if (0 == (id_bits[id >> 5] & (static_cast<uint32>(1) << (id & 0x1f))))
+        continue;
+      if (range_num > 0 &&
+          ranges[range_num - 1].start + ranges[range_num - 1].num == id) {
+        ranges[range_num - 1].num++;
+        continue;
+      }
+      if (range_num >= kMaxIdRangeNum)
+        return false;
+      ranges[range_num].start = id;
+      ranges[range_num].num = 1;
+      range_num++;
+    }
+    id_range_num_[splid] = range_num;
+  }
+
+  return true;
+}
+
+bool SpellingTrie::set_fuzzy(uint32 fuzzy_flags) {
+  if (NULL == root_)
+    return false;
+
+  fuzzy_flags_ = fuzzy_flags;
+  return build_id_ranges();
+}
+
+bool SpellingTrie::id_covers(uint16 splid, uint16 full_id) const {
+  if (NULL == id_range_num_ || splid >= kFullSplIdStart + spelling_num_)
+    return false;
+
+  const SplIdRange *ranges;
+  uint16 range_num = get_id_ranges(splid, &ranges);
+  return in_id_ranges(full_id, ranges, range_num);
+}
+
+bool SpellingTrie::is_fuzzy_id(uint16 splid) const {
+  if (!is_full_id(splid))
+    return false;
+
+  const SplIdRange *ranges;
+  uint16 range_num = get_id_ranges(splid, &ranges);
+  return range_num > 1 || ranges[0].num > 1;
+}
+
 void SpellingTrie::free_son_trie(SpellingNode* node) {
   if (NULL == node)
     return;
@@ -341,6 +581,12 @@ bool SpellingTrie::construct(const char* spelling_arr, size_t item_size,
   if (!build_f2h())
     return false;
 
+  if (!build_dfa())
+    return false;
+
+  if (!build_id_ranges())
+    return false;
+
 #ifdef ___BUILD_MODEL___
   if (kPrintDebug0) {
     printf("---SpellingTrie Nodes: %d\n", node_num_);
@@ -640,10 +886,11 @@ bool SpellingTrie::save_spl_trie(FILE *fp) {
   if (NULL == fp || NULL == spelling_buf_)
     return false;
 
-  if (fwrite(&spelling_size_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fwrite(&spelling_num_, sizeof(size_t), 1, fp) != 1)
+  // Written as uint32, which is what size_t is on the devices.
+  uint32 sizes[2];
+  sizes[0] = static_cast<uint32>(spelling_size_);
+  sizes[1] = static_cast<uint32>(spelling_num_);
+  if (fwrite(sizes, sizeof(uint32), 2, fp) != 2)
     return false;
 
   if (fwrite(&score_amplifier_, sizeof(float), 1, fp) != 1)
@@ -663,11 +910,11 @@ bool SpellingTrie::load_spl_trie(FILE *fp) {
   if (NULL == fp)
     return false;
 
-  if (fread(&spelling_size_, sizeof(size_t), 1, fp) != 1)
-    return false;
-
-  if (fread(&spelling_num_, sizeof(size_t), 1, fp) != 1)
+  uint32 sizes[2];
+  if (fread(sizes, sizeof(uint32), 2, fp) != 2)
     return false;
+  spelling_size_ = sizes[0];
+  spelling_num_ = sizes[1];
 
   if (fread(&score_amplifier_, sizeof(float), 1, fp) != 1)
     return false;
@@ -710,6 +957,26 @@ size_t SpellingTrie::get_spelling_num() {
   return spelling_num_;
 }
 
+size_t SpellingTrie::get_mem_size() {
+  size_t size = sizeof(SpellingTrie);
+  if (NULL == root_)
+    return size;
+
+  size += spelling_size_ * spelling_num_ +          // spelling_buf_
+          (spelling_num_ + kFullSplIdStart) +      // spl_ym_ids_
+          ym_size_ * ym_num_ +                     // ym_buf_
+          spelling_size_ * (1 + sizeof(char16)) +  // splstr*_queried_
+          sizeof(uint16) * spelling_num_;          // f2h_
+  // The nodes of the trie, and the transition table compiled from them.
+  size += dfa_state_num_ *
+          (sizeof(SpellingNode) + sizeof(uint16) * (kValidSplCharNum + 1));
+  if (NULL != id_ranges_) {
+    size_t id_num = kFullSplIdStart + spelling_num_;
+    size += id_num * (sizeof(SplIdRange) * kMaxIdRangeNum + sizeof(uint16));
+  }
+  return size;
+}
+
 uint8 SpellingTrie::get_ym_id(const char *ym_str) {
   if (NULL == ym_str || NULL == ym_buf_)
     return 0;
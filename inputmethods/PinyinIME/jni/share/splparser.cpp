@@ -38,7 +38,8 @@ uint16 SpellingParser::splstr_to_idxs(const char *splstr, uint16 str_len,
 
   last_is_pre = false;
 
-  const SpellingNode *node_this = spl_trie_->root_;
+  // The state in the compiled spelling trie, 0 is the root.
+  uint16 state = 0;
 
   uint16 str_pos = 0;
   uint16 idx_num = 0;
@@ -50,8 +51,8 @@ uint16 SpellingParser::splstr_to_idxs(const char *splstr, uint16 str_len,
     char char_this = splstr[str_pos];
     // all characters outside of [a, z] are considered as splitters
     if (!SpellingTrie::is_valid_spl_char(char_this)) {
-      // test if the current node is endable
-      uint16 id_this = node_this->spelling_idx;
+      // test if the current state is endable
+      uint16 id_this = spl_trie_->dfa_splid(state);
       if (spl_trie_->if_valid_id_update(&id_this)) {
         spl_idx[idx_num] = id_this;
 
@@ -62,7 +63,7 @@ uint16 SpellingParser::splstr_to_idxs(const char *splstr, uint16 str_len,
         if (idx_num >= max_size)
           return idx_num;
 
-        node_this = spl_trie_->root_;
+        state = 0;
         last_is_splitter = true;
         continue;
       } else {
@@ -79,33 +80,14 @@ uint16 SpellingParser::splstr_to_idxs(const char *splstr, uint16 str_len,
 
     last_is_splitter = false;
 
-    SpellingNode *found_son = NULL;
+    uint16 next_state = spl_trie_->dfa_next(state, char_this);
 
-    if (0 == str_pos) {
-      if (char_this >= 'a')
-        found_son = spl_trie_->level1_sons_[char_this - 'a'];
-      else
-        found_son = spl_trie_->level1_sons_[char_this - 'A'];
-    } else {
-      SpellingNode *first_son = node_this->first_son;
-      // Because for Zh/Ch/Sh nodes, they are the last in the buffer and
-      // frequently used, so we scan from the end.
-      for (int i = 0; i < node_this->num_of_son; i++) {
-        SpellingNode *this_son = first_son + i;
-        if (SpellingTrie::is_same_spl_char(
-            this_son->char_this_node, char_this)) {
-          found_son = this_son;
-          break;
-        }
-      }
-    }
-
-    // found, just move the current node pointer to the the son
-    if (NULL != found_son) {
-      node_this = found_son;
+    // found, just move to the next state
+    if (0 != next_state) {
+      state = next_state;
     } else {
       // not found, test if it is endable
-      uint16 id_this = node_this->spelling_idx;
+      uint16 id_this = spl_trie_->dfa_splid(state);
       if (spl_trie_->if_valid_id_update(&id_this)) {
         // endable, remember the index
         spl_idx[idx_num] = id_this;
@@ -115,7 +97,7 @@ uint16 SpellingParser::splstr_to_idxs(const char *splstr, uint16 str_len,
           start_pos[idx_num] = str_pos;
         if (idx_num >= max_size)
           return idx_num;
-        node_this = spl_trie_->root_;
+        state = 0;
         continue;
       } else {
         return idx_num;
@@ -125,7 +107,7 @@ uint16 SpellingParser::splstr_to_idxs(const char *splstr, uint16 str_len,
     str_pos++;
   }
 
-  uint16 id_this = node_this->spelling_idx;
+  uint16 id_this = spl_trie_->dfa_splid(state);
   if (spl_trie_->if_valid_id_update(&id_this)) {
     // endable, remember the index
     spl_idx[idx_num] = id_this;
@@ -167,7 +149,8 @@ uint16 SpellingParser::splstr16_to_idxs(const char16 *splstr, uint16 str_len,
 
   last_is_pre = false;
 
-  const SpellingNode *node_this = spl_trie_->root_;
+  // The state in the compiled spelling trie, 0 is the root.
+  uint16 state = 0;
 
   uint16 str_pos = 0;
   uint16 idx_num = 0;
@@ -179,8 +162,8 @@ uint16 SpellingParser::splstr16_to_idxs(const char16 *splstr, uint16 str_len,
     char16 char_this = splstr[str_pos];
     // all characters outside of [a, z] are considered as splitters
     if (!SpellingTrie::is_valid_spl_char(char_this)) {
-      // test if the current node is endable
-      uint16 id_this = node_this->spelling_idx;
+      // test if the current state is endable
+      uint16 id_this = spl_trie_->dfa_splid(state);
       if (spl_trie_->if_valid_id_update(&id_this)) {
         spl_idx[idx_num] = id_this;
 
@@ -191,7 +174,7 @@ uint16 SpellingParser::splstr16_to_idxs(const char16 *splstr, uint16 str_len,
         if (idx_num >= max_size)
           return idx_num;
 
-        node_this = spl_trie_->root_;
+        state = 0;
         last_is_splitter = true;
         continue;
       } else {
@@ -208,33 +191,15 @@ uint16 SpellingParser::splstr16_to_idxs(const char16 *splstr, uint16 str_len,
 
     last_is_splitter = false;
 
-    SpellingNode *found_son = NULL;
-
-    if (0 == str_pos) {
-      if (char_this >= 'a')
-        found_son = spl_trie_->level1_sons_[char_this - 'a'];
-      else
-        found_son = spl_trie_->level1_sons_[char_this - 'A'];
-    } else {
-      SpellingNode *first_son = node_this->first_son;
-      // Because for Zh/Ch/Sh nodes, they are the last in the buffer and
-      // frequently used, so we scan from the end.
-      for (int i = 0; i < node_this->num_of_son; i++) {
-        SpellingNode *this_son = first_son + i;
-        if (SpellingTrie::is_same_spl_char(
-            this_son->char_this_node, char_this)) {
-          found_son = this_son;
-          break;
-        }
-      }
-    }
+    uint16 next_state = spl_trie_->dfa_next(state,
+                                              static_cast<char>(char_this));
 
-    // found, just move the current node pointer to the the son
-    if (NULL != found_son) {
-      node_this = found_son;
+    // found, just move to the next state
+    if (0 != next_state) {
+      state = next_state;
     } else {
       // not found, test if it is endable
-      uint16 id_this = node_this->spelling_idx;
+      uint16 id_this = spl_trie_->dfa_splid(state);
       if (spl_trie_->if_valid_id_update(&id_this)) {
         // endable, remember the index
         spl_idx[idx_num] = id_this;
@@ -244,7 +209,7 @@ uint16 SpellingParser::splstr16_to_idxs(const char16 *splstr, uint16 str_len,
           start_pos[idx_num] = str_pos;
         if (idx_num >= max_size)
           return idx_num;
-        node_this = spl_trie_->root_;
+        state = 0;
         continue;
       } else {
         return idx_num;
@@ -254,7 +219,7 @@ uint16 SpellingParser::splstr16_to_idxs(const char16 *splstr, uint16 str_len,
     str_pos++;
   }
 
-  uint16 id_this = node_this->spelling_idx;
+  uint16 id_this = spl_trie_->dfa_splid(state);
   if (spl_trie_->if_valid_id_update(&id_this)) {
     // endable, remember the index
     spl_idx[idx_num] = id_this;
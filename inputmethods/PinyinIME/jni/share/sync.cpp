@@ -24,8 +24,7 @@ namespace ime_pinyin {
 
 Sync::Sync()
   : userdict_(NULL),
-    dictfile_(NULL),
-    last_count_(0) {
+    dictfile_(NULL) {
 };
 
 Sync::~Sync() {
@@ -72,11 +71,25 @@ int Sync::put_lemmas(char16 * lemmas, int len) {
 }
 
 int Sync::get_lemmas(char16 * str, int size) {
-  return userdict_->get_sync_lemmas_in_utf16le_string_from_beginning(str, size, &last_count_);
+  int count;
+  return userdict_->get_sync_lemmas_in_utf16le_string_from_beginning(str, size, &count);
+}
+
+int Sync::put_lemmas_chunk(const uint8 * chunk, int size) {
+  int added;
+  return userdict_->put_lemmas_no_sync_from_chunk(chunk, size, &added);
+}
+
+uint32 Sync::get_lemmas_chunk(uint32 token, uint8 * chunk, int size) {
+  int count;
+  userdict_->get_sync_lemmas_in_chunk(&token, chunk, size, &count);
+  return token;
 }
 
 int Sync::get_last_got_count() {
-  return last_count_;
+  if (NULL == userdict_)
+    return 0;
+  return userdict_->get_sync_got_count();
 }
 
 int Sync::get_total_count() {
@@ -84,11 +97,9 @@ int Sync::get_total_count() {
 }
 
 void Sync::clear_last_got() {
-  if (last_count_ < 0) {
+  if (NULL == userdict_)
     return;
-  }
-  userdict_->clear_sync_lemmas(0, last_count_);
-  last_count_ = 0;
+  userdict_->clear_sync_got_lemmas();
 }
 
 void Sync::finish() {
@@ -98,7 +109,6 @@ void Sync::finish() {
     userdict_ = NULL;
     free(dictfile_);
     dictfile_ = NULL;
-    last_count_ = 0;
   }
 }
 
@@ -17,6 +17,7 @@
 #include "../include/userdict.h"
 #include "../include/splparser.h"
 #include "../include/ngram.h"
+#include "../include/lpicache.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -31,6 +32,11 @@
 #include <time.h>
 #include <pthread.h>
 #include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 namespace ime_pinyin {
 
@@ -201,6 +207,25 @@ inline uint16 * UserDict::get_lemma_word(uint32 offset) {
   return (uint16 *)(lemmas_ + offset + 2 + (nchar << 1));
 }
 
+inline void UserDict::defrag_note_removal(uint32 offset) {
+  offset &= kUserDictOffsetMask;
+  if (defrag_running_ && offset < defrag_dst_ && offset < defrag_hole_)
+    defrag_hole_ = offset;
+}
+
+inline uint32 UserDict::list_item_of(LemmaIdType id) {
+  if (defrag_running_)
+    return id - start_id_;
+  return offsets_by_id_[id - start_id_];
+}
+
+inline uint32 UserDict::list_item_offset(uint32 item) {
+  if (defrag_running_)
+    return offsets_by_id_[item & kUserDictOffsetMask] |
+        (item & kUserDictOffsetFlagRemove);
+  return item;
+}
+
 inline LemmaIdType UserDict::get_max_lemma_id() {
   // When a lemma is deleted, we don't not claim its id back for
   // simplicity and performance
@@ -219,12 +244,27 @@ inline bool UserDict::is_valid_state() {
   return true;
 }
 
+inline void UserDict::invalidate_lpi_user() {
+  if (lpi_cache_notify_)
+    LpiCache::invalidate_user();
+}
+
+inline void UserDict::invalidate_lpi_lemma(const uint16 *splids,
+                                           uint16 lemma_len) {
+  if (lpi_cache_notify_)
+    LpiCache::invalidate_lemma(splids, lemma_len);
+}
+
+inline void UserDict::invalidate_lpi_all() {
+  if (lpi_cache_notify_)
+    LpiCache::invalidate_all();
+}
+
 UserDict::UserDict()
     : start_id_(0),
       version_(0),
       lemmas_(NULL),
-      offsets_(NULL),
-      scores_(NULL),
+      slots_(NULL),
       ids_(NULL),
 #ifdef ___PREDICT_ENABLED___
       predicts_(NULL),
@@ -232,11 +272,27 @@ UserDict::UserDict()
 #ifdef ___SYNC_ENABLED___
       syncs_(NULL),
       sync_count_size_(0),
+      sync_got_(0),
+      sync_pull_(0),
 #endif
       offsets_by_id_(NULL),
+      offset_indexes_by_id_(NULL),
+      locates_(NULL),
+      locate_size_(0),
+      locate_tombstones_(0),
+      defrag_running_(false),
+      defrag_dst_(0),
+      defrag_src_(0),
+      defrag_hole_(kUserDictDefragNoHole),
+      defrag_gap_(0),
+      defrag_gap_end_(0),
       lemma_count_left_(0),
       lemma_size_left_(0),
+      lemma_size_loaded_(0),
       dict_file_(NULL),
+      read_only_(false),
+      lpi_cache_notify_(true),
+      prealloc_(kUserDictPreAlloc),
       state_(USER_DICT_NONE) {
   memset(&dict_info_, 0, sizeof(dict_info_));
   memset(&load_time_, 0, sizeof(load_time_));
@@ -270,6 +326,7 @@ bool UserDict::load_dict(const char *file_name, LemmaIdType start_id,
   state_ = USER_DICT_SYNC;
 
   gettimeofday(&load_time_, NULL);
+  invalidate_lpi_all();
 
 #ifdef ___DEBUG_PERF___
   DEBUG_PERF_END;
@@ -304,13 +361,17 @@ bool UserDict::close_dict() {
  out:
   free((void*)dict_file_);
   free(lemmas_);
-  free(offsets_);
+  free(slots_);
   free(offsets_by_id_);
-  free(scores_);
+  free(offset_indexes_by_id_);
+  free(locates_);
   free(ids_);
 #ifdef ___PREDICT_ENABLED___
   free(predicts_);
 #endif
+#ifdef ___SYNC_ENABLED___
+  free(syncs_);
+#endif
 
   version_ = 0;
   dict_file_ = NULL;
@@ -318,10 +379,20 @@ bool UserDict::close_dict() {
 #ifdef ___SYNC_ENABLED___
   syncs_ = NULL;
   sync_count_size_ = 0;
+  // Tokens of a pull before closing must not continue from the new list
+  sync_got_ = 0;
+  sync_pull_++;
 #endif
-  offsets_ = NULL;
+  slots_ = NULL;
   offsets_by_id_ = NULL;
-  scores_ = NULL;
+  offset_indexes_by_id_ = NULL;
+  locates_ = NULL;
+  locate_size_ = 0;
+  locate_tombstones_ = 0;
+  defrag_running_ = false;
+  defrag_hole_ = kUserDictDefragNoHole;
+  defrag_gap_ = 0;
+  defrag_gap_end_ = 0;
   ids_ = NULL;
 #ifdef ___PREDICT_ENABLED___
   predicts_ = NULL;
@@ -330,6 +401,8 @@ bool UserDict::close_dict() {
   memset(&dict_info_, 0, sizeof(dict_info_));
   lemma_count_left_ = 0;
   lemma_size_left_ = 0;
+  lemma_size_loaded_ = 0;
+  read_only_ = false;
   state_ = USER_DICT_NONE;
 
   return true;
@@ -364,22 +437,112 @@ MileStoneHandle UserDict::extend_dict(MileStoneHandle from_handle,
   return ((*lpi_num > 0 || need_extend) ? 1 : 0);
 }
 
-int UserDict::is_fuzzy_prefix_spell_id(
-    const uint16 * id1, uint16 len1, const UserDictSearchable *searchable) {
-  if (len1 < searchable->splids_len)
+// Test if each id is in its range, [starts[i], starts[i] + lasts[i]]. There
+// are kMaxLemmaSize items in each array, 8 uint16 lanes of a vector, and
+// ids must be 16-byte aligned.
+static inline bool in_single_ranges(const uint16 *ids, const uint16 *starts,
+                                    const uint16 *lasts) {
+#if defined(__SSE2__)
+  __m128i off = _mm_sub_epi16(_mm_load_si128((const __m128i*)ids),
+                              _mm_loadu_si128((const __m128i*)starts));
+  // off <= last if and only if the saturated off - last is 0.
+  __m128i over = _mm_subs_epu16(off, _mm_loadu_si128((const __m128i*)lasts));
+  return 0xffff == _mm_movemask_epi8(_mm_cmpeq_epi16(over,
+                                                     _mm_setzero_si128()));
+#elif defined(__ARM_NEON__)
+  uint16x8_t off = vsubq_u16(vld1q_u16(ids), vld1q_u16(starts));
+  uint8x8_t in = vmovn_u16(vcleq_u16(off, vld1q_u16(lasts)));
+  return ~(uint64)0 == vget_lane_u64(vreinterpret_u64_u8(in), 0);
+#else
+  uint16 out = 0;
+  for (size_t pos = 0; pos < kMaxLemmaSize; pos++)
+    out |= (uint16)(ids[pos] - starts[pos]) > lasts[pos];
+  return 0 == out;
+#endif
+}
+
+// Compare two words of four packed letters by the first different letter,
+// which has the lowest different bit.
+static inline int compare_initial_words(uint32 word, uint32 sig) {
+  if (word == sig)
     return 0;
+  uint32 off = __builtin_ctz(word ^ sig) & ~7u;
+  return ((word >> off) & 0xff) > ((sig >> off) & 0xff) ? 1 : -1;
+}
 
+int UserDict::compare_initials(const uint16 *ids, uint16 from,
+                               const UserDictSearchable *searchable) {
   SpellingTrie &spl_trie = SpellingTrie::get_instance();
-  uint32 i = 0;
-  for (i = 0; i < searchable->splids_len; i++) {
-    const char py1 = *spl_trie.get_spelling_str(id1[i]);
-    uint16 off = 8 * (i % 4);
-    const char py2 = ((searchable->signature[i/4] & (0xff << off)) >> off);
-    if (py1 == py2)
-      continue;
-    return 0;
+  uint16 len = searchable->splids_len;
+  // Pack four letters into a word as in the signature.
+  for (uint16 pos = from; pos < len; pos += 4) {
+    uint16 end = pos + 4 < len ? pos + 4 : len;
+    uint32 word = 0;
+    for (uint16 i = pos; i < end; i++) {
+      word |= (uint32)(unsigned char)spl_trie.get_spelling_initial(ids[i]) <<
+          (8 * (i - pos));
+    }
+    int cmp = compare_initial_words(word, searchable->signature[pos / 4]);
+    if (0 != cmp)
+      return cmp;
+  }
+  return 0;
+}
+
+int UserDict::compare_slot_initials(uint32 index,
+                                    const UserDictSearchable *searchable) {
+  const UserDictSlot *slot = slots_ + index;
+  uint16 len = searchable->splids_len;
+  uint32 word = slot->initials;
+  if (len < kUserDictSlotInitials)
+    word &= (1u << (8 * len)) - 1;
+  int cmp = compare_initial_words(word, searchable->signature[0]);
+  if (0 != cmp || len <= kUserDictSlotInitials)
+    return cmp;
+  return compare_initials(get_lemma_spell_ids(slot->offset),
+                          kUserDictSlotInitials, searchable);
+}
+
+void UserDict::fill_slot(UserDictSlot *slot, uint32 offset) {
+  SpellingTrie &spl_trie = SpellingTrie::get_instance();
+  uint8 nchar = get_lemma_nchar(offset);
+  const uint16 *splids = get_lemma_spell_ids(offset);
+  slot->offset = offset;
+  slot->initials = 0;
+  for (uint16 i = 0; i < nchar && i < kUserDictSlotInitials; i++) {
+    slot->initials |=
+        (uint32)(unsigned char)spl_trie.get_spelling_initial(splids[i]) <<
+        (8 * i);
+  }
+  slot->nchar = nchar;
+  memset(slot->reserved, 0, sizeof(slot->reserved));
+}
+
+bool UserDict::in_id_ranges(const uint16 *fullids,
+                            const UserDictSearchable *searchable) {
+  uint16 len = searchable->splids_len;
+  if (searchable->single_ranges) {
+    // Lemmas are not padded to kMaxLemmaSize ids, copy them.
+    uint16 ids[kMaxLemmaSize] __attribute__((aligned(16)));
+    memcpy(ids, fullids, len << 1);
+    memset(ids + len, 0, (kMaxLemmaSize - len) << 1);
+    return in_single_ranges(ids, searchable->range_starts,
+                            searchable->range_lasts);
+  }
+
+  for (uint16 i = 0; i < len; i++) {
+    if (!SpellingTrie::in_id_ranges(fullids[i], searchable->id_ranges[i],
+                                    searchable->id_range_num[i]))
+      return false;
   }
-  return 1;
+  return true;
+}
+
+int UserDict::is_fuzzy_prefix_spell_id(
+    const uint16 * id1, uint16 len1, const UserDictSearchable *searchable) {
+  if (len1 < searchable->splids_len)
+    return 0;
+  return 0 == compare_initials(id1, 0, searchable) ? 1 : 0;
 }
 
 int UserDict::fuzzy_compare_spell_id(
@@ -388,20 +551,7 @@ int UserDict::fuzzy_compare_spell_id(
     return -1;
   if (len1 > searchable->splids_len)
     return 1;
-
-  SpellingTrie &spl_trie = SpellingTrie::get_instance();
-  uint32 i = 0;
-  for (i = 0; i < len1; i++) {
-    const char py1 = *spl_trie.get_spelling_str(id1[i]);
-    uint16 off = 8 * (i % 4);
-    const char py2 = ((searchable->signature[i/4] & (0xff << off)) >> off);
-    if (py1 == py2)
-      continue;
-    if (py1 > py2)
-      return 1;
-    return -1;
-  }
-  return 0;
+  return compare_initials(id1, 0, searchable);
 }
 
 bool UserDict::is_prefix_spell_id(
@@ -409,17 +559,7 @@ bool UserDict::is_prefix_spell_id(
     const UserDictSearchable *searchable) {
   if (fulllen < searchable->splids_len)
     return false;
-
-  uint32 i = 0;
-  for (; i < searchable->splids_len; i++) {
-    uint16 start_id = searchable->splid_start[i];
-    uint16 count = searchable->splid_count[i];
-    if (fullids[i] >= start_id && fullids[i] < start_id + count)
-      continue;
-    else
-      return false;
-  }
-  return true;
+  return in_id_ranges(fullids, searchable);
 }
 
 bool UserDict::equal_spell_id(
@@ -427,17 +567,7 @@ bool UserDict::equal_spell_id(
     const UserDictSearchable *searchable) {
   if (fulllen != searchable->splids_len)
     return false;
-
-  uint32 i = 0;
-  for (; i < fulllen; i++) {
-    uint16 start_id = searchable->splid_start[i];
-    uint16 count = searchable->splid_count[i];
-    if (fullids[i] >= start_id && fullids[i] < start_id + count)
-      continue;
-    else
-      return false;
-  }
-  return true;
+  return in_id_ranges(fullids, searchable);
 }
 
 int32 UserDict::locate_first_in_offsets(const UserDictSearchable * searchable) {
@@ -450,11 +580,17 @@ int32 UserDict::locate_first_in_offsets(const UserDictSearchable * searchable) {
 
   while (begin <= end) {
     middle = (begin + end) >> 1;
-    uint32 offset = offsets_[middle];
-    uint8 nchar = get_lemma_nchar(offset);
-    const uint16 * splids = get_lemma_spell_ids(offset);
-    int cmp = fuzzy_compare_spell_id(splids, nchar, searchable);
-    int pre = is_fuzzy_prefix_spell_id(splids, nchar, searchable);
+    uint8 nchar = slots_[middle].nchar;
+    // One pass over the initial letters gives both the order and whether
+    // the lemma is a prefix match.
+    int cmp = -1;
+    int pre = 0;
+    if (nchar >= searchable->splids_len) {
+      cmp = compare_slot_initials(middle, searchable);
+      pre = (0 == cmp);
+      if (nchar > searchable->splids_len)
+        cmp = 1;
+    }
 
     if (pre)
       first_prefix = middle;
@@ -478,22 +614,62 @@ void UserDict::prepare_locate(UserDictSearchable *searchable,
   searchable->splids_len = splid_str_len;
   memset(searchable->signature, 0, sizeof(searchable->signature));
 
+  searchable->fuzzy_letters_used = 0;
+
   SpellingTrie &spl_trie = SpellingTrie::get_instance();
   uint32 i = 0;
   for (; i < splid_str_len; i++) {
-    if (spl_trie.is_half_id(splid_str[i])) {
-      searchable->splid_count[i] =
-          spl_trie.half_to_full(splid_str[i],
-                                &(searchable->splid_start[i]));
+    searchable->id_range_num[i] =
+        spl_trie.get_id_ranges(splid_str[i], &(searchable->id_ranges[i]));
+    const unsigned char py = spl_trie.get_spelling_initial(splid_str[i]);
+    searchable->signature[i>>2] |= (py << (8 * (i % 4)));
+
+    searchable->fuzzy_letters[i] = 0;
+    for (uint16 range = 0; range < searchable->id_range_num[i]; range++) {
+      const char fuzzy_py = spl_trie.get_spelling_initial(
+          searchable->id_ranges[i][range].start);
+      if (fuzzy_py != py)
+        searchable->fuzzy_letters[i] = fuzzy_py;
+    }
+  }
+
+  searchable->single_ranges = true;
+  for (i = 0; i < kMaxLemmaSize; i++) {
+    if (i >= splid_str_len) {
+      searchable->range_starts[i] = 0;
+      searchable->range_lasts[i] = 0xffff;
+    } else if (1 == searchable->id_range_num[i] &&
+               0 != searchable->id_ranges[i][0].num) {
+      searchable->range_starts[i] = searchable->id_ranges[i][0].start;
+      searchable->range_lasts[i] = searchable->id_ranges[i][0].num - 1;
     } else {
-      searchable->splid_count[i] = 1;
-      searchable->splid_start[i] = splid_str[i];
+      searchable->single_ranges = false;
+      break;
     }
-    const unsigned char py = *spl_trie.get_spelling_str(splid_str[i]);
-    searchable->signature[i>>2] |= (py << (8 * (i % 4)));
   }
 }
 
+bool UserDict::next_fuzzy_signature(UserDictSearchable *searchable) {
+  // Count in binary over the positions which have fuzzy letters.
+  for (uint32 i = 0; i < searchable->splids_len; i++) {
+    if (0 == searchable->fuzzy_letters[i])
+      continue;
+
+    // Swap the letter in the signature and the fuzzy one.
+    uint16 off = 8 * (i % 4);
+    const unsigned char py =
+        ((searchable->signature[i / 4] & (0xff << off)) >> off);
+    const unsigned char fuzzy_py = searchable->fuzzy_letters[i];
+    searchable->signature[i / 4] ^= ((py ^ fuzzy_py) << off);
+    searchable->fuzzy_letters[i] = py;
+
+    searchable->fuzzy_letters_used ^= 1 << i;
+    if (0 != (searchable->fuzzy_letters_used & (1 << i)))
+      return true;
+  }
+  return false;
+}
+
 size_t UserDict::get_lpis(const uint16 *splid_str, uint16 splid_str_len,
                           LmaPsbItem *lpi_items, size_t lpi_max) {
   return _get_lpis(splid_str, splid_str_len, lpi_items, lpi_max, NULL);
@@ -513,42 +689,48 @@ size_t UserDict::_get_lpis(const uint16 *splid_str,
   if (lpi_max <= 0)
     return 0;
 
-  if (0 == pthread_mutex_trylock(&g_mutex_)) {
-    if (load_time_.tv_sec < g_last_update_.tv_sec ||
-      (load_time_.tv_sec == g_last_update_.tv_sec &&
-       load_time_.tv_usec < g_last_update_.tv_usec)) {
-      // Others updated disk file, have to reload
-      pthread_mutex_unlock(&g_mutex_);
-      flush_cache();
-    } else {
-      pthread_mutex_unlock(&g_mutex_);
-    }
-  } else {
-  }
+  // A copy is reloaded by the thread which owns the dictionary it is made
+  // from.
+  if (!read_only_)
+    reload_if_outdated();
 
   UserDictSearchable searchable;
   prepare_locate(&searchable, splid_str, splid_str_len);
 
+  // With fuzzy Pinyin (n = l), the lemmas may start with other letters,
+  // which are in other places of the list sorted by the initial letters.
+  size_t lpi_current = 0;
+  do {
+    lpi_current += get_lpis_by_signature(&searchable, lpi_items + lpi_current,
+                                         lpi_max - lpi_current, need_extend);
+  } while (lpi_current < lpi_max && next_fuzzy_signature(&searchable));
+
+  return lpi_current;
+}
+
+size_t UserDict::get_lpis_by_signature(UserDictSearchable *searchable,
+                                       LmaPsbItem *lpi_items, size_t lpi_max,
+                                       bool *need_extend) {
   uint32 max_off = dict_info_.lemma_count;
 #ifdef ___CACHE_ENABLED___
   int32 middle;
   uint32 start, count;
-  bool cached = cache_hit(&searchable, &start, &count);
+  bool cached = cache_hit(searchable, &start, &count);
   if (cached) {
     middle = start;
     max_off = start + count;
   } else {
-    middle = locate_first_in_offsets(&searchable);
+    middle = locate_first_in_offsets(searchable);
     start = middle;
   }
 #else
-  int32 middle = locate_first_in_offsets(&searchable);
+  int32 middle = locate_first_in_offsets(searchable);
 #endif
 
   if (middle == -1) {
 #ifdef ___CACHE_ENABLED___
     if (!cached)
-      cache_push(USER_DICT_MISS_CACHE, &searchable, 0, 0);
+      cache_push(USER_DICT_MISS_CACHE, searchable, 0, 0);
 #endif
     return 0;
   }
@@ -560,26 +742,30 @@ size_t UserDict::_get_lpis(const uint16 *splid_str,
   while ((size_t)middle < max_off && !fuzzy_break && !prefix_break) {
     if (lpi_current >= lpi_max)
       break;
-    uint32 offset = offsets_[middle];
+    uint32 offset = slots_[middle].offset;
     // Ignore deleted lemmas
     if (offset & kUserDictOffsetFlagRemove) {
       middle++;
       continue;
     }
-    uint8 nchar = get_lemma_nchar(offset);
+    uint8 nchar = slots_[middle].nchar;
     uint16 * splids = get_lemma_spell_ids(offset);
+    // The initial letters decide both the fuzzy match and the fuzzy prefix.
+    int initials = -1;
+    if (nchar >= searchable->splids_len)
+      initials = compare_slot_initials(middle, searchable);
 #ifdef ___CACHE_ENABLED___
-    if (!cached && 0 != fuzzy_compare_spell_id(splids, nchar, &searchable)) {
+    if (!cached && (nchar != searchable->splids_len || 0 != initials)) {
 #else
-    if (0 != fuzzy_compare_spell_id(splids, nchar, &searchable)) {
+    if (nchar != searchable->splids_len || 0 != initials) {
 #endif
       fuzzy_break = true;
     }
 
     if (prefix_break == false) {
-      if (is_fuzzy_prefix_spell_id(splids, nchar, &searchable)) {
+      if (0 == initials) {
         if (*need_extend == false &&
-            is_prefix_spell_id(splids, nchar, &searchable)) {
+            is_prefix_spell_id(splids, nchar, searchable)) {
           *need_extend = true;
         }
       } else {
@@ -587,8 +773,8 @@ size_t UserDict::_get_lpis(const uint16 *splid_str,
       }
     }
 
-    if (equal_spell_id(splids, nchar, &searchable) == true) {
-      lpi_items[lpi_current].psb = translate_score(scores_[middle]);
+    if (equal_spell_id(splids, nchar, searchable) == true) {
+      lpi_items[lpi_current].psb = translate_score(slots_[middle].score);
       lpi_items[lpi_current].id = ids_[middle];
       lpi_items[lpi_current].lma_len = nchar;
       lpi_current++;
@@ -599,7 +785,7 @@ size_t UserDict::_get_lpis(const uint16 *splid_str,
 #ifdef ___CACHE_ENABLED___
   if (!cached) {
     count = middle - start;
-    cache_push(USER_DICT_CACHE, &searchable, start, count);
+    cache_push(USER_DICT_CACHE, searchable, start, count);
   }
 #endif
 
@@ -648,7 +834,7 @@ size_t UserDict::predict(const char16 last_hzs[], uint16 hzs_len,
     return 0;
 
   while (j <= end) {
-    uint32 offset = predicts_[j];
+    uint32 offset = list_item_offset(predicts_[j]);
     // Ignore deleted lemmas
     if (offset & kUserDictOffsetFlagRemove) {
       j++;
@@ -689,6 +875,17 @@ size_t UserDict::predict(const char16 last_hzs[], uint16 hzs_len,
 
 int32 UserDict::locate_in_offsets(char16 lemma_str[], uint16 splid_str[],
                                   uint16 lemma_len) {
+  if (locates_) {
+    SpellingTrie &spl_trie = SpellingTrie::get_instance();
+    uint32 i = 0;
+    for (; i < lemma_len; i++) {
+      if (spl_trie.is_half_id(splid_str[i]))
+        break;
+    }
+    if (i == lemma_len)
+      return locate_in_index(lemma_str, splid_str, lemma_len);
+  }
+
   int32 max_off = dict_info_.lemma_count;
 
   UserDictSearchable searchable;
@@ -713,7 +910,7 @@ int32 UserDict::locate_in_offsets(char16 lemma_str[], uint16 splid_str[],
   }
 
   while (off < max_off) {
-    uint32 offset = offsets_[off];
+    uint32 offset = slots_[off].offset;
     if (offset & kUserDictOffsetFlagRemove) {
       off++;
       continue;
@@ -755,6 +952,97 @@ int32 UserDict::locate_in_offsets(char16 lemma_str[], uint16 splid_str[],
   return -1;
 }
 
+uint32 UserDict::locate_hash(const char16 lemma_str[],
+                              const uint16 splid_str[], uint16 lemma_len) {
+  // FNV-1a over spelling ids and hanzis
+  uint32 h = 2166136261U;
+  for (uint16 i = 0; i < lemma_len; i++) {
+    h = (h ^ splid_str[i]) * 16777619U;
+    h = (h ^ lemma_str[i]) * 16777619U;
+  }
+  return h;
+}
+
+void UserDict::locate_index_rebuild() {
+  free(locates_);
+  locates_ = NULL;
+  locate_size_ = 0;
+  locate_tombstones_ = 0;
+
+  // Keep load factor under 1/2, including room for lemmas added later
+  uint32 capacity = dict_info_.lemma_count + lemma_count_left_;
+  uint32 size = 16;
+  while (size < (capacity << 1))
+    size <<= 1;
+
+  locates_ = (uint32*)calloc(size, sizeof(uint32));
+  if (!locates_)
+    return;
+  locate_size_ = size;
+
+  for (uint32 i = 0; i < dict_info_.lemma_count; i++) {
+    if (slots_[i].offset & kUserDictOffsetFlagRemove)
+      continue;
+    locate_index_insert(i);
+  }
+}
+
+void UserDict::locate_index_insert(uint32 offset_index) {
+  if (!locates_)
+    return;
+  uint32 offset = slots_[offset_index].offset & kUserDictOffsetMask;
+  uint32 mask = locate_size_ - 1;
+  uint32 pos = locate_hash(get_lemma_word(offset),
+                           get_lemma_spell_ids(offset),
+                           get_lemma_nchar(offset)) & mask;
+  while (locates_[pos] != 0 && locates_[pos] != kUserDictLocateTombstone)
+    pos = (pos + 1) & mask;
+  if (locates_[pos] == kUserDictLocateTombstone)
+    locate_tombstones_--;
+  locates_[pos] = ids_[offset_index] - start_id_ + 1;
+}
+
+void UserDict::locate_index_remove(uint32 offset_index) {
+  if (!locates_)
+    return;
+  uint32 offset = slots_[offset_index].offset & kUserDictOffsetMask;
+  uint32 mask = locate_size_ - 1;
+  uint32 pos = locate_hash(get_lemma_word(offset),
+                           get_lemma_spell_ids(offset),
+                           get_lemma_nchar(offset)) & mask;
+  uint32 v = ids_[offset_index] - start_id_ + 1;
+  while (locates_[pos] != 0) {
+    if (locates_[pos] == v) {
+      locates_[pos] = kUserDictLocateTombstone;
+      locate_tombstones_++;
+      return;
+    }
+    pos = (pos + 1) & mask;
+  }
+}
+
+int32 UserDict::locate_in_index(char16 lemma_str[], uint16 splid_str[],
+                                uint16 lemma_len) {
+  uint32 mask = locate_size_ - 1;
+  uint32 pos = locate_hash(lemma_str, splid_str, lemma_len) & mask;
+  while (locates_[pos] != 0) {
+    uint32 v = locates_[pos];
+    pos = (pos + 1) & mask;
+    if (v == kUserDictLocateTombstone)
+      continue;
+    uint32 offset_index = offset_indexes_by_id_[v - 1];
+    uint32 offset = slots_[offset_index].offset;
+    if (offset & kUserDictOffsetFlagRemove)
+      continue;
+    if (get_lemma_nchar(offset) != lemma_len)
+      continue;
+    if (memcmp(get_lemma_spell_ids(offset), splid_str, lemma_len << 1) == 0 &&
+        memcmp(get_lemma_word(offset), lemma_str, lemma_len << 1) == 0)
+      return offset_index;
+  }
+  return -1;
+}
+
 #ifdef ___PREDICT_ENABLED___
 uint32 UserDict::locate_where_to_insert_in_predicts(
     const uint16 * words, int lemma_len) {
@@ -766,7 +1054,7 @@ uint32 UserDict::locate_where_to_insert_in_predicts(
 
   while (begin <= end) {
     middle = (begin + end) >> 1;
-    uint32 offset = offsets_[middle];
+    uint32 offset = slots_[middle].offset;
     uint8 nchar = get_lemma_nchar(offset);
     const uint16 * ws = get_lemma_word(offset);
 
@@ -813,7 +1101,7 @@ int32 UserDict::locate_first_in_predicts(const uint16 * words, int lemma_len) {
 
   while (begin <= end) {
     middle = (begin + end) >> 1;
-    uint32 offset = offsets_[middle];
+    uint32 offset = slots_[middle].offset;
     uint8 nchar = get_lemma_nchar(offset);
     const uint16 * ws = get_lemma_word(offset);
 
@@ -896,7 +1184,7 @@ int UserDict::_get_lemma_score(LemmaIdType lemma_id) {
     return 0;
   }
 
-  return scores_[off];
+  return slots_[off].score;
 }
 
 int UserDict::_get_lemma_score(char16 lemma_str[], uint16 splids[],
@@ -909,7 +1197,7 @@ int UserDict::_get_lemma_score(char16 lemma_str[], uint16 splids[],
     return 0;
   }
 
-  return scores_[off];
+  return slots_[off].score;
 }
 
 #ifdef ___SYNC_ENABLED___
@@ -917,13 +1205,16 @@ void UserDict::remove_lemma_from_sync_list(uint32 offset) {
   offset &= kUserDictOffsetMask;
   uint32 i = 0;
   for (; i < dict_info_.sync_count; i++) {
-    unsigned int off = (syncs_[i] & kUserDictOffsetMask);
+    unsigned int off = (list_item_offset(syncs_[i]) & kUserDictOffsetMask);
     if (off == offset)
       break;
   }
   if (i < dict_info_.sync_count) {
-    syncs_[i] = syncs_[dict_info_.sync_count - 1];
+    memmove(syncs_ + i, syncs_ + i + 1,
+            (dict_info_.sync_count - i - 1) << 2);
     dict_info_.sync_count--;
+    if (i < sync_got_)
+      sync_got_--;
   }
 }
 #endif
@@ -933,7 +1224,7 @@ void UserDict::remove_lemma_from_predict_list(uint32 offset) {
   offset &= kUserDictOffsetMask;
   uint32 i = 0;
   for (; i < dict_info_.lemma_count; i++) {
-    unsigned int off = (predicts_[i] & kUserDictOffsetMask);
+    unsigned int off = (list_item_offset(predicts_[i]) & kUserDictOffsetMask);
     if (off == offset) {
       predicts_[i] |= kUserDictOffsetFlagRemove;
       break;
@@ -951,10 +1242,13 @@ bool UserDict::remove_lemma_by_offset_index(int offset_index) {
     return false;
   }
 
-  uint32 offset = offsets_[off];
+  uint32 offset = slots_[off].offset;
   uint32 nchar = get_lemma_nchar(offset);
 
-  offsets_[off] |= kUserDictOffsetFlagRemove;
+  locate_index_remove(off);
+  slots_[off].offset |= kUserDictOffsetFlagRemove;
+  set_lemma_flag(offset & kUserDictOffsetMask, kUserDictLemmaFlagRemove);
+  defrag_note_removal(offset);
 
 #ifdef ___SYNC_ENABLED___
   // Remove corresponding sync item
@@ -966,6 +1260,7 @@ bool UserDict::remove_lemma_by_offset_index(int offset_index) {
 #endif
   dict_info_.free_count++;
   dict_info_.free_size += (2 + (nchar << 2));
+  invalidate_lpi_user();
 
   if (state_ < USER_DICT_OFFSET_DIRTY)
     state_ = USER_DICT_OFFSET_DIRTY;
@@ -993,15 +1288,151 @@ void UserDict::flush_cache() {
   const char * file = strdup(dict_file_);
   if (!file)
     return;
+#ifdef ___SYNC_ENABLED___
+  // The sync list is written back and loaded again in the same order, so a
+  // pull goes on after the flush unless the file is written by others.
+  uint32 sync_got = sync_got_;
+  uint32 sync_pull = sync_pull_;
+  pthread_mutex_lock(&g_mutex_);
+  bool keep_pull = load_time_.tv_sec > g_last_update_.tv_sec ||
+      (load_time_.tv_sec == g_last_update_.tv_sec &&
+       load_time_.tv_usec >= g_last_update_.tv_usec);
+  pthread_mutex_unlock(&g_mutex_);
+#endif
   close_dict();
   load_dict(file, start_id, kUserDictIdEnd);
   free((void*)file);
+#ifdef ___SYNC_ENABLED___
+  if (keep_pull && is_valid_state()) {
+    sync_got_ = (sync_got < dict_info_.sync_count ?
+                 sync_got : dict_info_.sync_count);
+    sync_pull_ = sync_pull;
+  }
+#endif
 #ifdef ___CACHE_ENABLED___
   cache_init();
 #endif
   return;
 }
 
+bool UserDict::is_outdated() {
+  if (!is_valid_state() || 0 != pthread_mutex_trylock(&g_mutex_))
+    return false;
+  bool outdated = load_time_.tv_sec < g_last_update_.tv_sec ||
+      (load_time_.tv_sec == g_last_update_.tv_sec &&
+       load_time_.tv_usec < g_last_update_.tv_usec);
+  pthread_mutex_unlock(&g_mutex_);
+  return outdated;
+}
+
+bool UserDict::reload_if_outdated() {
+  if (read_only_ || !is_outdated())
+    return false;
+  // Others updated disk file, have to reload
+  flush_cache();
+  return true;
+}
+
+// Copy size bytes into a new buffer. A buffer is allocated even if size is
+// 0, so that NULL only means a failure.
+static void* copy_buffer(const void *src, size_t size) {
+  void *buf = malloc(size > 0 ? size : 1);
+  if (NULL != buf && size > 0)
+    memcpy(buf, src, size);
+  return buf;
+}
+
+bool UserDict::copy_dict(UserDict *dict) {
+  close_dict();
+  if (NULL == dict || !dict->is_valid_state())
+    return false;
+
+  size_t count = dict->dict_info_.lemma_count;
+  dict_file_ = strdup(dict->dict_file_);
+  lemmas_ = static_cast<uint8*>(
+      copy_buffer(dict->lemmas_, dict->dict_info_.lemma_size));
+  slots_ = static_cast<UserDictSlot*>(
+      copy_buffer(dict->slots_, count * sizeof(UserDictSlot)));
+  ids_ = static_cast<uint32*>(copy_buffer(dict->ids_, count << 2));
+#ifdef ___PREDICT_ENABLED___
+  predicts_ = static_cast<uint32*>(copy_buffer(dict->predicts_, count << 2));
+#endif
+#ifdef ___SYNC_ENABLED___
+  syncs_ = static_cast<uint32*>(
+      copy_buffer(dict->syncs_, dict->dict_info_.sync_count << 2));
+  sync_count_size_ = dict->dict_info_.sync_count;
+#endif
+  offsets_by_id_ = static_cast<uint32*>(
+      copy_buffer(dict->offsets_by_id_, count << 2));
+  offset_indexes_by_id_ = static_cast<uint32*>(
+      copy_buffer(dict->offset_indexes_by_id_, count << 2));
+  locates_ = static_cast<uint32*>(
+      copy_buffer(dict->locates_, dict->locate_size_ << 2));
+
+  // The buffers are freed by close_dict(), whether they are all allocated
+  // or not.
+  state_ = USER_DICT_SYNC;
+  if (NULL == dict_file_ || NULL == lemmas_ || NULL == slots_ ||
+      NULL == ids_ ||
+#ifdef ___PREDICT_ENABLED___
+      NULL == predicts_ ||
+#endif
+#ifdef ___SYNC_ENABLED___
+      NULL == syncs_ ||
+#endif
+      NULL == offsets_by_id_ || NULL == offset_indexes_by_id_ ||
+      NULL == locates_) {
+    close_dict();
+    return false;
+  }
+
+  total_other_nfreq_ = dict->total_other_nfreq_;
+  load_time_ = dict->load_time_;
+  start_id_ = dict->start_id_;
+  version_ = dict->version_;
+  locate_size_ = dict->locate_size_;
+  locate_tombstones_ = dict->locate_tombstones_;
+  defrag_running_ = dict->defrag_running_;
+  defrag_dst_ = dict->defrag_dst_;
+  defrag_src_ = dict->defrag_src_;
+  defrag_hole_ = dict->defrag_hole_;
+  defrag_gap_ = dict->defrag_gap_;
+  defrag_gap_end_ = dict->defrag_gap_end_;
+  lemma_count_left_ = 0;
+  lemma_size_left_ = 0;
+  lemma_size_loaded_ = dict->lemma_size_loaded_;
+  memcpy(&dict_info_, &dict->dict_info_, sizeof(dict_info_));
+  read_only_ = true;
+#ifdef ___CACHE_ENABLED___
+  cache_init();
+#endif
+  return true;
+}
+
+void UserDict::set_lpi_cache_notify(bool notify) {
+  lpi_cache_notify_ = notify;
+}
+
+size_t UserDict::get_mem_size() {
+  size_t size = sizeof(UserDict);
+  if (is_valid_state() == false)
+    return size;
+
+  // Room is kept for the lemmas to be added, it is counted too.
+  size_t count = dict_info_.lemma_count + lemma_count_left_;
+  size += dict_info_.lemma_size + lemma_size_left_;
+  // slots_, ids_, offsets_by_id_ and offset_indexes_by_id_.
+  size += count * sizeof(UserDictSlot) + (count << 2) * 3;
+#ifdef ___PREDICT_ENABLED___
+  size += count << 2;
+#endif
+#ifdef ___SYNC_ENABLED___
+  size += sync_count_size_ << 2;
+#endif
+  size += locate_size_ << 2;
+  return size;
+}
+
 bool UserDict::reset(const char *file) {
   FILE *fp = fopen(file, "w+");
   if (!fp) {
@@ -1097,13 +1528,13 @@ bool UserDict::load(const char *file, LemmaIdType start_id) {
   size_t readed, toread;
   UserDictInfo dict_info;
   uint8 *lemmas = NULL;
-  uint32 *offsets = NULL;
+  UserDictSlot *slots = NULL;
 #ifdef ___SYNC_ENABLED___
   uint32 *syncs = NULL;
 #endif
-  uint32 *scores = NULL;
   uint32 *ids = NULL;
   uint32 *offsets_by_id = NULL;
+  uint32 *offset_indexes_by_id = NULL;
 #ifdef ___PREDICT_ENABLED___
   uint32 *predicts = NULL;
 #endif
@@ -1118,33 +1549,35 @@ bool UserDict::load(const char *file, LemmaIdType start_id) {
 
   lemmas = (uint8 *)malloc(
       dict_info.lemma_size +
-      (kUserDictPreAlloc * (2 + (kUserDictAverageNchar << 2))));
+      (prealloc_ * (2 + (kUserDictAverageNchar << 2))));
 
   if (!lemmas) goto error;
 
-  offsets = (uint32 *)malloc((dict_info.lemma_count + kUserDictPreAlloc) << 2);
-  if (!offsets) goto error;
+  slots = (UserDictSlot *)malloc(
+      (dict_info.lemma_count + prealloc_) * sizeof(UserDictSlot));
+  if (!slots) goto error;
 
 #ifdef ___PREDICT_ENABLED___
-  predicts = (uint32 *)malloc((dict_info.lemma_count + kUserDictPreAlloc) << 2);
+  predicts = (uint32 *)malloc((dict_info.lemma_count + prealloc_) << 2);
   if (!predicts) goto error;
 #endif
 
 #ifdef ___SYNC_ENABLED___
-  syncs = (uint32 *)malloc((dict_info.sync_count + kUserDictPreAlloc) << 2);
+  syncs = (uint32 *)malloc((dict_info.sync_count + prealloc_) << 2);
   if (!syncs) goto error;
 #endif
 
-  scores = (uint32 *)malloc((dict_info.lemma_count + kUserDictPreAlloc) << 2);
-  if (!scores) goto error;
-
-  ids = (uint32 *)malloc((dict_info.lemma_count + kUserDictPreAlloc) << 2);
+  ids = (uint32 *)malloc((dict_info.lemma_count + prealloc_) << 2);
   if (!ids) goto error;
 
   offsets_by_id = (uint32 *)malloc(
-      (dict_info.lemma_count + kUserDictPreAlloc) << 2);
+      (dict_info.lemma_count + prealloc_) << 2);
   if (!offsets_by_id) goto error;
 
+  offset_indexes_by_id = (uint32 *)malloc(
+      (dict_info.lemma_count + prealloc_) << 2);
+  if (!offset_indexes_by_id) goto error;
+
   err = fseek(fp, 4, SEEK_SET);
   if (err) goto error;
 
@@ -1155,13 +1588,17 @@ bool UserDict::load(const char *file, LemmaIdType start_id) {
   if (readed < dict_info.lemma_size)
     goto error;
 
+  // Offsets and scores are read into ids, which is not filled yet, and
+  // moved to the slots.
   toread = (dict_info.lemma_count << 2);
   readed = 0;
   while (readed < toread && !ferror(fp) && !feof(fp)) {
-    readed += fread((((uint8*)offsets) + readed), 1, toread - readed, fp);
+    readed += fread((((uint8*)ids) + readed), 1, toread - readed, fp);
   }
   if (readed < toread)
     goto error;
+  for (i = 0; i < dict_info.lemma_count; i++)
+    slots[i].offset = ids[i];
 
 #ifdef ___PREDICT_ENABLED___
   toread = (dict_info.lemma_count << 2);
@@ -1175,10 +1612,12 @@ bool UserDict::load(const char *file, LemmaIdType start_id) {
 
   readed = 0;
   while (readed < toread && !ferror(fp) && !feof(fp)) {
-    readed += fread((((uint8*)scores) + readed), 1, toread - readed, fp);
+    readed += fread((((uint8*)ids) + readed), 1, toread - readed, fp);
   }
   if (readed < toread)
     goto error;
+  for (i = 0; i < dict_info.lemma_count; i++)
+    slots[i].score = ids[i];
 
 #ifdef ___SYNC_ENABLED___
   toread = (dict_info.sync_count << 2);
@@ -1190,27 +1629,36 @@ bool UserDict::load(const char *file, LemmaIdType start_id) {
     goto error;
 #endif
 
+  lemmas_ = lemmas;
   for (i = 0; i < dict_info.lemma_count; i++) {
     ids[i] = start_id + i;
-    offsets_by_id[i] = offsets[i];
+    offsets_by_id[i] = slots[i].offset;
+    offset_indexes_by_id[i] = i;
+    fill_slot(slots + i, slots[i].offset);
   }
 
-  lemmas_ = lemmas;
-  offsets_ = offsets;
+  slots_ = slots;
 #ifdef ___SYNC_ENABLED___
   syncs_ = syncs;
-  sync_count_size_ = dict_info.sync_count + kUserDictPreAlloc;
+  sync_count_size_ = dict_info.sync_count + prealloc_;
 #endif
   offsets_by_id_ = offsets_by_id;
-  scores_ = scores;
+  offset_indexes_by_id_ = offset_indexes_by_id;
   ids_ = ids;
 #ifdef ___PREDICT_ENABLED___
   predicts_ = predicts;
 #endif
-  lemma_count_left_ = kUserDictPreAlloc;
-  lemma_size_left_ = kUserDictPreAlloc * (2 + (kUserDictAverageNchar << 2));
+  lemma_count_left_ = prealloc_;
+  lemma_size_left_ = prealloc_ * (2 + (kUserDictAverageNchar << 2));
+  lemma_size_loaded_ = dict_info.lemma_size;
   memcpy(&dict_info_, &dict_info, sizeof(dict_info));
   state_ = USER_DICT_SYNC;
+  defrag_running_ = false;
+  defrag_hole_ = kUserDictDefragNoHole;
+  defrag_gap_ = 0;
+  defrag_gap_end_ = 0;
+
+  locate_index_rebuild();
 
   fclose(fp);
 
@@ -1219,13 +1667,13 @@ bool UserDict::load(const char *file, LemmaIdType start_id) {
 
  error:
   if (lemmas) free(lemmas);
-  if (offsets) free(offsets);
+  if (slots) free(slots);
 #ifdef ___SYNC_ENABLED___
   if (syncs) free(syncs);
 #endif
-  if (scores) free(scores);
   if (ids) free(ids);
   if (offsets_by_id) free(offsets_by_id);
+  if (offset_indexes_by_id) free(offset_indexes_by_id);
 #ifdef ___PREDICT_ENABLED___
   if (predicts) free(predicts);
 #endif
@@ -1238,6 +1686,9 @@ void UserDict::write_back() {
   // XXX write back is only allowed from close_dict due to thread-safe sake
   if (state_ == USER_DICT_NONE || state_ == USER_DICT_SYNC)
     return;
+  // Lemma buffer has a hole during defragment, finish it before writing
+  if (defrag_running_)
+    defragment();
   int fd = open(dict_file_, O_WRONLY);
   if (fd == -1)
     return;
@@ -1285,15 +1736,26 @@ void UserDict::write_back_sync(int fd) {
 }
 #endif
 
+void UserDict::write_slot_field(int fd, uint32 UserDictSlot::*field) {
+  uint32 buf[256];
+  size_t i = 0;
+  while (i < dict_info_.lemma_count) {
+    size_t num = 0;
+    for (; num < 256 && i < dict_info_.lemma_count; num++, i++)
+      buf[num] = slots_[i].*field;
+    write(fd, buf, num << 2);
+  }
+}
+
 void UserDict::write_back_offset(int fd) {
   int err = lseek(fd, 4 + dict_info_.lemma_size, SEEK_SET);
   if (err == -1)
     return;
-  write(fd, offsets_, dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::offset);
 #ifdef ___PREDICT_ENABLED___
   write(fd, predicts_, dict_info_.lemma_count << 2);
 #endif
-  write(fd, scores_, dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::score);
 #ifdef ___SYNC_ENABLED___
   write(fd, syncs_, dict_info_.sync_count << 2);
 #endif
@@ -1309,7 +1771,7 @@ void UserDict::write_back_score(int fd) {
                   , SEEK_SET);
   if (err == -1)
     return;
-  write(fd, scores_, dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::score);
 #ifdef ___SYNC_ENABLED___
   write(fd, syncs_, dict_info_.sync_count << 2);
 #endif
@@ -1321,18 +1783,17 @@ void UserDict::write_back_lemma(int fd) {
   if (err == -1)
     return;
   // New lemmas are always appended, no need to write whole lemma block
-  size_t need_write = kUserDictPreAlloc *
-      (2 + (kUserDictAverageNchar << 2)) - lemma_size_left_;
+  size_t need_write = dict_info_.lemma_size - lemma_size_loaded_;
   err = lseek(fd, dict_info_.lemma_size - need_write, SEEK_CUR);
   if (err == -1)
     return;
   write(fd, lemmas_ + dict_info_.lemma_size - need_write, need_write);
 
-  write(fd, offsets_,  dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::offset);
 #ifdef ___PREDICT_ENABLED___
   write(fd, predicts_,  dict_info_.lemma_count << 2);
 #endif
-  write(fd, scores_, dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::score);
 #ifdef ___SYNC_ENABLED___
   write(fd, syncs_, dict_info_.sync_count << 2);
 #endif
@@ -1347,11 +1808,11 @@ void UserDict::write_back_all(int fd) {
   if (err == -1)
     return;
   write(fd, lemmas_, dict_info_.lemma_size);
-  write(fd, offsets_, dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::offset);
 #ifdef ___PREDICT_ENABLED___
   write(fd, predicts_, dict_info_.lemma_count << 2);
 #endif
-  write(fd, scores_, dict_info_.lemma_count << 2);
+  write_slot_field(fd, &UserDictSlot::score);
 #ifdef ___SYNC_ENABLED___
   write(fd, syncs_, dict_info_.sync_count << 2);
 #endif
@@ -1512,170 +1973,186 @@ void UserDict::defragment(void) {
 #endif
   if (is_valid_state() == false)
     return;
-  // Fixup offsets_, set REMOVE flag to lemma's flag if needed
-  size_t first_freed = 0;
-  size_t first_inuse = 0;
-  while (first_freed < dict_info_.lemma_count) {
-    // Find first freed offset
-    while ((offsets_[first_freed] & kUserDictOffsetFlagRemove) == 0 &&
-            first_freed < dict_info_.lemma_count) {
-      first_freed++;
-    }
-    if (first_freed < dict_info_.lemma_count) {
-      // Save REMOVE flag to lemma flag
-      int off = offsets_[first_freed];
-      set_lemma_flag(off, kUserDictLemmaFlagRemove);
-    } else {
-      break;
-    }
-    // Find first inuse offse after first_freed
-    first_inuse = first_freed + 1;
-    while ((offsets_[first_inuse] & kUserDictOffsetFlagRemove) &&
-           (first_inuse < dict_info_.lemma_count)) {
-      // Save REMOVE flag to lemma flag
-      int off = offsets_[first_inuse];
-      set_lemma_flag(off, kUserDictLemmaFlagRemove);
-      first_inuse++;
-    }
-    if (first_inuse >= dict_info_.lemma_count) {
-      break;
-    }
-    // Swap offsets_
-    int tmp = offsets_[first_inuse];
-    offsets_[first_inuse] = offsets_[first_freed];
-    offsets_[first_freed] = tmp;
-    // Move scores_, no need to swap
-    tmp = scores_[first_inuse];
-    scores_[first_inuse] = scores_[first_freed];
-    scores_[first_freed] = tmp;
-    // Swap ids_
-    LemmaIdType tmpid = ids_[first_inuse];
-    ids_[first_inuse] = ids_[first_freed];
-    ids_[first_freed] = tmpid;
-    // Go on
-    first_freed++;
+  while (false == defragment_step(dict_info_.lemma_size + lemma_size_left_)) {
   }
+#ifdef ___DEBUG_PERF___
+  DEBUG_PERF_END;
+  LOGD_PERF("defragment");
+#endif
+}
+
+bool UserDict::need_defragment() {
+  if (is_valid_state() == false)
+    return false;
+  if (defrag_running_)
+    return true;
+  return dict_info_.free_count > 0 &&
+      dict_info_.free_size * kUserDictDefragFreeRatio >=
+      dict_info_.lemma_size;
+}
+
+void UserDict::list_items_to_ids() {
 #ifdef ___PREDICT_ENABLED___
-  // Fixup predicts_
-  first_freed = 0;
-  first_inuse = 0;
-  while (first_freed < dict_info_.lemma_count) {
-    // Find first freed offset
-    while ((predicts_[first_freed] & kUserDictOffsetFlagRemove) == 0 &&
-            first_freed < dict_info_.lemma_count) {
-      first_freed++;
-    }
-    if (first_freed >= dict_info_.lemma_count)
-      break;
-    // Find first inuse offse after first_freed
-    first_inuse = first_freed + 1;
-    while ((predicts_[first_inuse] & kUserDictOffsetFlagRemove)
-           && (first_inuse < dict_info_.lemma_count)) {
-      first_inuse++;
-    }
-    if (first_inuse >= dict_info_.lemma_count) {
-      break;
-    }
-    // Swap offsets_
-    int tmp = predicts_[first_inuse];
-    predicts_[first_inuse] = predicts_[first_freed];
-    predicts_[first_freed] = tmp;
-    // Go on
-    first_freed++;
-  }
-#endif
-  dict_info_.lemma_count = first_freed;
-  // Fixup lemmas_
-  size_t begin = 0;
-  size_t end = 0;
-  size_t dst = 0;
-  int total_size = dict_info_.lemma_size + lemma_size_left_;
-  int total_count = dict_info_.lemma_count + lemma_count_left_;
-  size_t real_size = total_size - lemma_size_left_;
-  while (dst < real_size) {
-    unsigned char flag = get_lemma_flag(dst);
-    unsigned char nchr = get_lemma_nchar(dst);
-    if ((flag & kUserDictLemmaFlagRemove) == 0) {
-      dst += nchr * 4 + 2;
+  for (size_t i = 0; i < dict_info_.lemma_count; i++) {
+    uint32 offset = predicts_[i];
+    if (offset & kUserDictOffsetFlagRemove) {
+      predicts_[i] = kUserDictOffsetFlagRemove;
       continue;
     }
-    break;
+    int32 off = locate_in_offsets(get_lemma_word(offset),
+                                  get_lemma_spell_ids(offset),
+                                  get_lemma_nchar(offset));
+    if (off == -1)
+      predicts_[i] = kUserDictOffsetFlagRemove;
+    else
+      predicts_[i] = ids_[off] - start_id_;
   }
-  if (dst >= real_size)
-    return;
+#endif
+#ifdef ___SYNC_ENABLED___
+  uint32 dst = 0;
+  uint32 got = sync_got_;
+  for (size_t i = 0; i < dict_info_.sync_count; i++) {
+    uint32 offset = syncs_[i];
+    int32 off = locate_in_offsets(get_lemma_word(offset),
+                                  get_lemma_spell_ids(offset),
+                                  get_lemma_nchar(offset));
+    if (off != -1)
+      syncs_[dst++] = ids_[off] - start_id_;
+    else if (i < sync_got_)
+      got--;
+  }
+  dict_info_.sync_count = dst;
+  sync_got_ = got;
+#endif
+}
 
-  end = dst;
-  while (end < real_size) {
-    begin = end + get_lemma_nchar(end) * 4 + 2;
- repeat:
-    // not used any more
-    if (begin >= real_size)
-      break;
-    unsigned char flag = get_lemma_flag(begin);
-    unsigned char nchr = get_lemma_nchar(begin);
-    if (flag & kUserDictLemmaFlagRemove) {
-      begin += nchr * 4 + 2;
-      goto repeat;
+void UserDict::list_items_to_offsets() {
+#ifdef ___PREDICT_ENABLED___
+  for (size_t i = 0; i < dict_info_.lemma_count; i++)
+    predicts_[i] = list_item_offset(predicts_[i]);
+#endif
+#ifdef ___SYNC_ENABLED___
+  for (size_t i = 0; i < dict_info_.sync_count; i++)
+    syncs_[i] = list_item_offset(syncs_[i]);
+#endif
+}
+
+bool UserDict::defragment_step(size_t max_bytes) {
+  if (is_valid_state() == false)
+    return true;
+
+  if (!defrag_running_) {
+    // Save REMOVE flag to lemma flag, lemmas removed after this point get
+    // the flag in remove_lemma_by_offset_index()
+    for (size_t i = 0; i < dict_info_.lemma_count; i++) {
+      if (slots_[i].offset & kUserDictOffsetFlagRemove)
+        set_lemma_flag(slots_[i].offset & kUserDictOffsetMask,
+                       kUserDictLemmaFlagRemove);
     }
-    end = begin + nchr * 4 + 2;
-    while (end < real_size) {
-      unsigned char eflag = get_lemma_flag(end);
-      unsigned char enchr = get_lemma_nchar(end);
-      if ((eflag & kUserDictLemmaFlagRemove) == 0) {
-        end += enchr * 4 + 2;
+    list_items_to_ids();
+    defrag_dst_ = 0;
+    defrag_src_ = 0;
+    defrag_running_ = true;
+  }
+
+  // Move lemmas_ forward one by one, at most max_bytes are walked through
+  // in this step. Lemmas between defrag_dst_ and defrag_src_ are garbage,
+  // no offset points to them. A moved lemma is found by its content, so
+  // only its own slot is updated.
+  size_t walked = 0;
+  while (true) {
+    while (defrag_src_ < dict_info_.lemma_size && walked < max_bytes) {
+      if (defrag_src_ == defrag_gap_ && defrag_gap_ < defrag_gap_end_) {
+        defrag_src_ = defrag_gap_end_;
         continue;
       }
-      break;
-    }
-    memmove(lemmas_ + dst, lemmas_ + begin, end - begin);
-    for (size_t j = 0; j < dict_info_.lemma_count; j++) {
-      if (offsets_[j] >= begin && offsets_[j] < end) {
-        offsets_[j] -= (begin - dst);
-        offsets_by_id_[ids_[j] - start_id_] = offsets_[j];
-      }
-#ifdef ___PREDICT_ENABLED___
-      if (predicts_[j] >= begin && predicts_[j] < end) {
-        predicts_[j] -= (begin - dst);
+      uint32 src = defrag_src_;
+      uint32 nchar = get_lemma_nchar(src);
+      uint32 size = (nchar << 2) + 2;
+      defrag_src_ += size;
+      walked += size;
+      if (get_lemma_flag(src) & kUserDictLemmaFlagRemove) {
+        if (dict_info_.free_count > 0)
+          dict_info_.free_count--;
+        dict_info_.free_size -= size < dict_info_.free_size ?
+            size : dict_info_.free_size;
+        continue;
       }
-#endif
-    }
-#ifdef ___SYNC_ENABLED___
-    for (size_t j = 0; j < dict_info_.sync_count; j++) {
-      if (syncs_[j] >= begin && syncs_[j] < end) {
-        syncs_[j] -= (begin - dst);
+      int32 off = locate_in_offsets(get_lemma_word(src),
+                                    get_lemma_spell_ids(src), nchar);
+      if (off == -1 || slots_[off].offset != src)
+        continue;
+      if (src != defrag_dst_) {
+        memmove(lemmas_ + defrag_dst_, lemmas_ + src, size);
+        slots_[off].offset = defrag_dst_;
+        offsets_by_id_[ids_[off] - start_id_] = defrag_dst_;
       }
+      defrag_dst_ += size;
     }
-#endif
-    dst += (end - begin);
+    if (state_ < USER_DICT_LEMMA_DIRTY)
+      state_ = USER_DICT_LEMMA_DIRTY;
+
+    if (defrag_src_ < dict_info_.lemma_size)
+      return false;
+    if (kUserDictDefragNoHole == defrag_hole_)
+      break;
+
+    // Some lemmas were removed after they had been moved. Walk the
+    // compacted part again from the first of them; what follows it is
+    // garbage up to the lemmas appended from now on.
+    defrag_gap_ = defrag_dst_;
+    defrag_gap_end_ = dict_info_.lemma_size;
+    defrag_dst_ = defrag_hole_;
+    defrag_src_ = defrag_hole_;
+    defrag_hole_ = kUserDictDefragNoHole;
+    if (walked >= max_bytes)
+      return false;
   }
 
-  dict_info_.free_count = 0;
-  dict_info_.free_size = 0;
-  dict_info_.lemma_size = dst;
+  // All lemmas are moved, remove freed items from slots_, ids_
+  // and predicts_ and collect back lemma ids.
+  list_items_to_offsets();
+  defrag_running_ = false;
+  defrag_gap_ = 0;
+  defrag_gap_end_ = 0;
+
+  size_t dst = 0;
+  for (size_t i = 0; i < dict_info_.lemma_count; i++) {
+    if (slots_[i].offset & kUserDictOffsetFlagRemove)
+      continue;
+    slots_[dst] = slots_[i];
+    dst++;
+  }
+#ifdef ___PREDICT_ENABLED___
+  size_t pdst = 0;
+  for (size_t i = 0; i < dict_info_.lemma_count; i++) {
+    if (predicts_[i] & kUserDictOffsetFlagRemove)
+      continue;
+    predicts_[pdst++] = predicts_[i];
+  }
+#endif
+  size_t total_size = dict_info_.lemma_size + lemma_size_left_;
+  size_t total_count = dict_info_.lemma_count + lemma_count_left_;
+  dict_info_.lemma_count = dst;
+  dict_info_.lemma_size = defrag_dst_;
   lemma_size_left_ = total_size - dict_info_.lemma_size;
   lemma_count_left_ = total_count - dict_info_.lemma_count;
 
-  // XXX Without following code,
-  // offsets_by_id_ is not reordered.
-  // That's to say, all removed lemmas' ids are not collected back.
-  // There may not be room for addition of new lemmas due to
-  // offsests_by_id_ reason, although lemma_size_left_ is fixed.
-  // By default, we do want defrag as fast as possible, because
-  // during defrag procedure, other peers can not write new lemmas
-  // to user dictionary file.
   // XXX If write-back is invoked immediately after
   // this defragment, no need to fix up following in-mem data.
   for (uint32 i = 0; i < dict_info_.lemma_count; i++) {
     ids_[i] = start_id_ + i;
-    offsets_by_id_[i] = offsets_[i];
+    offsets_by_id_[i] = slots_[i].offset;
+    offset_indexes_by_id_[i] = i;
   }
+  locate_index_rebuild();
+#ifdef ___CACHE_ENABLED___
+  cache_init();
+#endif
+  invalidate_lpi_user();
 
   state_ = USER_DICT_DEFRAGMENTED;
-
-#ifdef ___DEBUG_PERF___
-  DEBUG_PERF_END;
-  LOGD_PERF("defragment");
-#endif
+  return true;
 }
 
 #ifdef ___SYNC_ENABLED___
@@ -1684,8 +2161,12 @@ void UserDict::clear_sync_lemmas(unsigned int start, unsigned int end) {
     return;
   if (end > dict_info_.sync_count)
     end = dict_info_.sync_count;
+  if (start >= end)
+    return;
   memmove(syncs_ + start, syncs_ + end, (dict_info_.sync_count - end) << 2);
   dict_info_.sync_count -= (end - start);
+  if (sync_got_ > start)
+    sync_got_ = (sync_got_ > end ? sync_got_ - (end - start) : start);
   if (state_ < USER_DICT_SYNC_DIRTY)
     state_ = USER_DICT_SYNC_DIRTY;
 }
@@ -1696,6 +2177,17 @@ int UserDict::get_sync_count() {
   return dict_info_.sync_count;
 }
 
+int UserDict::get_sync_got_count() {
+  if (is_valid_state() == false)
+    return 0;
+  return sync_got_;
+}
+
+void UserDict::clear_sync_got_lemmas() {
+  clear_sync_lemmas(0, sync_got_);
+  sync_pull_++;
+}
+
 LemmaIdType UserDict::put_lemma_no_sync(char16 lemma_str[], uint16 splids[],
                         uint16 lemma_len, uint16 count, uint64 lmt) {
   int again = 0;
@@ -1821,7 +2313,7 @@ int UserDict::get_sync_lemmas_in_utf16le_string_from_beginning(
 
   uint32 i;
   for (i = 0; i < dict_info_.sync_count; i++) {
-    int offset = syncs_[i];
+    int offset = list_item_offset(syncs_[i]);
     uint32 nchar = get_lemma_nchar(offset);
     uint16 *spl = get_lemma_spell_ids(offset);
     uint16 *wrd = get_lemma_word(offset);
@@ -1906,6 +2398,159 @@ int UserDict::get_sync_lemmas_in_utf16le_string_from_beginning(
     len += need_len;
     (*count)++;
   }
+  // Lemmas skipped above can not be synced in this format either, they are
+  // cleared with the ones got.
+  sync_got_ = i;
+  sync_pull_++;
+
+  if (len > 0) {
+    if (state_ < USER_DICT_SYNC_DIRTY)
+      state_ = USER_DICT_SYNC_DIRTY;
+  }
+  return len;
+}
+
+int UserDict::put_lemmas_no_sync_from_chunk(const uint8 * chunk, int size,
+                                            int * count) {
+  *count = 0;
+  if (is_valid_state() == false || NULL == chunk)
+    return 0;
+#ifdef ___DEBUG_PERF___
+  DEBUG_PERF_BEGIN;
+#endif
+
+  // Find complete records and reserve room for them
+  int used = 0;
+  bool ended = false;
+  uint32 lemma_num = 0;
+  uint32 lemma_size = 0;
+  while (used < size) {
+    uint8 nchar = chunk[used];
+    if (nchar == 0) {
+      // End of chunk, the rest is not used
+      ended = true;
+      break;
+    }
+    if (used + 2 > size)
+      break;
+    int rec_len = 2 + chunk[used + 1] + (nchar << 1) + 6;
+    if (used + rec_len > size)
+      break;
+    lemma_num++;
+    lemma_size += (2 + (nchar << 2));
+    used += rec_len;
+  }
+  reserve(lemma_num, lemma_size);
+
+  SpellingParser spl_parser;
+  uint16 splid[kMaxLemmaSize];
+  char16 hz16[kMaxLemmaSize];
+  const uint8 * p = chunk;
+  while (p < chunk + used) {
+    uint8 nchar = p[0];
+    uint8 py_len = p[1];
+    const char * py = (const char*)(p + 2);
+    const uint8 * rec = p + 2 + py_len;
+    p = rec + (nchar << 1) + 6;
+
+    if (nchar > kMaxLemmaSize)
+      continue;
+    bool is_pre;
+    int splid_len = spl_parser.splstr_to_idxs_f(
+        py, py_len, splid, NULL, kMaxLemmaSize, is_pre);
+    if (splid_len != nchar)
+      continue;
+    memcpy(hz16, rec, nchar << 1);
+    uint16 freq;
+    memcpy(&freq, rec + (nchar << 1), 2);
+    uint32 last_mod;
+    memcpy(&last_mod, rec + (nchar << 1) + 2, 4);
+
+    if (0 != put_lemma_no_sync(hz16, splid, nchar, freq, last_mod))
+      (*count)++;
+  }
+
+#ifdef ___DEBUG_PERF___
+  DEBUG_PERF_END;
+  LOGD_PERF("put_lemmas_no_sync_from_chunk");
+#endif
+  return ended ? size : used;
+}
+
+int UserDict::get_sync_lemmas_in_chunk(uint32 * token, uint8 * chunk,
+                                       int size, int * count) {
+  int len = 0;
+  *count = 0;
+
+  if (is_valid_state() == false || NULL == token || NULL == chunk)
+    return len;
+
+  uint32 given = *token;
+  if (0 == *token) {
+    sync_pull_++;
+    if (0 == sync_pull_ || kUserDictSyncEnd == sync_pull_)
+      sync_pull_ = 1;
+    sync_got_ = 0;
+  } else if (*token != sync_pull_) {
+    *token = 0;
+    return len;
+  }
+  *token = sync_pull_;
+
+  SpellingTrie &spl_trie = SpellingTrie::get_instance();
+
+  uint8 record[kUserDictChunkMaxRecord];
+  uint32 i;
+  for (i = sync_got_; i < dict_info_.sync_count; i++) {
+    uint32 offset = list_item_offset(syncs_[i]);
+    uint8 nchar = get_lemma_nchar(offset);
+    uint16 *spl = get_lemma_spell_ids(offset);
+    uint16 *wrd = get_lemma_word(offset);
+    int score = _get_lemma_score(wrd, spl, nchar);
+
+    // Add pinyin
+    uint8 *p = record + 2;
+    uint32 j;
+    for (j = 0; j < nchar; j++) {
+      const char *py = spl_trie.get_spelling_str(spl[j]);
+      size_t py_len = strlen(py);
+      if (p + py_len + 1 > record + 2 + 255)
+        break;
+      if (j > 0)
+        *(p++) = ' ';
+      memcpy(p, py, py_len);
+      p += py_len;
+    }
+    if (j < nchar)
+      continue;
+    record[0] = nchar;
+    record[1] = (uint8)(p - record - 2);
+    // Add phrase
+    memcpy(p, wrd, nchar << 1);
+    p += (nchar << 1);
+    // Add frequency and last modified time
+    uint16 freq = extract_score_freq(score);
+    uint32 last_mod = extract_score_lmt(score);
+    memcpy(p, &freq, 2);
+    p += 2;
+    memcpy(p, &last_mod, 4);
+    p += 4;
+
+    // Write to chunk
+    int need_len = p - record;
+    if (len + need_len > size)
+      break;
+    memcpy(chunk + len, record, need_len);
+    len += need_len;
+    (*count)++;
+  }
+  sync_got_ = i;
+  if (i == dict_info_.sync_count)
+    *token = kUserDictSyncEnd;
+  else if (0 == len)
+    *token = given;
+  if (len < size)
+    chunk[len] = 0;
 
   if (len > 0) {
     if (state_ < USER_DICT_SYNC_DIRTY)
@@ -1916,6 +2561,59 @@ int UserDict::get_sync_lemmas_in_utf16le_string_from_beginning(
 
 #endif
 
+bool UserDict::reserve(uint32 count, uint32 size) {
+  if (is_valid_state() == false)
+    return false;
+  if (lemma_count_left_ >= count && lemma_size_left_ >= size)
+    return true;
+
+  size_t count_left = lemma_count_left_ > count ? lemma_count_left_ : count;
+  size_t size_left = lemma_size_left_ > size ? lemma_size_left_ : size;
+  size_t total_count = dict_info_.lemma_count + count_left;
+
+  // Arrays already enlarged are kept if a later one fails, they are only
+  // bigger than needed.
+  uint8 * lemmas = (uint8*)realloc(lemmas_,
+                                   dict_info_.lemma_size + size_left);
+  if (!lemmas)
+    return false;
+  lemmas_ = lemmas;
+
+  UserDictSlot * slots = (UserDictSlot*)realloc(
+      slots_, total_count * sizeof(UserDictSlot));
+  if (!slots)
+    return false;
+  slots_ = slots;
+
+#ifdef ___PREDICT_ENABLED___
+  uint32 * predicts = (uint32*)realloc(predicts_, total_count << 2);
+  if (!predicts)
+    return false;
+  predicts_ = predicts;
+#endif
+
+  uint32 * ids = (uint32*)realloc(ids_, total_count << 2);
+  if (!ids)
+    return false;
+  ids_ = ids;
+
+  uint32 * offsets_by_id = (uint32*)realloc(offsets_by_id_, total_count << 2);
+  if (!offsets_by_id)
+    return false;
+  offsets_by_id_ = offsets_by_id;
+
+  uint32 * offset_indexes_by_id = (uint32*)realloc(offset_indexes_by_id_,
+                                                   total_count << 2);
+  if (!offset_indexes_by_id)
+    return false;
+  offset_indexes_by_id_ = offset_indexes_by_id;
+
+  lemma_count_left_ = count_left;
+  lemma_size_left_ = size_left;
+  locate_index_rebuild();
+  return true;
+}
+
 bool UserDict::state(UserDictStat * stat) {
   if (is_valid_state() == false)
     return false;
@@ -1952,6 +2650,10 @@ void UserDict::set_limit(uint32 max_lemma_count,
   dict_info_.reclaim_ratio = reclaim_ratio;
 }
 
+void UserDict::set_prealloc(uint32 count) {
+  prealloc_ = (count > 0 ? count : 1);
+}
+
 void UserDict::reclaim() {
   if (is_valid_state() == false)
     return;
@@ -1979,7 +2681,7 @@ void UserDict::reclaim() {
   }
 
   for (int i = 0; i < rc; i++) {
-    int s = scores_[i];
+    int s = slots_[i].score;
     score_offset_pairs[i].score = s;
     score_offset_pairs[i].offset_index = i;
   }
@@ -1988,7 +2690,7 @@ void UserDict::reclaim() {
     shift_down(score_offset_pairs, i, rc);
 
   for (uint32 i = rc; i < dict_info_.lemma_count; i++) {
-    int s = scores_[i];
+    int s = slots_[i].score;
     if (s < score_offset_pairs[0].score) {
       score_offset_pairs[0].score = s;
       score_offset_pairs[0].offset_index = i;
@@ -1996,11 +2698,24 @@ void UserDict::reclaim() {
     }
   }
 
+  // Remove them in a batch, predict list and sync list are swept only once
+  // instead of once per lemma as remove_lemma_by_offset_index() does.
   for (int i = 0; i < rc; i++) {
     int off = score_offset_pairs[i].offset_index;
-    remove_lemma_by_offset_index(off);
-  }
+    uint32 offset = slots_[off].offset;
+    if (offset & kUserDictOffsetFlagRemove)
+      continue;
+    uint32 nchar = get_lemma_nchar(offset);
+    locate_index_remove(off);
+    slots_[off].offset |= kUserDictOffsetFlagRemove;
+    set_lemma_flag(offset, kUserDictLemmaFlagRemove);
+    defrag_note_removal(offset);
+    dict_info_.free_count++;
+    dict_info_.free_size += (2 + (nchar << 2));
+  }
+  sweep_removed_lemmas();
   if (rc > 0) {
+    invalidate_lpi_user();
     if (state_ < USER_DICT_OFFSET_DIRTY)
       state_ = USER_DICT_OFFSET_DIRTY;
   }
@@ -2008,6 +2723,33 @@ void UserDict::reclaim() {
   free(score_offset_pairs);
 }
 
+void UserDict::sweep_removed_lemmas() {
+#ifdef ___PREDICT_ENABLED___
+  for (uint32 i = 0; i < dict_info_.lemma_count; i++) {
+    uint32 offset = list_item_offset(predicts_[i]);
+    if (offset & kUserDictOffsetFlagRemove)
+      continue;
+    if (get_lemma_flag(offset) & kUserDictLemmaFlagRemove)
+      predicts_[i] |= kUserDictOffsetFlagRemove;
+  }
+#endif
+#ifdef ___SYNC_ENABLED___
+  uint32 dst = 0;
+  uint32 got = sync_got_;
+  for (uint32 i = 0; i < dict_info_.sync_count; i++) {
+    uint32 offset = list_item_offset(syncs_[i]);
+    if (get_lemma_flag(offset) & kUserDictLemmaFlagRemove) {
+      if (i < sync_got_)
+        got--;
+      continue;
+    }
+    syncs_[dst++] = syncs_[i];
+  }
+  dict_info_.sync_count = dst;
+  sync_got_ = got;
+#endif
+}
+
 inline void UserDict::swap(UserDictScoreOffsetPair * sop, int i, int j) {
   int s = sop[i].score;
   int p = sop[i].offset_index;
@@ -2059,9 +2801,10 @@ LemmaIdType UserDict::_put_lemma(char16 lemma_str[], uint16 splids[],
     return 0;
   int32 off = locate_in_offsets(lemma_str, splids, lemma_len);
   if (off != -1) {
-    int delta_score = count - scores_[off];
+    int delta_score = count - slots_[off].score;
     dict_info_.total_nfreq += delta_score;
-    scores_[off] = build_score(lmt, count);
+    slots_[off].score = build_score(lmt, count);
+    invalidate_lpi_lemma(splids, lemma_len);
     if (state_ < USER_DICT_SCORE_DIRTY)
       state_ = USER_DICT_SCORE_DIRTY;
 #ifdef ___DEBUG_PERF___
@@ -2108,14 +2851,14 @@ LemmaIdType UserDict::_put_lemma(char16 lemma_str[], uint16 splids[],
 #ifdef ___SYNC_ENABLED___
 void UserDict::queue_lemma_for_sync(LemmaIdType id) {
   if (dict_info_.sync_count < sync_count_size_) {
-    syncs_[dict_info_.sync_count++] = offsets_by_id_[id - start_id_];
+    syncs_[dict_info_.sync_count++] = list_item_of(id);
   } else {
     uint32 * syncs = (uint32*)realloc(
-        syncs_, (sync_count_size_ + kUserDictPreAlloc) << 2);
+        syncs_, (sync_count_size_ + prealloc_) << 2);
     if (syncs) {
-      sync_count_size_ += kUserDictPreAlloc;
+      sync_count_size_ += prealloc_;
       syncs_ = syncs;
-      syncs_[dict_info_.sync_count++] = offsets_by_id_[id - start_id_];
+      syncs_[dict_info_.sync_count++] = list_item_of(id);
     }
   }
 }
@@ -2137,7 +2880,7 @@ LemmaIdType UserDict::update_lemma(LemmaIdType lemma_id, int16 delta_count,
 
   int32 off = locate_in_offsets(lemma_str, splids, lemma_len);
   if (off != -1) {
-    int score = scores_[off];
+    int score = slots_[off].score;
     int count = extract_score_freq(score);
     uint64 lmt = extract_score_lmt(score);
     if (count + delta_count > kUserDictMaxFrequency ||
@@ -2149,7 +2892,8 @@ LemmaIdType UserDict::update_lemma(LemmaIdType lemma_id, int16 delta_count,
     if (selected) {
       lmt = time(NULL);
     }
-    scores_[off] = build_score(lmt, count);
+    slots_[off].score = build_score(lmt, count);
+    invalidate_lpi_lemma(splids, lemma_len);
     if (state_ < USER_DICT_SCORE_DIRTY)
       state_ = USER_DICT_SCORE_DIRTY;
 #ifdef ___DEBUG_PERF___
@@ -2170,6 +2914,7 @@ size_t UserDict::get_total_lemma_count() {
 
 void UserDict::set_total_lemma_count_of_others(size_t count) {
   total_other_nfreq_ = count;
+  invalidate_lpi_user();
 }
 
 LemmaIdType UserDict::append_a_lemma(char16 lemma_str[], uint16 splids[],
@@ -2187,15 +2932,14 @@ LemmaIdType UserDict::append_a_lemma(char16 lemma_str[], uint16 splids[],
         = lemma_str[i];
   }
   uint32 off = dict_info_.lemma_count;
-  offsets_[off] = offset;
-  scores_[off] = build_score(lmt, count);
+  fill_slot(slots_ + off, offset);
+  slots_[off].score = build_score(lmt, count);
   ids_[off] = id;
+  offsets_by_id_[id - start_id_] = offset;
 #ifdef ___PREDICT_ENABLED___
-  predicts_[off] = offset;
+  predicts_[off] = list_item_of(id);
 #endif
 
-  offsets_by_id_[id - start_id_] = offset;
-
   dict_info_.lemma_count++;
   dict_info_.lemma_size += (2 + (lemma_len << 2));
   lemma_count_left_--;
@@ -2208,31 +2952,32 @@ LemmaIdType UserDict::append_a_lemma(char16 lemma_str[], uint16 splids[],
 
   size_t i = 0;
   while (i < off) {
-    offset = offsets_[i];
-    uint32 nchar = get_lemma_nchar(offset);
-    uint16 * spl = get_lemma_spell_ids(offset);
-
-    if (0 <= fuzzy_compare_spell_id(spl, nchar, &searchable))
+    uint32 nchar = slots_[i].nchar;
+    if (nchar > lemma_len ||
+        (nchar == lemma_len && 0 <= compare_slot_initials(i, &searchable)))
       break;
     i++;
   }
   if (i != off) {
-    uint32 temp = offsets_[off];
-    memmove(offsets_ + i + 1, offsets_ + i, (off - i) << 2);
-    offsets_[i] = temp;
+    UserDictSlot slot = slots_[off];
+    memmove(slots_ + i + 1, slots_ + i, (off - i) * sizeof(UserDictSlot));
+    slots_[i] = slot;
 
-    temp = scores_[off];
-    memmove(scores_ + i + 1, scores_ + i, (off - i) << 2);
-    scores_[i] = temp;
-
-    temp = ids_[off];
+    uint32 temp = ids_[off];
     memmove(ids_ + i + 1, ids_ + i, (off - i) << 2);
     ids_[i] = temp;
   }
+  for (size_t k = i; k <= off; k++)
+    offset_indexes_by_id_[ids_[k] - start_id_] = k;
+
+  if (locate_tombstones_ > (locate_size_ >> 2))
+    locate_index_rebuild();
+  else
+    locate_index_insert(i);
 
 #ifdef ___PREDICT_ENABLED___
   uint32 j = 0;
-  uint16 * words_new = get_lemma_word(predicts_[off]);
+  uint16 * words_new = get_lemma_word(offset);
   j = locate_where_to_insert_in_predicts(words_new, lemma_len);
   if (j != off) {
     uint32 temp = predicts_[off];
@@ -2249,6 +2994,7 @@ LemmaIdType UserDict::append_a_lemma(char16 lemma_str[], uint16 splids[],
 #endif
 
   dict_info_.total_nfreq += count;
+  invalidate_lpi_lemma(splids, lemma_len);
   return id;
 }
 }
@@ -15,6 +15,7 @@
  */
 
 #include <stdlib.h>
+#include "../include/dictdef.h"
 #include "../include/utf16char.h"
 
 namespace ime_pinyin {
@@ -59,20 +60,62 @@ extern "C" {
     return ret_val;
   }
 
+  const char16* utf16_strntok(const char16 *utf16_str,
+                              const char16 *utf16_end, size_t *token_size,
+                              const char16 **utf16_str_next) {
+    if (NULL == utf16_str || NULL == token_size || NULL == utf16_str_next) {
+      return NULL;
+    }
+
+    // Skip the splitters
+    while (utf16_str < utf16_end &&
+           ((char16)' ' == *utf16_str || (char16)'\n' == *utf16_str ||
+            (char16)'\t' == *utf16_str))
+      utf16_str++;
+
+    size_t pos = 0;
+    while (utf16_str + pos < utf16_end && (char16)'\0' != utf16_str[pos] &&
+           (char16)' ' != utf16_str[pos] && (char16)'\n' != utf16_str[pos] &&
+           (char16)'\t' != utf16_str[pos]) {
+      pos++;
+    }
+
+    *utf16_str_next = utf16_str + pos;
+    if (0 == pos)
+      return NULL;
+
+    *token_size = pos;
+    return utf16_str;
+  }
+
   int utf16_atoi(const char16 *utf16_str) {
     if (NULL == utf16_str)
       return 0;
 
+    return utf16_strtoi(utf16_str, utf16_strlen(utf16_str));
+  }
+
+  float utf16_atof(const char16 *utf16_str) {
+    if (NULL == utf16_str)
+      return 0;
+
+    return utf16_strtod(utf16_str, utf16_strlen(utf16_str));
+  }
+
+  int utf16_strtoi(const char16 *utf16_str, size_t size) {
+    if (NULL == utf16_str)
+      return 0;
+
     int value = 0;
     int sign = 1;
     size_t pos = 0;
 
-    if ((char16)'-' == utf16_str[pos]) {
+    if (pos < size && (char16)'-' == utf16_str[pos]) {
       sign = -1;
       pos++;
     }
 
-    while ((char16)'0' <=  utf16_str[pos] &&
+    while (pos < size && (char16)'0' <=  utf16_str[pos] &&
            (char16)'9' >= utf16_str[pos]) {
       value = value * 10 + static_cast<int>(utf16_str[pos] - (char16)'0');
       pos++;
@@ -81,13 +124,70 @@ extern "C" {
     return value*sign;
   }
 
-  float utf16_atof(const char16 *utf16_str) {
-    // A temporary implemetation.
+  double utf16_strtod(const char16 *utf16_str, size_t size) {
+    if (NULL == utf16_str)
+      return 0;
+
+    // A plain decimal number with at most 15 significant digits is an exact
+    // integer divided by an exact power of 10, so one division gives the
+    // correctly rounded result, the same as strtod(). Other numbers are
+    // converted by strtod().
+    static const double kPowersOf10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    static const size_t kMaxExactDigits = 15;
+    static const size_t kMaxExactPower = 22;
+
+    size_t pos = 0;
+    bool negative = false;
+    if (pos < size && ((char16)'-' == utf16_str[pos] ||
+                       (char16)'+' == utf16_str[pos])) {
+      negative = (char16)'-' == utf16_str[pos];
+      pos++;
+    }
+
+    uint64 mantissa = 0;
+    size_t digit_num = 0;
+    size_t frac_num = 0;
+    bool has_digit = false;
+    bool has_point = false;
+    for (; pos < size && digit_num <= kMaxExactDigits; pos++) {
+      char16 ch = utf16_str[pos];
+      if ((char16)'0' <= ch && (char16)'9' >= ch) {
+        mantissa = mantissa * 10 + (ch - (char16)'0');
+        if (0 != mantissa)
+          digit_num++;
+        if (has_point)
+          frac_num++;
+        has_digit = true;
+      } else if ((char16)'.' == ch && !has_point) {
+        has_point = true;
+      } else {
+        break;
+      }
+    }
+
+    bool exact = has_digit && digit_num <= kMaxExactDigits &&
+                 frac_num <= kMaxExactPower;
+    // An exponent or a hexadecimal number is left to strtod().
+    if (exact && pos < size) {
+      char16 ch = utf16_str[pos];
+      if ((char16)'e' == ch || (char16)'E' == ch || (char16)'x' == ch ||
+          (char16)'X' == ch || ((char16)'0' <= ch && (char16)'9' >= ch))
+        exact = false;
+    }
+
+    if (exact) {
+      double value = static_cast<double>(mantissa) / kPowersOf10[frac_num];
+      return negative ? -value : value;
+    }
+
     char char8[256];
-    if (utf16_strlen(utf16_str) >= 256) return 0;
+    if (size >= 256) return 0;
 
-    utf16_strcpy_tochar(char8, utf16_str);
-    return atof(char8);
+    utf16_strncpy_tochar(char8, utf16_str, size);
+    return strtod(char8, NULL);
   }
 
   size_t utf16_strlen(const char16 *utf16_str) {
@@ -119,6 +219,16 @@ extern "C" {
     return static_cast<int>(str1[pos]) - static_cast<int>(str2[pos]);
   }
 
+  size_t utf16_strhash(const char16 *str, size_t size) {
+    // FNV-1a hash.
+    unsigned int hash = 2166136261U;
+    for (size_t pos = 0; pos < size && (char16)'\0' != str[pos]; pos++) {
+      hash ^= str[pos];
+      hash *= 16777619U;
+    }
+    return hash;
+  }
+
   // we do not consider overlapping
   char16* utf16_strcpy(char16 *dst, const char16 *src) {
     if (NULL == src || NULL == dst)
@@ -176,6 +286,17 @@ extern "C" {
     return dst;
   }
 
+  char* utf16_strncpy_tochar(char *dst, const char16 *src, size_t size) {
+    if (NULL == src || NULL == dst)
+      return NULL;
+
+    for (size_t pos = 0; pos < size; pos++)
+      dst[pos] = static_cast<char>(src[pos]);
+    dst[size] = '\0';
+
+    return dst;
+  }
+
 #ifdef __cplusplus
 }
 #endif
@@ -14,118 +14,150 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../include/dictdef.h"
 #include "../include/utf16reader.h"
 
 namespace ime_pinyin {
 
-#define MIN_BUF_LEN 128
-#define MAX_BUF_LEN 65535
-
 Utf16Reader::Utf16Reader() {
-  fp_ = NULL;
-  buffer_ = NULL;
-  buffer_total_len_ = 0;
-  buffer_next_pos_ = 0;
-  buffer_valid_len_ = 0;
+  file_buf_ = NULL;
+  file_size_ = 0;
+  mapped_ = false;
+  line_pos_ = NULL;
+  file_end_ = NULL;
 }
 
 Utf16Reader::~Utf16Reader() {
-  if (NULL != fp_)
-    fclose(fp_);
-
-  if (NULL != buffer_)
-    delete [] buffer_;
+  close();
 }
 
-
-bool Utf16Reader::open(const char* filename, size_t buffer_len) {
+bool Utf16Reader::open(const char* filename) {
   if (filename == NULL)
     return false;
 
-  if (buffer_len < MIN_BUF_LEN)
-    buffer_len = MIN_BUF_LEN;
-  else if (buffer_len > MAX_BUF_LEN)
-    buffer_len = MAX_BUF_LEN;
+  close();
 
-  buffer_total_len_ = buffer_len;
+  int fd = ::open(filename, O_RDONLY);
+  if (-1 == fd)
+    return false;
 
-  if (NULL != buffer_)
-    delete [] buffer_;
-  buffer_ = new char16[buffer_total_len_];
-  if (NULL == buffer_)
+  struct stat file_stat;
+  if (0 != fstat(fd, &file_stat) ||
+      file_stat.st_size < static_cast<off_t>(sizeof(char16))) {
+    ::close(fd);
     return false;
+  }
 
-  if ((fp_ = fopen(filename, "rb")) == NULL)
+  file_size_ = static_cast<size_t>(file_stat.st_size);
+  file_buf_ = mmap(NULL, file_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED != file_buf_) {
+    mapped_ = true;
+    madvise(file_buf_, file_size_, MADV_SEQUENTIAL);
+  } else {
+    // Read the file as a whole instead.
+    file_buf_ = malloc(file_size_);
+    size_t read_len = 0;
+    while (NULL != file_buf_ && read_len < file_size_) {
+      ssize_t ret = read(fd, static_cast<char*>(file_buf_) + read_len,
+                         file_size_ - read_len);
+      if (ret <= 0)
+        break;
+      read_len += ret;
+    }
+    if (read_len < file_size_) {
+      free(file_buf_);
+      file_buf_ = NULL;
+    }
+  }
+  ::close(fd);
+
+  if (NULL == file_buf_) {
+    close();
     return false;
+  }
 
   // the UTF16 file header, skip
-  char16 header;
-  if (fread(&header, sizeof(header), 1, fp_) != 1 || header != 0xfeff) {
-    fclose(fp_);
-    fp_ = NULL;
+  const char16 *chars = static_cast<const char16*>(file_buf_);
+  if (chars[0] != 0xfeff) {
+    close();
     return false;
   }
 
+  line_pos_ = chars + 1;
+  file_end_ = chars + file_size_ / sizeof(char16);
   return true;
 }
 
-char16* Utf16Reader::readline(char16* read_buf, size_t max_len) {
-  if (NULL == fp_ || NULL == read_buf || 0 == max_len)
+const char16* Utf16Reader::next_line(size_t *line_len) {
+  if (NULL == line_pos_ || line_pos_ >= file_end_ || NULL == line_len)
     return NULL;
 
-  size_t ret_len = 0;
-
-  do {
-    if (buffer_valid_len_ == 0) {
-      buffer_next_pos_ = 0;
-      buffer_valid_len_ = fread(buffer_, sizeof(char16),
-                                buffer_total_len_, fp_);
-      if (buffer_valid_len_ == 0) {
-        if (0 == ret_len)
-          return NULL;
-        read_buf[ret_len] = (char16)'\0';
-        return read_buf;
-      }
-    }
+  const char16 *line = line_pos_;
+  const char16 *pos = line;
+
+  // Check four characters at a time for '\n': a lane of (word ^ newlines)
+  // is 0 only if the character is '\n', and (x - 1) & ~x sets the top bit
+  // of a lane which is 0. A lane above a '\n' may be set too, so the exact
+  // position is found one character at a time.
+  const uint64 kLaneOnes = 0x0001000100010001ULL;
+  const uint64 kLaneTops = 0x8000800080008000ULL;
+  const uint64 kNewlines = kLaneOnes * static_cast<uint64>('\n');
+  while (file_end_ - pos >= 4) {
+    uint64 word;
+    memcpy(&word, pos, sizeof(word));
+    word ^= kNewlines;
+    if (0 != ((word - kLaneOnes) & ~word & kLaneTops))
+      break;
+    pos += 4;
+  }
+  while (pos < file_end_ && *pos != (char16)'\n')
+    pos++;
+
+  if (pos < file_end_) {
+    line_pos_ = pos + 1;
+    if (pos > line && *(pos - 1) == (char16)'\r')
+      pos--;
+  } else {
+    line_pos_ = file_end_;
+  }
 
-    for (size_t i = 0; i < buffer_valid_len_; i++) {
-      if (i == max_len - 1 ||
-          buffer_[buffer_next_pos_ + i] == (char16)'\n') {
-        if (ret_len + i > 0 && read_buf[ret_len + i - 1] == (char16)'\r') {
-          read_buf[ret_len + i - 1] = (char16)'\0';
-        } else {
-          read_buf[ret_len + i] = (char16)'\0';
-        }
-
-        i++;
-        buffer_next_pos_ += i;
-        buffer_valid_len_ -= i;
-        if (buffer_next_pos_ == buffer_total_len_) {
-          buffer_next_pos_ = 0;
-          buffer_valid_len_ = 0;
-        }
-        return read_buf;
-      } else {
-        read_buf[ret_len + i] = buffer_[buffer_next_pos_ + i];
-      }
-    }
+  *line_len = pos - line;
+  return line;
+}
 
-    ret_len += buffer_valid_len_;
-    buffer_valid_len_ = 0;
-  } while (true);
+char16* Utf16Reader::readline(char16* read_buf, size_t max_len) {
+  if (NULL == read_buf || 0 == max_len)
+    return NULL;
+
+  size_t line_len;
+  const char16 *line = next_line(&line_len);
+  if (NULL == line)
+    return NULL;
 
-  // Never reach here
-  return NULL;
+  if (line_len > max_len - 1)
+    line_len = max_len - 1;
+  memcpy(read_buf, line, line_len * sizeof(char16));
+  read_buf[line_len] = (char16)'\0';
+  return read_buf;
 }
 
 bool Utf16Reader::close() {
-  if (NULL != fp_)
-    fclose(fp_);
-  fp_ = NULL;
-
-  if (NULL != buffer_)
-    delete [] buffer_;
-  buffer_ = NULL;
+  if (NULL != file_buf_) {
+    if (mapped_)
+      munmap(file_buf_, file_size_);
+    else
+      free(file_buf_);
+  }
+  file_buf_ = NULL;
+  file_size_ = 0;
+  mapped_ = false;
+  line_pos_ = NULL;
+  file_end_ = NULL;
   return true;
 }
 }  // namespace ime_pinyin
@@ -21,6 +21,8 @@ import com.android.inputmethod.pinyin.IPinyinDecoderService;
 import java.io.FileDescriptor;
 import java.io.FileNotFoundException;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.List;
 import java.util.Vector;
 
@@ -63,6 +65,11 @@ public class PinyinDecoderService extends Service {
 
     native static String nativeImGetChoice(int choiceId);
 
+    native static int nativeImGetChoicesToBuffer(ByteBuffer pageBuf,
+            int choicesStart, int choicesNum);
+
+    native static int nativeImGetNBest(int num, byte[] nbest);
+
     native static int nativeImChoose(int choiceId);
 
     native static int nativeImCancelLastChoice();
@@ -73,10 +80,19 @@ public class PinyinDecoderService extends Service {
 
     native static boolean nativeImFlushCache();
 
+    native static boolean nativeImDefragmentUserDict();
+
+    native static boolean nativeImSetMemoryCap(int cap);
+
+    native static int[] nativeImGetMemoryStats();
+
     native static int nativeImGetPredictsNum(String fixedStr);
 
     native static String nativeImGetPredictItem(int predictNo);
 
+    native static int nativeImGetPredictsToBuffer(ByteBuffer pageBuf,
+            int predictsStart, int predictsNum);
+
     // Sync related
     native static String nativeSyncUserDict(byte[] user_dict, String tomerge);
 
@@ -88,6 +104,10 @@ public class PinyinDecoderService extends Service {
 
     native static int nativeSyncPutLemmas(String tomerge);
 
+    native static int nativeSyncPutLemmasChunk(byte[] chunk, int len);
+
+    native static int nativeSyncGetLemmasChunk(int token, byte[] chunk);
+
     native static int nativeSyncGetLastCount();
 
     native static int nativeSyncGetTotalCount();
@@ -97,8 +117,18 @@ public class PinyinDecoderService extends Service {
     native static int nativeSyncGetCapacity();
 
     private final static int MAX_PATH_FILE_LENGTH = 100;
+
+    // Size of the direct buffer used to get a page of candidates or
+    // predictions in one JNI call, and the maximum number of items asked
+    // in one call.
+    private final static int PAGE_BUFFER_SIZE = 8192;
+    private final static int PAGE_ITEMS_MAX = 64;
+
     private static boolean inited = false;
 
+    private final ByteBuffer mPageBuffer = ByteBuffer.allocateDirect(
+            PAGE_BUFFER_SIZE).order(ByteOrder.nativeOrder());
+
     private String mUsr_dict_file;
 
     static {
@@ -123,6 +153,48 @@ public class PinyinDecoderService extends Service {
         return true;
     }
 
+    // Get num candidates (or predicted items if candidates is false) from
+    // start, and add them to list. The native side fills mPageBuffer with
+    // (num + 1) int offsets followed by the UTF-16 strings, so that a whole
+    // page is got in one JNI call.
+    private void getPage(List<String> list, int start, int num,
+            boolean candidates) {
+        synchronized (mPageBuffer) {
+            while (num > 0) {
+                int pageNum = num < PAGE_ITEMS_MAX ? num : PAGE_ITEMS_MAX;
+                int filled;
+                if (candidates) {
+                    filled = nativeImGetChoicesToBuffer(mPageBuffer, start,
+                            pageNum);
+                } else {
+                    filled = nativeImGetPredictsToBuffer(mPageBuffer, start,
+                            pageNum);
+                }
+
+                if (filled <= 0) {
+                    // The buffer can not hold the string, get it directly.
+                    list.add(candidates ? nativeImGetChoice(start)
+                            : nativeImGetPredictItem(start));
+                    filled = 1;
+                } else {
+                    int payloadPos = (pageNum + 1) * 4;
+                    for (int i = 0; i < filled; i++) {
+                        int from = mPageBuffer.getInt(i * 4);
+                        int to = mPageBuffer.getInt((i + 1) * 4);
+                        char str[] = new char[to - from];
+                        for (int pos = from; pos < to; pos++) {
+                            str[pos - from] = mPageBuffer.getChar(payloadPos
+                                    + pos * 2);
+                        }
+                        list.add(new String(str));
+                    }
+                }
+                start += filled;
+                num -= filled;
+            }
+        }
+    }
+
     private void initPinyinEngine() {
         byte usr_dict[];
         usr_dict = new byte[MAX_PATH_FILE_LENGTH];
@@ -226,14 +298,17 @@ public class PinyinDecoderService extends Service {
         public List<String> imGetChoiceList(int choicesStart, int choicesNum,
                 int sentFixedLen) {
             Vector<String> choiceList = new Vector<String>();
-            for (int i = choicesStart; i < choicesStart + choicesNum; i++) {
-                String retStr = nativeImGetChoice(i);
-                if (0 == i) retStr = retStr.substring(sentFixedLen);
-                choiceList.add(retStr);
+            getPage(choiceList, choicesStart, choicesNum, true);
+            if (0 == choicesStart && choiceList.size() > 0) {
+                choiceList.set(0, choiceList.get(0).substring(sentFixedLen));
             }
             return choiceList;
         }
 
+        public int imGetNBest(int num, byte[] nbest) {
+            return nativeImGetNBest(num, nbest);
+        }
+
         public int imChoose(int choiceId) {
             return nativeImChoose(choiceId);
         }
@@ -254,6 +329,18 @@ public class PinyinDecoderService extends Service {
             nativeImFlushCache();
         }
 
+        public boolean imDefragmentUserDict() {
+            return nativeImDefragmentUserDict();
+        }
+
+        public boolean imSetMemoryCap(int cap) {
+            return nativeImSetMemoryCap(cap);
+        }
+
+        public int[] imGetMemoryStats() {
+            return nativeImGetMemoryStats();
+        }
+
         public int imGetPredictsNum(String fixedStr) {
             return nativeImGetPredictsNum(fixedStr);
         }
@@ -264,9 +351,7 @@ public class PinyinDecoderService extends Service {
 
         public List<String> imGetPredictList(int predictsStart, int predictsNum) {
             Vector<String> predictList = new Vector<String>();
-            for (int i = predictsStart; i < predictsStart + predictsNum; i++) {
-                predictList.add(nativeImGetPredictItem(i));
-            }
+            getPage(predictList, predictsStart, predictsNum, false);
             return predictList;
         }
 
@@ -302,6 +387,14 @@ public class PinyinDecoderService extends Service {
             return nativeSyncGetLemmas();
         }
 
+        public int syncPutLemmasChunk(byte[] chunk, int len) {
+            return nativeSyncPutLemmasChunk(chunk, len);
+        }
+
+        public int syncGetLemmasChunk(int token, byte[] chunk) {
+            return nativeSyncGetLemmasChunk(token, chunk);
+        }
+
         public int syncGetLastCount() {
             return nativeSyncGetLastCount();
         }
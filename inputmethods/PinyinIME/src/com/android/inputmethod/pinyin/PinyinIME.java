@@ -102,6 +102,12 @@ public class PinyinIME extends InputMethodService {
      */
     private PopupTimer mFloatingWindowTimer = new PopupTimer();
 
+    /**
+     * Used to defragment the user dictionary while no input view is shown.
+     */
+    private UserDictDefragmenter mUserDictDefragmenter =
+            new UserDictDefragmenter();
+
     /**
      * View to show candidates list.
      */
@@ -203,6 +209,7 @@ public class PinyinIME extends InputMethodService {
         if (mEnvironment.needDebug()) {
             Log.d(TAG, "onDestroy.");
         }
+        mUserDictDefragmenter.cancel();
         unbindService(mPinyinDecoderServiceConnection);
         Settings.releaseInstance();
         super.onDestroy();
@@ -1122,6 +1129,7 @@ public class PinyinIME extends InputMethodService {
                     + String.valueOf(editorInfo.inputType) + " Restarting:"
                     + String.valueOf(restarting));
         }
+        mUserDictDefragmenter.cancel();
         updateIcon(mInputModeSwitcher.requestInputWithSkb(editorInfo));
         resetToIdleState(false);
         mSkbContainer.updateInputMode();
@@ -1134,6 +1142,7 @@ public class PinyinIME extends InputMethodService {
             Log.d(TAG, "onFinishInputView.");
         }
         resetToIdleState(false);
+        mUserDictDefragmenter.start();
         super.onFinishInputView(finishingInput);
     }
 
@@ -1276,6 +1285,36 @@ public class PinyinIME extends InputMethodService {
         }
     }
 
+    /**
+     * Defragments the user dictionary a small step at a time, so that removed
+     * lemmas are not compacted all at once when the decoder is closed.
+     */
+    private class UserDictDefragmenter extends Handler implements Runnable {
+        /**
+         * Delay before the first step and between two steps, in ms.
+         */
+        private static final int STEP_DELAY = 100;
+
+        void start() {
+            removeCallbacks(this);
+            postDelayed(this, STEP_DELAY);
+        }
+
+        void cancel() {
+            removeCallbacks(this);
+        }
+
+        public void run() {
+            if (null == mDecInfo.mIPinyinDecoderService) return;
+            try {
+                if (!mDecInfo.mIPinyinDecoderService.imDefragmentUserDict()) {
+                    postDelayed(this, STEP_DELAY);
+                }
+            } catch (RemoteException e) {
+            }
+        }
+    }
+
     /**
      * Used to notify IME that the user selects a candidate or performs an
      * gesture.